@@ -0,0 +1,96 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   AllocScope.hpp                                     :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/26 10:05:44 by astein            #+#    #+#             */
+/*   Updated: 2024/05/26 10:05:44 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef ALLOCSCOPE_HPP
+#define ALLOCSCOPE_HPP
+
+#include <cstddef>
+
+// Allocation counting (only in the build of "make alloc")
+// -----------------------------------------------------------------------------
+// That build replaces the global operator new/delete and malloc/free and
+// counts every allocation for the scope the loop is in: an AllocScope names
+// the scope until it goes out of scope again (the innermost one wins).
+// STATS a shows the counts, so the number of allocations a command costs
+// can be read before and after sending it (e.g. a channel PRIVMSG in the
+// steady state should cost none in fan-out).
+// In the normal build an AllocScope is an empty object and costs nothing.
+enum AllocScopeId
+{
+	ALLOC_OTHER,		// timers, accept, setup, ...
+	ALLOC_RECV,			// reading the sockets
+	ALLOC_PARSE,		// splitting and checking a line
+	ALLOC_DISPATCH,		// the command handlers
+	ALLOC_FANOUT,		// queueing the lines for the receivers
+	ALLOC_FLUSH,		// sending the sendqs
+	ALLOC_LOGGING,		// the log file
+	ALLOC_SCOPES
+};
+
+#ifdef ALLOC_TRACKING
+
+class AllocScope
+{
+	public:
+		struct Stats
+		{
+			unsigned long	allocations;
+			unsigned long	bytes;
+			unsigned long	frees;
+		};
+
+		explicit AllocScope(AllocScopeId scope);
+		~AllocScope();
+
+		static void			countAllocation(size_t size);
+		static void			countFree();
+		static const Stats	&getStats(int scope);
+		static const char	*getName(int scope);
+		static bool			isEnabled();
+
+	private:
+		AllocScope();
+		AllocScope(const AllocScope &other);
+		AllocScope	&operator=(const AllocScope &other);
+
+		AllocScopeId		_previous;
+
+		static AllocScopeId	_current;
+		static Stats		_stats[ALLOC_SCOPES];
+};
+
+#else
+
+class AllocScope
+{
+	public:
+		struct Stats
+		{
+			unsigned long	allocations;
+			unsigned long	bytes;
+			unsigned long	frees;
+		};
+
+		explicit AllocScope(AllocScopeId) {}
+
+		static const Stats	&getStats(int)
+		{
+			static const Stats none = {0, 0, 0};
+			return none;
+		}
+		static const char	*getName(int)	{ return ""; }
+		static bool			isEnabled()		{ return false; }
+};
+
+#endif
+
+#endif
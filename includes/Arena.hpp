@@ -0,0 +1,75 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Arena.hpp                                          :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/18 17:55:03 by astein            #+#    #+#             */
+/*   Updated: 2024/05/18 17:55:03 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+
+// Bump allocator for memory which only lives for one loop iteration
+// -----------------------------------------------------------------------------
+// allocate() just moves a pointer forward, reset() gives everything back
+// at once. If one block wasn't enough, reset() replaces the blocks by one
+// block big enough for all of them, so in the steady state an iteration
+// never touches the heap. What is kept is capped by ARENA_RETAIN_MAX: after
+// a burst (a big LIST or WHO) the arena shrinks back to that.
+#define ARENA_BLOCK_SIZE	16384
+#define ARENA_RETAIN_MAX	262144	// bytes kept over a reset
+
+class Arena
+{
+	public:
+		Arena(size_t blockSize = ARENA_BLOCK_SIZE);
+		~Arena();
+
+		// The arena of the current loop iteration (reset by the server)
+		static Arena	&frame();
+
+		void	*allocate(size_t size);
+		template <typename T>
+		T		*allocateArray(size_t count)
+		{
+			return static_cast<T *>(allocate(count * sizeof(T)));
+		}
+		void	reset();
+
+		// Stats
+		size_t			getCapacity()	const;
+		size_t			getPeak()		const;
+		unsigned long	getResets()		const;
+		unsigned long	getGrows()		const;
+		unsigned long	getTrims()		const;	// resets which gave memory back
+
+	private:
+		Arena(const Arena &other);
+		Arena	&operator=(const Arena &other);
+
+		struct Block
+		{
+			Block	*next;
+			size_t	size;
+			size_t	used;
+		};
+
+		Block	*newBlock(size_t size);
+		void	freeBlocks();
+
+		Block			*_head;		// the block allocate() cuts from
+		size_t			_blockSize;
+		size_t			_used;		// bytes of this iteration
+		size_t			_peak;
+		unsigned long	_resets;
+		unsigned long	_grows;
+		unsigned long	_trims;
+};
+
+#endif
@@ -0,0 +1,84 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Atom.hpp                                           :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/19 11:02:14 by astein            #+#    #+#             */
+/*   Updated: 2024/05/19 11:02:14 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef ATOM_HPP
+#define ATOM_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// Interned names
+// -----------------------------------------------------------------------------
+// Nicks and channel names are interned once into a table that keeps the
+// casefolded spelling (RFC 1459: A-Z == a-z, [] == {}, \ == |, ~ == ^) and
+// its hash. An Atom is a reference counted handle to such an entry, so two
+// names are the same IRC identity exactly when their atom ids are equal.
+// Entries are dropped when the last Atom referring to them goes away and
+// their ids are reused.
+class Atom
+{
+	public:
+		Atom();										// the empty atom (id 0)
+		explicit Atom(const std::string &name);		// interns the name
+		Atom(const Atom &other);
+		Atom	&operator=(const Atom &other);
+		~Atom();
+
+		// Existing atom of a name or the empty atom (never interns)
+		static Atom			find(const std::string &name);
+
+		bool				operator==(const Atom &other) const;
+		bool				operator!=(const Atom &other) const;
+		bool				operator<(const Atom &other) const;
+
+		bool				empty()		const;
+		unsigned int		id()		const;
+		unsigned int		hash()		const;
+		const std::string	&folded()	const;
+
+		// Helpers for names that are not interned
+		static unsigned int	hashOf(const char *name, size_t len);
+		static bool			equalFolded(const std::string &a, const std::string &b);
+		static std::string	fold(const std::string &name);
+		static char			foldByte(char c);
+
+		// Stats
+		static size_t		count();
+		static size_t		bucketCount();
+
+	private:
+		struct Entry
+		{
+			Entry() : hash(0), refs(0), next(0) {}
+
+			std::string		folded;
+			unsigned int	hash;
+			unsigned int	refs;
+			unsigned int	next;		// next id in the bucket chain (0 = end)
+		};
+
+		static unsigned int	lookup(const char *name, size_t len, unsigned int hash);
+		static unsigned int	intern(const std::string &name);
+		static void			retain(unsigned int id);
+		static void			release(unsigned int id);
+		static void			rehash(size_t buckets);
+
+		static std::vector<Entry>			_entries;	// index 0 is the empty atom
+		static std::vector<unsigned int>	_buckets;
+		static std::vector<unsigned int>	_freeIds;
+		static size_t						_count;
+
+		unsigned int		_id;
+};
+
+#endif
@@ -16,13 +16,30 @@
 #include <iostream>
 #include <string>
 #include <map>
+#include <set>
 #include "Client.hpp"
 #include "Server.hpp"
 #include "utils.hpp"
+#include "Pool.hpp"
+#include "Atom.hpp"
+#include "Snapshot.hpp"
+#include "History.hpp"
+#include "MaskList.hpp"
+#include "Reply.hpp"
 
 class Client;
 class Server;
 
+typedef std::map<Client *, int, std::less<Client *>, PoolAllocator<std::pair<Client * const, int> > >	ClientStateMap;
+typedef std::map<unsigned long, long>	InviteMap;	// invited connection -> expiry (monotonicMs)
+
+// Invites live apart from the members and run out
+#define INVITE_TTL_MS		3600000	// an invite is good for an hour
+#define INVITE_MAX			64		// open invites of one channel
+
+// Masks of one +b, +e or +I list
+#define MASKLIST_MAX		4096
+
 class Channel
 {
     public:
@@ -37,16 +54,19 @@ class Channel
 
 		// So the Server can check if the Channel still has an operator
 		bool	isActive() const;
+		bool	isLobby() const;
 
 		// Members & Operators funtionality
 		void	joinChannel 	(Client *client, const std::string &pswd);
 		void	inviteToChannel	(Client *host, Client *guest);
 		void	kickFromChannel	(Client *kicker, Client *kicked, const std::string &reason);		
 		void	partChannel		(Client *client, const std::string &reason);
+		bool	canSend			(const Client *client);
+		void	dropInvite		(const Client *client);
 
 		// Modes & Topic funtionality
 		void	topicOfChannel(Client *sender, const std::string &topic);
-		void	modeOfChannel(Client *client, const std::string &flag, const std::string &value, Server *server);
+		void	modeOfChannel(Client *client, const std::string &modes, const std::vector<std::string> &params, Server *server);
 		
 		// Simple Map Management
 		void	removeClient	(Client *client);
@@ -55,8 +75,29 @@ class Channel
         void	sendMessageToClients(const std::string &ircMessage, Client *sender = NULL) const;
 		void 	sendWhoMessage(Client *receiver) const;
 
+		// Server links (burst of the channel state to another server)
+		const std::string	getBurstModes()	const;
+		const std::string	&getTopic()		const;
+		const std::string	&getTopicChange() const;
+		void	applyBurstModes	(const std::string &flags, const std::string &key, int limit);
+		void	applyBurstTopic	(const std::string &topic, const std::string &topicChange);
+		void	burstJoin		(Client *client, bool op);
+
+		// Snapshots (state which survives a restart)
+		void	getSnapshot	(Snapshot::Record &record) const;
+		void	restore		(const Snapshot::Record &record);
+
+		// Hot upgrade (the members move to the new binary unnoticed)
+		const ClientStateMap	&getMembers() const;
+		void	resumeMember	(Client *client, int state);
+
+		// Message history (CHATHISTORY)
+		void	addHistory	(int type, const Client *client, const std::string &text);
+		void	sendHistory	(Client *receiver, uint64_t after, uint64_t before, size_t limit, bool newest) const;
+
 		// Getters and Setters
 		const std::string	&getUniqueName() const;
+		const Atom			&getAtom() const;
 		const std::string	getClientList()	const;
 
 		// LOG
@@ -72,10 +113,17 @@ class Channel
 
 		// For the basic channel functionality
 		int					getClientState(const Client *client) const;
+		bool				isInvited(const Client *client);
+		void				addInvite(Client *client);
+		bool				isBanned(const Client *client);
+		MaskList			&getMaskList(char mode);
+		void				sendMaskList(Client *receiver, char mode);
+		static Reply		maskListReply(char mode, const std::string &nick, bool end);
 		std::string			getChannelFlags();
 
         Channel();									// Default Constructor shouldn't be used
         const std::string		_channelName;
+		const Atom				_atom;				// casefolded identity of the name
         std::string				_topic;
         std::string				_topicChange;
         std::string				_key;				// empty string means no password
@@ -83,11 +131,26 @@ class Channel
         bool					_inviteOnly;
         bool					_topicProtected;
 		
-		// A CLIENT CAN ONLY BE AT ONE LIST AT A TIME!
-		#define STATE_I	0	// INVITED
 		#define STATE_C	1	// CLIENT
 		#define STATE_O	2	// OPERATOR
-		std::map<Client *, int>	_clients;
+		ClientStateMap			_clients;			// only the members, so broadcasts don't skip anyone
+		InviteMap				_invites;
+		std::set<std::string>	_pendingOps;		// casefolded hostmasks of the snapshot's operators which didn't join yet
+		History					_history;
+
+		// +b, +e and +I; whether a member is banned is remembered until its
+		// hostmask (see Client::getMaskSerial) or the +b or +e list changes
+		struct BanCache
+		{
+			unsigned long	maskSerial;
+			unsigned long	generation;
+			bool			banned;
+		};
+		MaskList				_bans;
+		MaskList				_excepts;
+		MaskList				_inviteExcepts;
+		unsigned long			_banGeneration;
+		std::map<const Client *, BanCache>	_banCache;	// members only
 };
 
 #endif
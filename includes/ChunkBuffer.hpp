@@ -0,0 +1,63 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   ChunkBuffer.hpp                                    :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/18 18:31:44 by astein            #+#    #+#             */
+/*   Updated: 2024/05/18 18:31:44 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef CHUNKBUFFER_HPP
+#define CHUNKBUFFER_HPP
+
+#include <string>
+#include <cstddef>
+
+// Byte queue made of fixed size chunks from the pool
+// -----------------------------------------------------------------------------
+// Used for the input and output buffers of the clients. Appending never
+// moves the data which is already queued and consumed chunks go straight
+// back to the pool, so an idle connection holds no buffer memory at all.
+#define IO_CHUNK_SIZE	1024	// one chunk incl. its header (a pool size class)
+
+class ChunkBuffer
+{
+	public:
+		ChunkBuffer();
+		ChunkBuffer(const ChunkBuffer &other);
+		ChunkBuffer	&operator=(const ChunkBuffer &other);
+		~ChunkBuffer();
+
+		void		append(const char *data, size_t len);
+		void		append(const std::string &str);
+		void		consume(size_t len);
+		void		clear();
+
+		bool		empty()			const;
+		size_t		size()			const;
+		size_t		chunkCount()	const;
+		size_t		find(char c)	const;		// std::string::npos if not found
+		std::string	copyFront(size_t len)	const;	// a copy of the first len bytes
+
+		// The first contiguous piece of data (e.g. for send())
+		const char	*front(size_t &len)	const;
+
+	private:
+		struct Chunk
+		{
+			Chunk	*next;
+			size_t	begin;
+			size_t	end;
+			char	data[IO_CHUNK_SIZE - sizeof(Chunk *) - 2 * sizeof(size_t)];
+		};
+
+		Chunk	*_head;
+		Chunk	*_tail;
+		size_t	_size;
+		size_t	_chunks;
+};
+
+#endif
@@ -19,11 +19,25 @@
 #include <set>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
 #include "Channel.hpp"
+#include "TimerWheel.hpp"
+#include "ChunkBuffer.hpp"
+#include "Pool.hpp"
+#include "Atom.hpp"
 #include "codes.hpp"
+#include "Reply.hpp"
 
 class Channel;
 
+typedef std::list<Channel *, PoolAllocator<Channel *> >	ChannelPtrList;
+
+// IRCv3 capabilities a client can ask for with CAP REQ (bits of getCaps())
+#define CAP_BATCH			0x1		// history comes in a BATCH
+#define CAP_SERVER_TIME		0x2		// time= tags
+#define CAP_MESSAGE_TAGS	0x4		// msgid= tags
+#define CAP_CHATHISTORY		0x8		// draft/chathistory
+
 class NickNameException : public std::exception
 {
 	public:
@@ -52,14 +66,79 @@ class Client
         void                    removeChannel(Channel *channel);		
 
 		// Read message from client to buffer
-		bool					appendBuffer(const char *buffer);
+		bool					appendBuffer(const char *buffer, size_t len);
 
 		// Get the full message from the buffer
+		bool					hasFullMessage()	const;
+		std::string				peekCommand()		const;
 		std::string				getFullMessage();
+		size_t					getInputBacklog()	const;
+
+		// Flood control (token bucket)
+		bool					consumeFloodTokens(int cost);
+		bool					isThrottled()		const;
+		void					setThrottled(bool throttled);
+
+		// Liveness (registration timeout, PING after idle, PONG timeout)
+		Timer					&getLivenessTimer();
+		void					touch();
+		long					getIdleMs()			const;
+		bool					isPingPending()		const;
+		void					setPingPending(bool pending);
+		bool					isRegistered()		const;
+
+		// IRCv3 capabilities; while they are negotiated (CAP LS or REQ before
+		// the registration) the client isn't registered until CAP END
+		unsigned				getCaps()			const;
+		bool					hasCap(unsigned cap) const;
+		void					setCaps(unsigned caps);
+		bool					isNegotiatingCaps()	const;
+		void					setNegotiatingCaps(bool negotiating);
+
+		// Server links: a link is a connection to another server, a remote
+		// client is a user of another server which is reached via _uplink
+		void					setServerLink(const std::string &name);	// name stays empty until the handshake is done
+		bool					isServerLink()		const;
+		const std::string		&getLinkName()		const;
+		void					setUplink(Client *link);
+		Client					*getUplink()		const;
+		bool					isRemote()			const;
+
+		// Hot upgrade: the unprocessed input and the unsent output move along
+		std::string				getPendingInput()	const;
+		std::string				getPendingOutput()	const;
+		void					restoreBuffers(const std::string &input, const std::string &output);
+
+		// Memory accounting: what the connection holds (see STATS m); an
+		// idle client gives back the slack of its strings
+		struct MemoryUsage
+		{
+			size_t	object;		// the client in the node of its list
+			size_t	strings;	// heap bytes of the names
+			size_t	buffers;	// chunks of the input and output
+			size_t	channels;	// nodes of the channel list
+		};
+		MemoryUsage				getMemoryUsage()	const;
+		size_t					compact();
+
+		// Visiting the neighbours (the clients which share a channel)
+		bool					markEpoch(unsigned long epoch);
+		const ChannelPtrList	&getChannels()		const;
 
-		// Send message to client
-        void                    sendMessage(const std::string &ircMessage) const;
-        void                    sendMessage(const std::string &code, const std::string &message) const;
+		// Disconnect handling (the server reaps marked clients after each loop)
+		void					markForDisconnect(const std::string &reason);
+		bool					isMarkedForDisconnect()	const;
+		const std::string		&getDisconnectReason()	const;
+
+		// Send message to client (queued and flushed as far as the socket allows)
+        void                    sendMessage(const std::string &ircMessage);
+        void                    sendMessage(const std::string &code, const std::string &message);
+		void					sendReply(const Reply &reply);
+		bool					flushOutput();
+		bool					hasPendingOutput()	const;
+		bool					isOutputBlocked()	const;	// the socket was full at the last flush
+		size_t					getSendQueueSize()	const;
+		size_t					getSendQueuePeak()	const;
         void 					sendWhoIsMsg(Client *reciever) const;
 		
 		// Setters
@@ -68,29 +147,77 @@ class Client
         void					setUsername(const std::string &username);
         void					setFullname(const std::string &fullname);
         void                    setHostname(const std::string &hostname);
+		void					setPeerAddress(const struct sockaddr_storage &address);
 
 		// Getters
 		int						getSocketFd()		const;
 		bool					isAuthenticated()	const;	
         const std::string		&getUniqueName()	const;
+		const Atom				&getAtom()			const;	// casefolded identity of the nick
         const std::string		&getUsername()		const;
         const std::string		&getFullname()		const;
         const std::string		&getHostname()		const;
+		struct sockaddr_storage	getPeerAddress()	const;
 		const std::string		getChannelList()	const;
+		const std::string		getHostmask()		const;	// "nick!user@host" for the channel masks
+		unsigned long			getMaskSerial()		const;	// changes with the hostmask
+		unsigned long			getConnectionId()	const;	// the invites are kept by it
+		bool					hasInvites()		const;	// maybe invited somewhere
+		void					setInvited(bool invited);
 
 		// LOG
 		void					logClient() const;
 
     private:
         Client();
+		void					queueLine(const char *line, size_t len);
+
         int						_socketFd;
-		std::string				_inputBuffer;
+		ChunkBuffer				_inputBuffer;
 		bool					_authenticated;
         std::string			   	_nickname;
+		Atom					_nickAtom;
         std::string         	_username;	// Can only be changed when connecting to server!
         std::string				_fullname;	// Can only be changed when connecting to server!
         std::string         	_hostname;	// Can only be changed when connecting to server!
-        std::list<Channel *>	_channels;
+		union
+		{
+			struct sockaddr_in	v4;
+			struct sockaddr_in6	v6;
+		}						_peerAddress;	// a sockaddr_storage would be 100 bytes more per client
+        ChannelPtrList			_channels;
+
+		// Flood control: tokens are stored in 1/1000 of a token
+		long					_floodTokens;
+		long					_floodLastRefill;
+		bool					_floodThrottled;
+
+		// SendQ: output the socket didn't accept yet
+		ChunkBuffer				_outputBuffer;
+		size_t					_sendqPeak;
+		bool					_outputBlocked;
+
+		// Liveness
+		Timer					_livenessTimer;
+		long					_lastActivity;
+		bool					_pingPending;
+
+		// IRCv3 capabilities
+		unsigned				_caps;
+		bool					_negotiatingCaps;
+
+		// Server links
+		bool					_serverLink;
+		std::string				_linkName;
+		Client					*_uplink;
+
+		bool					_markedForDisconnect;
+		std::string				_disconnectReason;
+
+		unsigned long			_epoch;		// of the last visit (see markEpoch)
+		unsigned long			_maskSerial;
+		unsigned long			_connectionId;
+		bool					_invited;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,96 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   ConnectionLimiter.hpp                              :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/17 14:26:53 by astein            #+#    #+#             */
+/*   Updated: 2024/05/17 14:26:53 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef CONNECTIONLIMITER_HPP
+#define CONNECTIONLIMITER_HPP
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+// Per source address admission control
+// -----------------------------------------------------------------------------
+// IPv4 hosts are tracked by their full address, IPv6 hosts by their /64
+// (one end user usually gets a whole /64). For every host the table keeps
+//	- the number of open connections
+//	- a token bucket limiting how fast the host may (re)connect
+//
+// The table uses open addressing with linear probing, so an entry is just a
+// few bytes in one flat array. Hosts without connections are dropped once
+// their bucket is full again.
+#define IP_MAX_CONNECTIONS	10		// concurrent connections per host
+#define IP_CONNECT_BURST	10		// connects a host may do at once
+#define IP_CONNECT_RATE_MS	2000	// one more connect every ... ms
+
+class ConnectionLimiter
+{
+	public:
+		enum Verdict
+		{
+			ADMIT,
+			TOO_MANY_CONNECTIONS,
+			TOO_FAST
+		};
+
+		// The part of an address the limits apply to
+		struct HostKey
+		{
+			uint64_t	prefix;
+			int			family;
+		};
+
+		ConnectionLimiter();
+		~ConnectionLimiter();
+
+		static HostKey		keyOf(const struct sockaddr_storage &addr);
+		static std::string	addressToString(const struct sockaddr_storage &addr);
+
+		// Has to be called for every accepted connection, and release()
+		// for every admitted one when it's closed
+		Verdict	admit(const HostKey &key, long nowMs);
+		void	release(const HostKey &key);
+		void	restore(const HostKey &key, long nowMs);	// a connection a hot upgrade took over
+
+		// Stats
+		size_t			getHostCount()	const;
+		size_t			getCapacity()	const;
+		unsigned long	getRejected(Verdict reason)	const;
+
+	private:
+		ConnectionLimiter(const ConnectionLimiter &other);
+		ConnectionLimiter	&operator=(const ConnectionLimiter &other);
+
+		struct Entry
+		{
+			uint64_t		prefix;
+			long			lastRefill;		// ms
+			int32_t			tokens;			// 1/1000 connects
+			uint16_t		connections;
+			uint8_t			family;
+			uint8_t			used;
+		};
+
+		static size_t	hash(const HostKey &key);
+		long			find(const HostKey &key) const;
+		Entry			&insert(const HostKey &key, long nowMs);
+		void			refill(Entry &entry, long nowMs) const;
+		void			purgeIdle(long nowMs);
+
+		std::vector<Entry>	_table;		// size is a power of 2
+		size_t				_used;
+		unsigned long		_rejectedTooMany;
+		unsigned long		_rejectedTooFast;
+};
+
+#endif
@@ -0,0 +1,52 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Glob.hpp                                           :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/24 14:03:18 by astein            #+#    #+#             */
+/*   Updated: 2024/05/24 14:03:18 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef GLOB_HPP
+#define GLOB_HPP
+
+#include <string>
+#include <vector>
+
+// IRC mask ('*' any run, '?' one char), compiled once per query
+// -----------------------------------------------------------------------------
+// The mask is casefolded like the names (see Atom) and cut at the stars:
+// the part before the first star has to be at the start, the part after the
+// last one at the end, so only the parts in between are searched for (from
+// the left, jumping to the next place where their first char fits).
+// getPrefix() is the literal start of the mask, which an index of sorted
+// names can use to skip everything which can't match; getSuffix() is the
+// literal end of a mask with a star (empty without one).
+class Glob
+{
+	public:
+		explicit Glob(const std::string &mask);
+
+		bool				match(const std::string &subject) const;
+		const std::string	&getPrefix() const;
+		const std::string	&getSuffix() const;
+
+	private:
+		Glob();
+
+		static bool	matchAt(const std::string &subject, size_t pos, const std::string &part);
+		static bool	isWild(char c);
+
+		bool						_hasStar;
+		std::string					_head;		// before the first star
+		std::string					_tail;		// after the last star
+		std::vector<std::string>	_middle;	// between the stars
+		std::string					_prefix;	// _head up to the first '?'
+		std::string					_suffix;	// _tail from the last '?'
+		size_t						_minLength;
+};
+
+#endif
@@ -0,0 +1,122 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   History.hpp                                        :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/22 18:27:51 by astein            #+#    #+#             */
+/*   Updated: 2024/05/22 18:27:51 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef HISTORY_HPP
+#define HISTORY_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <stdint.h>
+
+// Recent events of one channel (PRIVMSG, TOPIC, JOIN, PART)
+// -----------------------------------------------------------------------------
+// The events live in a buffer of HISTORY_RING_BYTES which is only allocated
+// with the first event. When it's full the oldest quarter is spilled to
+// segment files in HISTORY_DIR (read back with mmap) and the oldest segment
+// is deleted once a channel has HISTORY_SEGMENTS of them. All buffers together
+// never take more than HISTORY_MEMORY_MAX; a channel which doesn't get a buffer
+// anymore writes its events straight to its segments.
+// Event:	length | time delta (ms) | type u8 | source length | source | text
+// (all numbers are varints; the delta is to the event before in the buffer or
+// segment, the first event of a segment has the absolute time)
+// Every event gets an id (1, 2, ... per channel) which is used for paging.
+#define HISTORY_RING_BYTES		16384				// per channel
+#define HISTORY_MEMORY_MAX		(8 * 1024 * 1024)	// all channels
+#define HISTORY_DIR				"history"
+#define HISTORY_SEGMENT_BYTES	262144
+#define HISTORY_SEGMENTS		4					// per channel
+#define HISTORY_TEXT_MAX		510
+
+class History
+{
+	public:
+		enum Type
+		{
+			EVENT_PRIVMSG,
+			EVENT_TOPIC,
+			EVENT_JOIN,
+			EVENT_PART
+		};
+
+		struct Event
+		{
+			uint64_t	id;
+			long		time;		// ms since the epoch
+			int			type;
+			std::string	source;		// nick!user@host
+			std::string	text;
+		};
+
+		History(const std::string &channelName);
+		History(const History &other);
+		~History();
+
+		void	add(int type, const std::string &source, const std::string &text);
+
+		// The events with after < id < before: the newest limit ones if
+		// newest is set, else the oldest ones (in order of their ids)
+		void	query(uint64_t after, uint64_t before, size_t limit, bool newest, std::vector<Event> &events) const;
+
+		// The segment files of an earlier run (returns how many were removed)
+		static size_t			removeSegments();
+
+		// Stats (of all channels)
+		static size_t			getBufferCount();
+		static size_t			getMemoryUsed();
+		static unsigned long	getSpilled();
+		static unsigned long	getDropped();
+
+	private:
+		History();
+		History	&operator=(const History &other);
+
+		struct Segment
+		{
+			unsigned	number;		// of the file name
+			uint64_t	firstId;
+			uint64_t	count;
+			size_t		bytes;
+		};
+
+		bool			allocateBuffer();
+		void			evict(size_t bytes);
+		void			spill(const std::vector<Event> &events);
+		bool			startSegment(uint64_t firstId);
+		std::string		getSegmentPath(unsigned number) const;
+		void			readSegment(const Segment &segment, uint64_t from, uint64_t to, std::vector<Event> &events) const;
+		static void		decodeRange(const char *data, size_t size, uint64_t firstId, const long *firstTime,
+							uint64_t from, uint64_t to, std::vector<Event> &events);
+
+		static void		encode(std::string &out, long delta, int type, const std::string &source, const std::string &text);
+		static size_t	skim(const char *data, size_t size, long &delta);
+		static size_t	decode(const char *data, size_t size, long &delta, Event &event);
+
+		std::string			_fileName;		// hex of the casefolded channel name
+		char				*_buffer;		// NULL until the first event
+		size_t				_used;
+		uint64_t			_firstId;		// of the first event in the buffer
+		uint64_t			_nextId;
+		long				_firstTime;		// of the first event in the buffer
+		long				_lastTime;		// of the last event in the buffer
+
+		std::deque<Segment>	_segments;
+		unsigned			_nextSegment;
+		long				_spillTime;		// of the last event in the newest segment
+
+		static size_t			_memoryUsed;
+		static size_t			_buffers;
+		static unsigned long	_spilled;
+		static unsigned long	_dropped;
+};
+
+#endif
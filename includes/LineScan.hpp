@@ -0,0 +1,93 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   LineScan.hpp                                       :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/23 21:10:37 by astein            #+#    #+#             */
+/*   Updated: 2024/05/23 21:10:37 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef LINESCAN_HPP
+#define LINESCAN_HPP
+
+#include <string>
+#include <stdint.h>
+
+// One pass over an incoming line: tokens and validation
+// -----------------------------------------------------------------------------
+// Every byte is classified once with a table; the trailing text (the bulk of a
+// PRIVMSG) is skipped 16 bytes at a time with SSE2 (8 with plain 64 bit words
+// without it) as long as it's printable ASCII. Multibyte characters have to
+// be well-formed UTF-8. The spans of the tokens are kept, so Message doesn't
+// have to split the line again.
+//	- NUL is never allowed, other control bytes only in the trailing text
+//	  (CTCP and the usual formatting codes)
+//	- the first three args must not contain ' " : \ # (unless they're lists)
+//	- a channel ("#..." or an element of a list) needs a name without
+//	  ' " : or a backslash
+#define LINE_TOKENS_MAX	32	// command + params, more are ignored
+
+class LineScan
+{
+	public:
+		enum Verdict
+		{
+			LINE_OK,
+			LINE_CONTROL,		// NUL or a control byte outside the trailing text
+			LINE_ENCODING,		// not UTF-8
+			LINE_BAD_ARG,
+			LINE_BAD_CHANNEL	// see getBadStart() and getBadLength()
+		};
+
+		// How the trailing text is skipped; the tests compare the three
+		enum Chunking
+		{
+			CHUNK_SSE2,			// the default (words without SSE2)
+			CHUNK_WORDS,
+			CHUNK_NONE			// every byte goes through the table
+		};
+
+		LineScan(const std::string &line);
+
+		static void	setChunking(Chunking chunking);
+
+		Verdict	getVerdict()		const;
+		size_t	getBadStart()		const;
+		size_t	getBadLength()		const;
+
+		size_t	getTokenCount()		const;
+		size_t	getTokenStart(size_t index)		const;
+		size_t	getTokenLength(size_t index)	const;
+
+		bool	hasTrailing()		const;
+		size_t	getTrailingStart()	const;
+		size_t	getTrailingLength()	const;	// without trailing whitespace
+
+	private:
+		struct Span
+		{
+			size_t	start;
+			size_t	length;
+		};
+
+		void	scanTrailing(const unsigned char *line, size_t start, size_t size);
+		bool	checkElement(const unsigned char *line, size_t start, size_t end, unsigned mask);
+		void	fail(Verdict verdict);
+
+		static size_t	utf8Length(const unsigned char *bytes, size_t left);
+		static size_t	plainRun(const unsigned char *bytes, size_t left);
+
+		static Chunking	_chunking;
+
+		Verdict	_verdict;
+		Span	_bad;
+		Span	_tokens[LINE_TOKENS_MAX];
+		size_t	_count;
+		bool	_hasTrailing;
+		Span	_trailing;
+};
+
+#endif
@@ -25,6 +25,7 @@ public:
 	static void 	init(); // Initialize the logger
 	static void		activateLogger();
 	static void		deactivateLogger();
+	static bool		isActive();
     static void 	log(const std::string& logmsg);
     static void 	close(); // Close the logger
 
@@ -0,0 +1,73 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   MaskList.hpp                                       :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/25 11:20:07 by astein            #+#    #+#             */
+/*   Updated: 2024/05/25 11:20:07 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef MASKLIST_HPP
+#define MASKLIST_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include "Glob.hpp"
+
+// A channel list of "nick!user@host" masks (+b, +e, +I)
+// -----------------------------------------------------------------------------
+// A hostmask only has to be tried against the masks which can match it at
+// all: masks with a literal start hang in a trie under that start, masks
+// which start with a wildcard but end literally (like "*!*@host") hang in a
+// second trie under their reversed end. Walking the hostmask down both tries
+// collects the candidates; only masks with wildcards at both ends are tried
+// for every hostmask.
+class MaskList
+{
+	public:
+		struct Entry
+		{
+			std::string	mask;
+			std::string	setter;
+			long		time;
+		};
+
+		MaskList();
+		~MaskList();
+
+		// "nick" -> "nick!*@*", "user@host" -> "*!user@host", ...
+		static std::string	normalize(const std::string &mask);
+
+		bool	add(const std::string &mask, const std::string &setter, long time);
+		bool	remove(const std::string &mask);
+		bool	contains(const std::string &mask) const;
+		bool	match(const std::string &hostmask) const;
+
+		size_t						size() const;
+		const std::vector<Entry>	&getEntries() const;
+
+	private:
+		struct Node
+		{
+			std::map<char, size_t>	next;
+			std::vector<size_t>		masks;	// the masks whose literal part ends here
+		};
+
+		void		index(size_t id);
+		void		rebuild();
+		static void	insert(std::vector<Node> &trie, const std::string &key, bool reversed, size_t id);
+		bool		walk(const std::vector<Node> &trie, const std::string &hostmask, bool reversed) const;
+
+		std::vector<Entry>				_entries;	// in the order they were set
+		std::vector<Glob>				_globs;		// compiled, same order
+		std::map<std::string, size_t>	_folded;	// folded mask -> id
+		std::vector<Node>				_prefixes;
+		std::vector<Node>				_suffixes;
+		std::vector<size_t>				_wild;
+};
+
+#endif
@@ -16,9 +16,11 @@
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <vector>
 #include "Client.hpp"
 #include "Channel.hpp"
 #include "Logger.hpp"
+#include "LineScan.hpp"
 
 class Client;
 class Channel;
@@ -39,6 +41,12 @@ class Message
         const std::string 	&getChannelName()		const;
         const std::string 	&getColon()				const;
         const std::string 	&getArg(size_t index)	const;
+        const std::string 	&getParam(size_t index)	const;	// in order, channel names included
+        const std::vector<std::string>	&getTargets()	const;	// the first param split at ','
+        const LineScan		&getScan()				const;	// validation of the line
+
+		// "a,b,,c" -> "a" "b" "c"
+		static std::vector<std::string>	splitList(const std::string &list);
 
 		// Setters
         void				setReceiver(Client *receiver);
@@ -49,6 +57,7 @@ class Message
     private:
         Message();
 
+        LineScan			_scan;
         Client		    	*_sender;
         Client          	*_receiver;
         Channel         	*_channel;
@@ -56,6 +65,8 @@ class Message
         std::string     	_channelName;
         std::string     	_colon;
         std::string     	_args[3];
+        std::vector<std::string>	_params;
+        std::vector<std::string>	_targets;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,140 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Pool.hpp                                           :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/18 16:40:27 by astein            #+#    #+#             */
+/*   Updated: 2024/05/18 16:40:27 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef POOL_HPP
+#define POOL_HPP
+
+#include <cstddef>
+#include <new>
+
+// Size class pool
+// -----------------------------------------------------------------------------
+// Small blocks are cut from 16 KiB slabs and handed out by size class.
+// Freed blocks go to the free list of their class and are reused by the
+// next allocation of that class, so connections and channels coming and
+// going recycle the same memory instead of fragmenting the heap.
+// Blocks bigger than the biggest class go to operator new directly.
+#define POOL_CLASSES	16
+#define POOL_SLAB_SIZE	16384
+
+class Pool
+{
+	public:
+		static void		*allocate(size_t size);
+		static void		deallocate(void *ptr, size_t size);
+
+		// Gives the slabs back once nothing is in use anymore (at exit)
+		static void		purge();
+
+		// Stats
+		struct ClassStats
+		{
+			size_t	size;		// block size of the class
+			size_t	inUse;		// blocks handed out
+			size_t	free;		// blocks waiting on the free list
+			size_t	reserved;	// bytes of all slabs of the class
+		};
+		static int			getClassCount();
+		static ClassStats	getClassStats(int index);
+		static size_t		getBigBytes();
+		static size_t		getBlockSize(size_t size);	// what an allocation of size really takes
+
+	private:
+		Pool();
+
+		struct FreeBlock
+		{
+			FreeBlock	*next;
+		};
+		struct Slab
+		{
+			Slab		*next;
+		};
+		struct SizeClass
+		{
+			size_t		size;
+			FreeBlock	*free;
+			size_t		inUse;
+			size_t		freeCount;
+			size_t		reserved;
+		};
+
+		static int	classOf(size_t size);
+		static void	refill(SizeClass &sizeClass);
+
+		static SizeClass	_classes[POOL_CLASSES];
+		static Slab			*_slabs;
+		static size_t		_bigBytes;
+};
+
+// STL allocator on top of the pool (e.g. for the nodes of lists and maps)
+// -----------------------------------------------------------------------------
+template <typename T>
+class PoolAllocator
+{
+	public:
+		typedef T			value_type;
+		typedef T			*pointer;
+		typedef const T		*const_pointer;
+		typedef T			&reference;
+		typedef const T		&const_reference;
+		typedef size_t		size_type;
+		typedef ptrdiff_t	difference_type;
+
+		template <typename U>
+		struct rebind
+		{
+			typedef PoolAllocator<U>	other;
+		};
+
+		PoolAllocator() throw() {}
+		PoolAllocator(const PoolAllocator &) throw() {}
+		template <typename U>
+		PoolAllocator(const PoolAllocator<U> &) throw() {}
+		~PoolAllocator() throw() {}
+
+		pointer			address(reference x) const			{ return &x; }
+		const_pointer	address(const_reference x) const	{ return &x; }
+		size_type		max_size() const throw()			{ return static_cast<size_t>(-1) / sizeof(T); }
+
+		pointer	allocate(size_type n, const void * = 0)
+		{
+			return static_cast<pointer>(Pool::allocate(n * sizeof(T)));
+		}
+		void	deallocate(pointer p, size_type n)
+		{
+			Pool::deallocate(p, n * sizeof(T));
+		}
+		void	construct(pointer p, const T &value)
+		{
+			new (static_cast<void *>(p)) T(value);
+		}
+		void	destroy(pointer p)
+		{
+			p->~T();
+		}
+};
+
+// The pool is global, so all allocators are interchangeable
+template <typename T, typename U>
+bool	operator==(const PoolAllocator<T> &, const PoolAllocator<U> &)
+{
+	return true;
+}
+
+template <typename T, typename U>
+bool	operator!=(const PoolAllocator<T> &, const PoolAllocator<U> &)
+{
+	return false;
+}
+
+#endif
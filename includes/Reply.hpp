@@ -0,0 +1,81 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Reply.hpp                                          :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/23 16:42:10 by astein            #+#    #+#             */
+/*   Updated: 2024/05/23 16:42:10 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef REPLY_HPP
+#define REPLY_HPP
+
+#include <string>
+#include <cstring>
+#include "utils.hpp"
+
+// One line for a client, rendered on the stack
+// -----------------------------------------------------------------------------
+// Reply(RPL_TOPIC, nick) << channel << " :" << topic gives
+// ":localhost 332 <nick> <channel> :<topic>" without touching the heap: the
+// numeric is checked to be three digits at compile time, string literals are
+// copied with their compile-time length and numbers go through
+// formatNumber(). Whatever doesn't fit into an IRC line is cut (and
+// overflowed() is set), so long lists have to be split by the caller: when
+// room() is too small for the next item, send the line and start a new one.
+#define REPLY_MAX		510		// bytes of a line without the CRLF
+
+// Only exists for true, so a wrong numeric doesn't compile
+template <bool>	struct NumericCheck;
+template <>		struct NumericCheck<true> {};
+
+class Reply
+{
+	public:
+		// A line without a numeric (":nick!user@localhost JOIN #chan")
+		Reply() : _size(0), _overflowed(false) {}
+
+		// ":localhost <code> <nick> "
+		template <size_t N>
+		Reply(const char (&code)[N], const std::string &nick) : _size(0), _overflowed(false)
+		{
+			(void)sizeof(NumericCheck<N == 4>);
+			append(":localhost ", 11);
+			append(code, 3);
+			*this << ' ' << nick << ' ';
+		}
+
+		template <size_t N>
+		Reply	&operator<<(const char (&text)[N])
+		{
+			return append(text, N - 1);
+		}
+		Reply	&operator<<(const std::string &text)
+		{
+			return append(text.data(), text.size());
+		}
+		Reply	&operator<<(char c)
+		{
+			return append(&c, 1);
+		}
+		Reply	&operator<<(int number);
+		Reply	&operator<<(unsigned int number);
+		Reply	&operator<<(long number);
+		Reply	&operator<<(unsigned long number);
+
+		Reply		&append(const char *text, size_t len);
+		const char	*data()			const	{ return _line; }
+		size_t		size()			const	{ return _size; }
+		size_t		room()			const	{ return REPLY_MAX - _size; }
+		bool		overflowed()	const	{ return _overflowed; }	// something was cut
+
+	private:
+		char	_line[REPLY_MAX];
+		size_t	_size;
+		bool	_overflowed;
+};
+
+#endif
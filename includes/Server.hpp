@@ -30,21 +30,102 @@
 #include <sys/select.h>	// For select function
 #include <signal.h>		// For signal handling
 #include <map>
+#include <set>
 #include <cstdlib>		// For getting the ip of the server
 #include <errno.h>
 #include <poll.h>
+#include <netdb.h>		// For resolving the hosts of the link peers
+#include <sys/wait.h>	// For the snapshot child
 
 #include "Channel.hpp"
 #include "Message.hpp"
 #include "utils.hpp"
 #include "Logger.hpp"
+#include "TimerWheel.hpp"
+#include "ConnectionLimiter.hpp"
+#include "Pool.hpp"
+#include "Arena.hpp"
+#include "Atom.hpp"
+#include "Snapshot.hpp"
+#include "Upgrade.hpp"
+#include "Glob.hpp"
+#include "SpamFilter.hpp"
+#include "AllocScope.hpp"
+#include "Trace.hpp"
 
 class Client;
 class Channel;
 class Message;
 
+typedef std::list<Client, PoolAllocator<Client> >		ClientList;
+typedef std::list<Channel, PoolAllocator<Channel> >		ChannelList;
+
 #define BUFFER_SIZE 512	// IRC message buffer size
 #define PROMT ">>>FINISHERS IRC NET<<<"
+#define LOBBY_NAME "#lobby"
+
+// Flood control (per client token bucket)
+#define FLOOD_BURST			20		// max tokens a client can save up
+#define FLOOD_RATE			4		// tokens refilled per second
+#define FLOOD_RETRY_MS		100		// poll timeout while lines are deferred
+#define FLOOD_MAX_BACKLOG	8192	// deferred input bytes before 'Excess Flood'
+
+// SendQ (per client output queue)
+#define SENDQ_MAX			65536	// queued output bytes before 'SendQ exceeded'
+#define SENDQ_SOFT			16384	// queued output bytes which stop reading from a client
+
+// Liveness timers (in seconds, one timer tick is one second)
+#define TIMER_TICK_MS		1000
+#define REGISTER_TIMEOUT	60		// to send PASS, NICK and USER
+#define PING_IDLE			120		// idle time before the server sends a PING
+#define PONG_TIMEOUT		60		// time to answer the PING
+
+// Loop phases (read everything, execute, then send everything)
+// They all run on the one thread. STATS p shows the time of each side: with
+// 8 clients flooding a channel the read and flush phases were ~1% of it
+// (23ms of 2.1s for 160k lines and 116MB out), so I/O threads in front of
+// the core couldn't win more than that.
+#define IO_READ_SIZE		4096	// bytes per recv
+#define IO_READ_BUDGET		4		// recvs per client and iteration
+
+// Target lists ("PRIVMSG bob,#chan :hi"), advertised as TARGMAX in the 005
+#define TARGET_MAX			8		// targets of one PRIVMSG, JOIN, PART or KICK
+
+// WHO <mask>
+#define WHO_RESULTS_MAX		500		// users listed for one mask
+
+// LIST (ELIST=MNU: ">n" "<n" "mask" "!mask", the text after the colon has to
+// be in the topic); the replies are made while the sendq of the client drains
+#define LIST_SCAN_MAX		2000	// channels one listing looks at per iteration
+#define LIST_SENDQ_FILL		8192	// a listing only adds while the sendq is smaller
+
+// Mode strings ("MODE #chan +ooo a b c"), advertised as MODES in the 005
+#define MODES_MAX			4		// modes with a parameter in one MODE
+
+// Channel history (the storage limits are in History.hpp)
+#define HISTORY_QUERY_MAX	100		// events of one CHATHISTORY, advertised in the 005
+
+// Channel snapshots
+#define SNAPSHOT_FILE		"ircserv.snap"
+#define SNAPSHOT_INTERVAL	300		// seconds between the periodic snapshots
+
+// Memory (see STATS m): idle clients give back their slack, new connections
+// are refused while the accounted memory is above the cap
+#define MEMORY_SCAN_INTERVAL	10			// seconds between the accounting passes
+#define COMPACT_IDLE_MS			60000		// idle time before a client is compacted
+#define MEMORY_CAP				268435456	// accounted bytes (256 MiB)
+
+// Content filter of PRIVMSG (see SpamFilter.hpp), read again on SIGHUP
+#define FILTER_FILE			"ircserv.filter"
+
+// Loop tracing (see Trace.hpp): SIGUSR1 switches it on, the next one off
+// and writes the ring to this file
+#define TRACE_FILE			"ircserv-trace.json"
+
+// Server links
+#define LINK_RETRY			10		// seconds between the connects to a peer
+#define LINK_SENDQ_MAX		1048576	// queued output bytes of a link (a burst is big)
+#define LINK_BURST_LINE		400		// max length of the member list of one SJOIN
 
 // -------------------------------------------------------------------------
 // Standard exception class for server
@@ -69,6 +150,9 @@ class Server
 		Server(const std::string &port, const std::string &password);
 		~Server();
 		void parseArgs(const std::string &port, const std::string &password);
+		void setServerName(const std::string &name);
+		void addLinkPeer(const std::string &hostPort);
+		void enableUpgrade(char **argv);
 	private:
 		Server(); // Private default constructor
 
@@ -77,19 +161,55 @@ class Server
 	// -------------------------------------------------------------------------
 	public :
 		void				initNetwork();
+		void				resumeUpgrade(int sock);
 		void				goOnline();
 		void				shutDown();
 	private:
-		std::vector<pollfd>	getFdsAsVector() const;
-		void				broadcastMessage(const std::string &msg) const;
+		void				acceptConnection();
+		bool				readClient(Client *client);
+		void				flushClients();
+		pollfd				*getPollFds(size_t &count) const;
+		int					getPollTimeout() const;
+		void				broadcastMessage(const std::string &msg);
+		void				reapClients();
+		void				dropInvites(Client *client);
+		void				removeStaleHistory();
+		void				sendQuit(Client *client, const std::string &reason);
+		void				sendToNeighbours(Client *client, const std::string &line, bool self);
+
+		// WHO index (every registered user under its folded nick, user,
+		// host and real name)
+		void				indexClient(Client *client);
+		void				unindexClient(Client *client);
+		static bool			matchWho(const Glob &mask, const Client *client);
+		static void			sendWhoReply(Client *receiver, const Client *client);
+		void				processTimers();
+		void				handleLivenessTimer(Client *client);
+		void				loadSnapshot();
+		void				saveSnapshot(bool background);
+		void				reapSnapshotChild(bool wait);
+		void				upgrade();
+		void				reloadFilter();
+		void				toggleTrace();
+		void				scanMemory(bool compact);
+		size_t				getMemoryTotal() const;
+		void				writeUpgradeState(Upgrade &state) const;
+		bool				readUpgradeState(Upgrade &state);
 
 	// -------------------------------------------------------------------------
 	// Processing the Messages
 	// -------------------------------------------------------------------------
 	private:
+		void	processInput(Client *sender);
+		void	processDeferredInput();
+		int		getCommandCost(const std::string &cmd) const;
 		void	processMessage(Client *sender, const std::string &ircMessage);
 		bool	isLoggedIn(Message *msg);
 		void	chooseCommand(Message *msg);
+		void	sendWelcome(Client *client);
+		void	buildBurst();
+		bool	checkTargetCount(Client *sender, const std::vector<std::string> &targets, size_t index);
+		static bool	isValidChannelName(const std::string &name);
 
 		typedef void	(Server::*CommandFunction)(Message*);
 		void	pass	(Message *msg);		// WORKS
@@ -104,6 +224,68 @@ class Server
 		void	mode	(Message *msg);
 		void	kick	(Message *msg);		// ERORRO NO SUCH USER
 		void	part	(Message *msg);
+		void	stats	(Message *msg);
+		void	chathistory	(Message *msg);
+		void	list	(Message *msg);
+		void	cap		(Message *msg);
+		void	ping	(Message *msg);
+		void	pong	(Message *msg);
+		void	quit	(Message *msg);
+
+	// -------------------------------------------------------------------------
+	// Channel Listings (LIST)
+	// -------------------------------------------------------------------------
+	private:
+		// A LIST in progress: the filters and the next channel to look at.
+		// Channels are never removed while the server runs (they are kept
+		// for the snapshot), so the iterator stays valid.
+		struct Listing
+		{
+			Client					*client;
+			ChannelList::iterator	next;
+			size_t					minUsers;
+			size_t					maxUsers;
+			std::vector<Glob>		masks;		// the name has to match one of them
+			std::vector<Glob>		notMasks;	// and none of these
+			std::string				topic;		// casefolded
+		};
+
+		void	continueListings();
+		bool	continueListing(Listing &listing);
+		static bool	matchListing(const Listing &listing, const Channel &channel);
+		void	cancelListing(const Client *client);
+
+	// -------------------------------------------------------------------------
+	// Server Links
+	// -------------------------------------------------------------------------
+	private:
+		struct LinkPeer
+		{
+			std::string	host;
+			std::string	port;
+			Client		*connection;	// NULL while not connected
+			Timer		retry;
+		};
+
+		void		connectLink(LinkPeer &peer);
+		LinkPeer	*getPeerByTimer(const Timer *timer);
+		LinkPeer	*getPeerByConnection(const Client *connection);
+		void		processLinkLine(Client *link, const std::string &line);
+		void		linkHandshake(Client *link, const std::vector<std::string> &params);
+		void		sendBurst(Client *link);
+		void		introduceServer(Client *link, const std::string &name);
+		void		removeServer(Client *link, const std::string &name);
+		void		introduceClient(Client *link, const std::vector<std::string> &params);
+		void		burstChannel(const std::vector<std::string> &params);
+		void		burstTopic(const std::vector<std::string> &params);
+		void		relayClientCommand(Client *link, const std::string &prefix, const std::string &rest, const std::vector<std::string> &params);
+		void		killClient(const std::string &nickname, const std::string &reason, Client *from);
+		void		removeRemoteClient(Client *client, const std::string &reason);
+		void		linkLost(Client *link);
+		void		propagate(const std::string &line, Client *except);
+		void		propagateMessage(Client *sender, const std::string &nickname, bool wasRegistered, const std::string &ircMessage);
+		void		propagatePrivmsg(Client *sender, const std::string &nickname, const std::string &message, size_t cmdEnd);
+		std::string	getIntroduction(const Client *client) const;
 
 	// -------------------------------------------------------------------------
 	// Client Methods
@@ -120,7 +302,7 @@ class Server
 	private:
 		void	addChannel(const Channel *channel);
 		void	removeChannel(Channel *channel);
-		Channel	*createNewChannel(Message *msg);
+		Channel	*createNewChannel(Client *creator, const std::string &name);
 
 	// -------------------------------------------------------------------------
 	// Attributes
@@ -131,17 +313,113 @@ class Server
 		int					_socket;
 		u_int16_t			_port;
 		std::string			_password;
-		std::list<Client>	_clients;
-		std::list<Channel>	_channels;
+		ConnectionLimiter	_limiter;
+		TimerWheel			_timers;	// has to outlive the clients (their timers)
+		ClientList			_clients;
+		ClientList			_remoteClients;	// users of other servers
+		ChannelList			_channels;
+		unsigned long		_epoch;		// of the last visit of all neighbours of a client
+
+		// Channel snapshots
+		Timer				_snapshotTimer;
+		pid_t				_snapshotChild;		// 0 if no snapshot is being written
+		struct SnapshotStats
+		{
+			unsigned long	written;
+			unsigned long	failed;
+			size_t			channels;			// channels of the last snapshot
+			long			loadMs;				// time the startup took to load it
+		}					_snapshotStats;
+
+		// Memory accounting (of the last scanMemory())
+		Timer				_memoryTimer;
+		struct MemoryStats
+		{
+			size_t			clients;
+			size_t			object;				// the Client parts (see Client::MemoryUsage)
+			size_t			strings;
+			size_t			buffers;
+			size_t			channels;
+			size_t			memberships;		// nodes in the member maps of the channels
+			size_t			index;				// entries of the WHO index
+			size_t			idleClients;		// registered, nothing queued
+			size_t			idleBytes;			// all they hold together
+			unsigned long	compacted;			// bytes given back by idle clients
+			unsigned long	refused;			// connections refused at the cap
+		}					_memoryStats;
+
+		// Content filter; _lineFiltered keeps a filtered line off the links
+		SpamFilter			_filter;
+		bool				_lineFiltered;
+
+		// Hot upgrade: the binary (and its args) which takes over on SIGUSR2
+		std::string							_execPath;
+		std::vector<std::string>			_execArgs;
+
+		// WHO: a mask with a literal start only looks at a range of this
+		std::multimap<std::string, Client *>	_whoIndex;
+
+		std::list<Listing>					_listings;
+
+		// Registration burst: 002 to 005 without the nick (see buildBurst())
+		std::string							_yourHost;
+		std::string							_created;
+		std::string							_myInfo;
+		std::string							_isupport;
+
+		// Server links
+		std::string							_serverName;
+		std::list<LinkPeer>					_peers;		// servers we connect to
+		std::list<Client *>					_links;		// links which finished the handshake
+		std::map<std::string, Client *>		_servers;	// all other servers -> link they are behind
+		std::set<std::string>				_linkedCmds;	// cmds which are replayed on the other servers
 		
 		// Declare the map of all allowed cmds
 		std::map<std::string, CommandFunction> _cmds;
 
+		// Flood control: token cost of each cmd (unlisted cmds cost 1)
+		std::map<std::string, int>	_cmdCosts;
+		struct FloodStats
+		{
+			unsigned long	throttledClients;	// times a client got throttled
+			unsigned long	deferredLines;		// times a line had to wait
+			unsigned long	excessFloods;		// clients kicked for flooding
+		}							_floodStats;
+
+		// SendQ counters
+		struct SendQStats
+		{
+			unsigned long	exceeded;			// clients kicked for a full sendq
+			size_t			peak;				// biggest sendq of a client which already left
+		}							_sendqStats;
+
+		// Liveness counters
+		struct TimerStats
+		{
+			unsigned long	pingsSent;
+			unsigned long	pingTimeouts;
+			unsigned long	registerTimeouts;
+		}							_timerStats;
+
+		// Loop phase counters
+		struct IoStats
+		{
+			unsigned long	iterations;
+			unsigned long	reads;				// recv calls
+			unsigned long	flushes;			// sendq flushes of the flush phase
+			unsigned long	lines;				// lines the core phase executed
+			long			ioNs;				// in the read and flush phases
+			long			coreNs;				// in the core phase
+		}							_ioStats;
+
 	// -------------------------------------------------------------------------
-	// Static Signal handling (for exit with CTRL C)
+	// Static Signal handling (for exit with CTRL C and the hot upgrade)
 	// -------------------------------------------------------------------------
 	public:
 		static volatile sig_atomic_t	_keepRunning;
+		static volatile sig_atomic_t	_upgradeRequested;
+		static volatile sig_atomic_t	_reloadRequested;
+		static volatile sig_atomic_t	_traceRequested;
 		static void						setupSignalHandling();
 		static void						sigIntHandler(int sig);
 
@@ -156,9 +434,16 @@ class Server
 			return true;
 		Logger::log("Check if name is available: " + name);
 
+		// A name nobody holds has no atom
+		Atom	atom = Atom::find(name);
+		if (atom.empty())
+		{
+			Logger::log("TRUE Check if name is available: " + name);
+			return true;
+		}
 		for (it = list.begin(); it != list.end(); ++it)
 		{
-			if (it->getUniqueName() == name)
+			if (it->getAtom() == atom)
 			{
 				Logger::log("FALSE Check if name is available: " + name);
 				return false;
@@ -179,9 +464,15 @@ class Server
 			Logger::log("Check if object is there: NAME is not given or LIST is empty!");
 			return NULL;
 		}
+		Atom	atom = Atom::find(name);
+		if (atom.empty())
+		{
+			Logger::log("FALSE Check if object is there: " + name);
+			return NULL;
+		}
 		for (it = list.begin(); it != list.end(); ++it)
 		{
-			if (it->getUniqueName() == name)
+			if (it->getAtom() == atom)
 			{
 				Logger::log("TRUE Check if object is there: " + name);
 				return &(*it);
@@ -0,0 +1,84 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Snapshot.hpp                                       :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/20 19:12:40 by astein            #+#    #+#             */
+/*   Updated: 2024/05/20 19:12:40 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Binary snapshot of the channel state
+// -----------------------------------------------------------------------------
+// Header:	"IRCSNAP" '\0' | version u32 | channels u32 | payload bytes u32 | FNV-1a of the payload u32
+// Channel:	flags u8 (1 = +i, 2 = +t) | limit u32 |
+//			name, topic, topic change, key (each u16 length + bytes) |
+//			operators u16 | operator hostmasks "nick!user@host" (each u16
+//			length + bytes; older snapshots have plain nicks) |
+//			for +b, +e and +I: masks u16 | (mask, setter, each u16 length + bytes,
+//			time u32) per mask
+// Version 1 snapshots (without the mask lists) are still read.
+// Numbers are in host byte order (the file is read by the same host).
+// The file is written to a temporary file which is renamed over the old
+// one, so a crash while writing never leaves a broken snapshot behind.
+#define SNAPSHOT_MAGIC		"IRCSNAP"
+#define SNAPSHOT_VERSION	2
+
+class Snapshot
+{
+	public:
+		struct Mask
+		{
+			std::string	mask;
+			std::string	setter;
+			uint32_t	time;
+		};
+
+		struct Record
+		{
+			std::string					name;
+			std::string					topic;
+			std::string					topicChange;
+			std::string					key;
+			int							limit;
+			bool						inviteOnly;
+			bool						topicProtected;
+			std::vector<std::string>	operators;
+			std::vector<Mask>			masks[3];	// +b, +e, +I
+		};
+
+		Snapshot();
+		~Snapshot();
+
+		// Writing
+		void		add(const Record &record);
+		std::string	getData() const;
+		bool		writeTo(const std::string &path) const;
+		uint32_t	getCount() const;
+
+		// Reading (the file is mapped, not read)
+		static bool	load(const std::string &path, std::vector<Record> &records);
+		static bool	parse(const char *data, size_t size, std::vector<Record> &records);
+
+	private:
+		void		putString(const std::string &str);
+		void		putMasks(const std::vector<Mask> &masks);
+		void		putU16(uint16_t value);
+		void		putU32(uint32_t value);
+
+		static uint32_t	checksum(const char *data, size_t len);
+
+		std::string	_payload;
+		uint32_t	_count;
+};
+
+#endif
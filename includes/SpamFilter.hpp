@@ -0,0 +1,86 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   SpamFilter.hpp                                     :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/25 16:42:31 by astein            #+#    #+#             */
+/*   Updated: 2024/05/25 16:42:31 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef SPAMFILTER_HPP
+#define SPAMFILTER_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Content filter for PRIVMSG text
+// -----------------------------------------------------------------------------
+// The patterns (one per line: "drop|notice|kill <text>", '#' starts a comment)
+// are compiled into one Aho-Corasick automaton, so a message is scanned once
+// however many patterns there are. The bytes are folded to lower case and
+// mapped to the few classes which appear in a pattern, which keeps the table
+// of the transitions small. In the start state nothing but the first byte of
+// a pattern leads anywhere, so the scan jumps there directly (with SSE2
+// for up to FILTER_FIRST_SIMD different first bytes).
+// A load which fails keeps the patterns which were there.
+#define FILTER_PATTERNS_MAX		10000
+#define FILTER_PATTERN_LENGTH	400
+#define FILTER_STATES_MAX		65535	// the transitions are 16 bit
+#define FILTER_FIRST_SIMD		8
+
+class SpamFilter
+{
+	public:
+		// The strongest action of the patterns in a message wins
+		enum Action
+		{
+			ACTION_NONE,
+			ACTION_DROP,	// the message isn't delivered
+			ACTION_NOTICE,	// ... and the sender gets told
+			ACTION_KILL		// ... and the sender is disconnected
+		};
+
+		struct Stats
+		{
+			unsigned long	checked;		// messages
+			unsigned long	bytes;			// scanned bytes
+			unsigned long	nanoseconds;	// spent in check()
+			unsigned long	hits[4];		// per action
+			unsigned long	loads;
+			unsigned long	failedLoads;
+		};
+
+		SpamFilter();
+		~SpamFilter();
+
+		bool	load(const std::string &path, std::string &error);
+		Action	check(const std::string &text);
+
+		size_t				getPatternCount()	const;
+		size_t				getStateCount()		const;
+		size_t				getClassCount()		const;
+		size_t				getMemoryUsed()		const;
+		bool				usesSimd()			const;
+		const Stats			&getStats()			const;
+
+	private:
+		size_t	nextFirst(const unsigned char *text, size_t pos, size_t len) const;
+		void	swap(SpamFilter &other);
+
+		static unsigned char	fold(unsigned char c);
+
+		size_t					_patterns;
+		size_t					_classes;
+		unsigned char			_classOf[256];
+		bool					_isFirst[256];
+		std::vector<unsigned char>	_first;		// the first bytes (both cases)
+		std::vector<uint16_t>	_delta;			// state * _classes + class -> state
+		std::vector<unsigned char>	_action;	// per state, including the suffixes
+		Stats					_stats;
+};
+
+#endif
@@ -0,0 +1,94 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   TimerWheel.hpp                                     :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/16 19:02:11 by astein            #+#    #+#             */
+/*   Updated: 2024/05/16 19:02:11 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef TIMERWHEEL_HPP
+#define TIMERWHEEL_HPP
+
+#include <vector>
+#include <cstddef>
+
+// Hierarchical timing wheel (like the one of the linux kernel)
+// -----------------------------------------------------------------------------
+// Level 0 has one slot per tick, the higher levels have one slot per
+// 256, 256 * 64, 256 * 64 * 64 ticks. Timers of the higher levels are moved
+// down one level every time the lower level wrapped around ('cascade').
+//
+//	- arm / cancel: O(1) (the timers are intrusive double linked lists)
+//	- advance:      O(1) per tick + O(1) per expired or cascaded timer
+//
+// So a wheel with thousands of armed timers costs nothing as long as none
+// of them fires.
+#define WHEEL_BITS_0	8
+#define WHEEL_BITS_N	6
+#define WHEEL_SIZE_0	(1 << WHEEL_BITS_0)
+#define WHEEL_SIZE_N	(1 << WHEEL_BITS_N)
+#define WHEEL_LEVELS	4
+#define WHEEL_MAX_TICKS	((1UL << (WHEEL_BITS_0 + 3 * WHEEL_BITS_N)) - 1)
+
+class TimerWheel;
+
+class Timer
+{
+	public:
+		Timer();
+		Timer(const Timer &other);				// copies are never armed
+		Timer	&operator=(const Timer &other);	// so is the assigned timer
+		~Timer();
+
+		bool	isArmed()	const;
+		void	*getData()	const;
+		void	cancel();
+
+	private:
+		friend class TimerWheel;
+		Timer			*_prev;
+		Timer			*_next;
+		TimerWheel		*_wheel;	// NULL if not armed
+		unsigned long	_expires;	// tick
+		void			*_data;		// whatever the owner needs to handle it
+};
+
+class TimerWheel
+{
+	public:
+		TimerWheel(unsigned long now);
+		~TimerWheel();
+
+		void	arm(Timer &timer, unsigned long ticks, void *data);
+		void	cancel(Timer &timer);
+
+		// Collects all timers which expired until (and including) tick 'now'
+		void	advance(unsigned long now, std::vector<Timer *> &expired);
+
+		// The next tick advance() has work to do, -1 if no timer is armed
+		long	nextEventTick()	const;
+		size_t	size()			const;
+
+	private:
+		TimerWheel();
+		TimerWheel(const TimerWheel &other);
+		TimerWheel	&operator=(const TimerWheel &other);
+
+		void	place(Timer &timer);
+		int		cascade(int level);
+		Timer	*slot(int level, unsigned long index);
+
+		unsigned long	_current;	// next tick to be processed
+		size_t			_count;
+		// The first slot of every level is the head of a circular list
+		Timer			_level0[WHEEL_SIZE_0];
+		Timer			_levelN[WHEEL_LEVELS - 1][WHEEL_SIZE_N];
+		// One bit per level 0 slot which (maybe) contains timers
+		unsigned int	_pending[WHEEL_SIZE_0 / 32];
+};
+
+#endif
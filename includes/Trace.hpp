@@ -0,0 +1,92 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Trace.hpp                                          :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/26 15:31:09 by astein            #+#    #+#             */
+/*   Updated: 2024/05/26 15:31:09 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <string>
+#include <cstddef>
+
+// Spans of the loop phases for chrome://tracing and Perfetto
+// -----------------------------------------------------------------------------
+// A TraceSpan writes a begin event into a ring buffer when it's made and an
+// end event when it goes out of scope. While tracing is off a span is a
+// single branch. The server runs on one thread, so there is one ring; once
+// it's full the oldest events are overwritten, so a dump always holds the
+// last TRACE_EVENTS of them. dump() writes them as trace event JSON.
+// The names have to outlive the ring (string literals or the command names
+// of the server).
+#define TRACE_EVENTS	65536	// events in the ring (24 bytes each)
+
+class Trace
+{
+	public:
+		static void	enable();
+		static void	disable();
+		static bool	dump(const std::string &path);
+		static size_t	getEventCount();
+
+		static void	begin(const char *name, int fd);
+		static void	end(const char *name, int fd);
+
+		static bool	_enabled;	// read by every span
+
+	private:
+		Trace();
+
+		struct Event
+		{
+			const char	*name;
+			long		ns;		// monotonic clock
+			int			fd;		// -1 if the span isn't about one client
+			char		phase;	// 'B' or 'E'
+		};
+
+		static void	record(const char *name, int fd, char phase);
+
+		static Event	*_ring;
+		static size_t	_next;		// slot of the next event
+		static size_t	_count;		// events in the ring
+};
+
+class TraceSpan
+{
+	public:
+		explicit TraceSpan(const char *name, int fd = -1) :
+			_name(Trace::_enabled ? name : NULL),
+			_fd(fd)
+		{
+			if (_name)
+				Trace::begin(_name, _fd);
+		}
+		~TraceSpan()
+		{
+			close();
+		}
+
+		// Ends the span before the end of the scope
+		void	close()
+		{
+			if (_name && Trace::_enabled)
+				Trace::end(_name, _fd);
+			_name = NULL;
+		}
+
+	private:
+		TraceSpan(const TraceSpan &other);
+		TraceSpan	&operator=(const TraceSpan &other);
+
+		const char	*_name;		// NULL if tracing was off at the start
+		int			_fd;
+};
+
+#endif
@@ -0,0 +1,68 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Upgrade.hpp                                        :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/21 20:03:17 by astein            #+#    #+#             */
+/*   Updated: 2024/05/21 20:03:17 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef UPGRADE_HPP
+#define UPGRADE_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// State of a running server which is handed over to the binary replacing it
+// -----------------------------------------------------------------------------
+// The old process writes the state and the open fds into its end of a Unix
+// socketpair (the fds as SCM_RIGHTS), the new one finds its end by the fd
+// number in UPGRADE_ENV and answers with one byte once it took over.
+// Wire:	fds u32 | data bytes u32 | the fds (UPGRADE_FDS_PER_MSG per message,
+//			each with one dummy byte) | data
+// The data is a plain sequence of u32s and strings (u32 length + bytes),
+// both sides just have to read it in the order it was written.
+#define UPGRADE_ENV				"IRCSERV_UPGRADE_FD"
+#define UPGRADE_FDS_PER_MSG		64
+#define UPGRADE_TIMEOUT_MS		10000	// the new binary has to take over in time
+
+class Upgrade
+{
+	public:
+		Upgrade();
+		~Upgrade();
+
+		// Writing (old process)
+		uint32_t	addFd(int fd);		// returns the index the fd is read back with
+		void		putU32(uint32_t value);
+		void		putString(const std::string &str);
+		void		putBytes(const void *data, size_t len);
+		bool		sendTo(int sock) const;
+		static bool	waitForAck(int sock);
+
+		// Reading (new process)
+		bool		receiveFrom(int sock);
+		bool		getU32(uint32_t &value);
+		bool		getString(std::string &str);
+		bool		getBytes(void *data, size_t len);
+		int			takeFd(uint32_t index);	// -1 if there is no such fd (or it was taken)
+		static bool	sendAck(int sock);
+
+	private:
+		Upgrade(const Upgrade &other);
+		Upgrade	&operator=(const Upgrade &other);
+
+		static bool	sendAll(int sock, const char *data, size_t len);
+		static bool	recvAll(int sock, char *data, size_t len);
+
+		std::string			_data;
+		size_t				_pos;
+		std::vector<int>	_fds;
+		bool				_received;	// received fds which weren't taken are closed
+};
+
+#endif
@@ -15,11 +15,18 @@
 
 // REPLY CODES
 #define RPL_WELCOME				"001"	// "<nick> :Welcome to the FINISHERS' IRC Network, <nick>
+#define RPL_YOURHOST			"002"	// ":Your host is <servername>, running <version>"
+#define RPL_CREATED				"003"	// ":This server was created <date>"
+#define RPL_MYINFO				"004"	// "<servername> <version> <user modes> <channel modes>"
+#define RPL_ISUPPORT			"005"	// "<token>[=<value>] ... :are supported by this server"
 #define RPL_WHOISUSER			"311"	// "<nick> <user> <host> * :<real name>"
 #define RPL_WHOISCHANNELS		"319"	// "<nick> :{[@|+]<channel><space>}"
 #define RPL_WHOREPLY			"352"	// "<channel> <user> <host> <server> <nick> <H|G>[*][@|+] :<hopcount> <real name>"
 #define RPL_ENDOFWHO			"315"	// "<name> :End of /WHO list"
 #define RPL_ENDOFWHOIS			"318"	// "<nick> :End of /WHOIS list"
+#define RPL_LISTSTART			"321"	// "Channel :Users  Name"
+#define RPL_LIST				"322"	// "<channel> <# visible> :<topic>"
+#define RPL_LISTEND				"323"	// ":End of /LIST"
 #define RPL_NOTOPIC				"331"	// "<channel> :No topic is set"
 #define RPL_TOPIC				"332"	// "<channel> :<topic>"
 #define RPL_TOPICADDITIONAL		"333"	// "<channel> astein!alex@F456A.75198A.60D2B2.ADA236.IP 1714884181"
@@ -27,11 +34,22 @@
 #define RPL_CHANNELMODEIS		"324"	// "<channel> <mode> <mode params>"
 #define RPL_NAMREPLY			"353"	// "= <channel> :@astein ash"
 #define RPL_ENDOFNAMES			"366"	// "<channel> :End of /NAMES list"
+#define RPL_BANLIST				"367"	// "<channel> <mask> <setter> <time>"
+#define RPL_ENDOFBANLIST		"368"	// "<channel> :End of channel ban list"
+#define RPL_EXCEPTLIST			"348"	// "<channel> <mask> <setter> <time>"
+#define RPL_ENDOFEXCEPTLIST		"349"	// "<channel> :End of channel exception list"
+#define RPL_INVITELIST			"346"	// "<channel> <mask> <setter> <time>"
+#define RPL_ENDOFINVITELIST		"347"	// "<channel> :End of channel invite list"
+#define RPL_STATSDEBUG			"249"	// ":<stats line>"
+#define RPL_ENDOFSTATS			"219"	// "<stats letter> :End of /STATS report"
 
 // ERROR CODES
 #define ERR_UNKNOWNCOMMAND		"421"	// "<command> :Unknown command"
 #define ERR_NORECIPIENT			"411"	// ":No recipient given (<command>)"
 #define ERR_NOTEXTTOSEND		"412"	// ":No text to send"
+#define ERR_NOORIGIN			"409"	// ":No origin specified"
+#define ERR_TOOMANYTARGETS		"407"	// "<target> :Too many targets. Only <n> processed"
+#define ERR_INVALIDCAPCMD		"410"	// "<subcommand> :Invalid CAP command"
 #define ERR_NOSUCHNICK			"401"	// "<nickname>	:No such nick/channel"
 #define ERR_NONICKNAMEGIVEN		"431"	// ":No nickname given"
 #define ERR_NICKNAMEINUSE		"433"	// "<nick> :Nickname is already in use"
@@ -43,6 +61,9 @@
 #define ERR_BADCHANNELKEY		"475"	// "<channel>	:Cannot join channel (+k)"
 #define ERR_INVITEONLYCHAN		"473"	// "<channel>	:Cannot join channel (+i)"
 #define ERR_CHANNELISFULL		"471"	// "<channel>	:Cannot join channel (+l)"
+#define ERR_BANNEDFROMCHAN		"474"	// "<channel>	:Cannot join channel (+b)"
+#define ERR_BANLISTFULL			"478"	// "<channel> <char> :Channel list is full"
+#define ERR_CANNOTSENDTOCHAN	"404"	// "<channel>	:Cannot send to channel"
 #define ERR_NOTONCHANNEL		"442"	// "<channel> 	:You're not on that channel"
 #define ERR_CHANOPRIVSNEEDED	"482"	// "<channel> 	:You're not channel operator"
 #define ERR_USERNOTINCHANNEL	"441"	// "<nick> <channel> :They aren't on that channel
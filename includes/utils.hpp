@@ -15,6 +15,7 @@
 
 # include <iostream>
 # include <sstream>
+# include <ctime>
 # include "Logger.hpp"
 
 // COLORS
@@ -31,6 +32,30 @@ void	title(std::string str, bool newline_before, bool newline_after);
 void	info(std::string str, std::string clr);
 bool	intNoOverflow(std::string token);
 
+// Monotonic clock in milliseconds (for rate limits and timeouts)
+long	monotonicMs();
+long	monotonicNs();
+
+// Wall clock in milliseconds since the epoch (for timestamps users see)
+long	realtimeMs();
+
+// Writes the decimal digits to out (at least NUMBER_MAX bytes, no '\0')
+// and returns how many there are
+#define NUMBER_MAX	21
+size_t	formatNumber(char *out, unsigned long value);
+size_t	formatNumber(char *out, long value);
+
+// Heap bytes behind a string (none if it fits into the string object) and
+// giving back what it holds beyond its size
+size_t	stringHeapBytes(const std::string &str);
+size_t	shrinkString(std::string &str);
+
+// Integers don't need a stream
+std::string	to_string(int value);
+std::string	to_string(unsigned int value);
+std::string	to_string(long value);
+std::string	to_string(unsigned long value);
+
 template <typename T>
 std::string to_string(const T& value)
 {
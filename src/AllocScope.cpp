@@ -0,0 +1,129 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   AllocScope.cpp                                     :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/26 10:05:44 by astein            #+#    #+#             */
+/*   Updated: 2024/05/26 10:05:44 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "AllocScope.hpp"
+
+#ifdef ALLOC_TRACKING
+
+#include <new>
+#include <cstdlib>
+
+// glibc's own allocator, which the replaced functions forward to
+extern "C"
+{
+	void	*__libc_malloc(size_t size);
+	void	*__libc_calloc(size_t count, size_t size);
+	void	*__libc_realloc(void *ptr, size_t size);
+	void	__libc_free(void *ptr);
+}
+
+AllocScopeId		AllocScope::_current = ALLOC_OTHER;
+AllocScope::Stats	AllocScope::_stats[ALLOC_SCOPES];
+
+// Scopes
+// -----------------------------------------------------------------------------
+AllocScope::AllocScope(AllocScopeId scope) :
+	_previous(_current)
+{
+	_current = scope;
+}
+
+AllocScope::~AllocScope()
+{
+	_current = _previous;
+}
+
+// Counting (no allocation in here, it's called from inside malloc)
+// -----------------------------------------------------------------------------
+void	AllocScope::countAllocation(size_t size)
+{
+	_stats[_current].allocations++;
+	_stats[_current].bytes += size;
+}
+
+void	AllocScope::countFree()
+{
+	_stats[_current].frees++;
+}
+
+const AllocScope::Stats	&AllocScope::getStats(int scope)
+{
+	return _stats[scope];
+}
+
+const char	*AllocScope::getName(int scope)
+{
+	static const char	*names[ALLOC_SCOPES] = {"other", "recv", "parse", "dispatch", "fanout", "flush", "logging"};
+
+	return names[scope];
+}
+
+bool	AllocScope::isEnabled()
+{
+	return true;
+}
+
+// The replaced allocation functions
+// -----------------------------------------------------------------------------
+extern "C" void	*malloc(size_t size)
+{
+	AllocScope::countAllocation(size);
+	return __libc_malloc(size);
+}
+
+extern "C" void	*calloc(size_t count, size_t size)
+{
+	AllocScope::countAllocation(count * size);
+	return __libc_calloc(count, size);
+}
+
+extern "C" void	*realloc(void *ptr, size_t size)
+{
+	AllocScope::countAllocation(size);
+	return __libc_realloc(ptr, size);
+}
+
+extern "C" void	free(void *ptr)
+{
+	if (ptr)
+		AllocScope::countFree();
+	__libc_free(ptr);
+}
+
+// operator new goes to the libc directly, so it isn't counted twice
+void	*operator new(size_t size) throw(std::bad_alloc)
+{
+	AllocScope::countAllocation(size);
+	void *ptr = __libc_malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void	*operator new[](size_t size) throw(std::bad_alloc)
+{
+	return operator new(size);
+}
+
+void	operator delete(void *ptr) throw()
+{
+	if (ptr)
+		AllocScope::countFree();
+	__libc_free(ptr);
+}
+
+void	operator delete[](void *ptr) throw()
+{
+	operator delete(ptr);
+}
+
+#endif
@@ -0,0 +1,141 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Arena.cpp                                          :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/18 17:55:03 by astein            #+#    #+#             */
+/*   Updated: 2024/05/18 17:55:03 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "Arena.hpp"
+#include <new>
+
+// The data of a block starts after its header (keeps 16 byte alignment)
+#define BLOCK_HEADER	((sizeof(Block) + 15) & ~static_cast<size_t>(15))
+
+// Construction / Destruction
+// -----------------------------------------------------------------------------
+Arena::Arena(size_t blockSize) :
+	_head(NULL),
+	_blockSize(blockSize),
+	_used(0),
+	_peak(0),
+	_resets(0),
+	_grows(0),
+	_trims(0)
+{
+	// The first block is allocated on the first use
+}
+
+Arena::~Arena()
+{
+	freeBlocks();
+}
+
+Arena	&Arena::frame()
+{
+	static Arena	arena;
+
+	return arena;
+}
+
+// Allocate / Reset
+// -----------------------------------------------------------------------------
+void	*Arena::allocate(size_t size)
+{
+	size = (size + 15) & ~static_cast<size_t>(15);
+	if (!_head || _head->used + size > _head->size)
+	{
+		if (_head)
+			_grows++;
+		Block *block = newBlock(size > _blockSize ? size : _blockSize);
+		block->next = _head;
+		_head = block;
+	}
+	void *ptr = reinterpret_cast<char *>(_head) + BLOCK_HEADER + _head->used;
+	_head->used += size;
+	_used += size;
+	if (_used > _peak)
+		_peak = _used;
+	return ptr;
+}
+
+void	Arena::reset()
+{
+	_resets++;
+	_used = 0;
+	if (!_head)
+		return ;
+	// More than one block -> merge them into one for the next iteration, but
+	// don't keep more than ARENA_RETAIN_MAX of it
+	if (_head->next || _head->size > ARENA_RETAIN_MAX)
+	{
+		size_t total = getCapacity();
+		if (total > ARENA_RETAIN_MAX)
+		{
+			total = ARENA_RETAIN_MAX;
+			_trims++;
+		}
+		freeBlocks();
+		_blockSize = total;
+		_head = newBlock(_blockSize);
+		return ;
+	}
+	_head->used = 0;
+}
+
+// Stats
+// -----------------------------------------------------------------------------
+size_t	Arena::getCapacity() const
+{
+	size_t total = 0;
+
+	for (Block *block = _head; block; block = block->next)
+		total += block->size;
+	return total;
+}
+
+size_t	Arena::getPeak() const
+{
+	return _peak;
+}
+
+unsigned long	Arena::getResets() const
+{
+	return _resets;
+}
+
+unsigned long	Arena::getGrows() const
+{
+	return _grows;
+}
+
+unsigned long	Arena::getTrims() const
+{
+	return _trims;
+}
+
+// Private Methods
+// -----------------------------------------------------------------------------
+Arena::Block	*Arena::newBlock(size_t size)
+{
+	Block *block = static_cast<Block *>(::operator new(BLOCK_HEADER + size));
+
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+	return block;
+}
+
+void	Arena::freeBlocks()
+{
+	while (_head)
+	{
+		Block *next = _head->next;
+		::operator delete(_head);
+		_head = next;
+	}
+}
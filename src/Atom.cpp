@@ -0,0 +1,264 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Atom.cpp                                           :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/19 11:02:14 by astein            #+#    #+#             */
+/*   Updated: 2024/05/19 11:02:14 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "Atom.hpp"
+
+std::vector<Atom::Entry>	Atom::_entries;
+std::vector<unsigned int>	Atom::_buckets;
+std::vector<unsigned int>	Atom::_freeIds;
+size_t						Atom::_count = 0;
+
+// RFC 1459 casemapping
+static inline unsigned char	foldChar(unsigned char c)
+{
+	if (c >= 'A' && c <= '^')
+		return c + ('a' - 'A');
+	return c;
+}
+
+// Constructors and Destructor
+// -----------------------------------------------------------------------------
+Atom::Atom() :
+	_id(0)
+{
+}
+
+Atom::Atom(const std::string &name) :
+	_id(intern(name))
+{
+}
+
+Atom::Atom(const Atom &other) :
+	_id(other._id)
+{
+	retain(_id);
+}
+
+Atom	&Atom::operator=(const Atom &other)
+{
+	retain(other._id);
+	release(_id);
+	_id = other._id;
+	return *this;
+}
+
+Atom::~Atom()
+{
+	release(_id);
+}
+
+Atom	Atom::find(const std::string &name)
+{
+	Atom	atom;
+
+	if (name.empty() || _buckets.empty())
+		return atom;
+	atom._id = lookup(name.data(), name.size(), hashOf(name.data(), name.size()));
+	retain(atom._id);
+	return atom;
+}
+
+// Compare
+// -----------------------------------------------------------------------------
+bool	Atom::operator==(const Atom &other) const
+{
+	return _id == other._id;
+}
+
+bool	Atom::operator!=(const Atom &other) const
+{
+	return _id != other._id;
+}
+
+bool	Atom::operator<(const Atom &other) const
+{
+	return _id < other._id;
+}
+
+// Getters
+// -----------------------------------------------------------------------------
+bool	Atom::empty() const
+{
+	return _id == 0;
+}
+
+unsigned int	Atom::id() const
+{
+	return _id;
+}
+
+unsigned int	Atom::hash() const
+{
+	return _id ? _entries[_id].hash : 0;
+}
+
+// The reference is only valid until the next name gets interned
+const std::string	&Atom::folded() const
+{
+	static const std::string	none;
+
+	return _id ? _entries[_id].folded : none;
+}
+
+// Helpers
+// -----------------------------------------------------------------------------
+// FNV-1a over the casefolded bytes
+unsigned int	Atom::hashOf(const char *name, size_t len)
+{
+	unsigned int	hash = 2166136261u;
+
+	for (size_t i = 0; i < len; ++i)
+	{
+		hash ^= foldChar(static_cast<unsigned char>(name[i]));
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+bool	Atom::equalFolded(const std::string &a, const std::string &b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); ++i)
+		if (foldChar(static_cast<unsigned char>(a[i])) != foldChar(static_cast<unsigned char>(b[i])))
+			return false;
+	return true;
+}
+
+char	Atom::foldByte(char c)
+{
+	return static_cast<char>(foldChar(static_cast<unsigned char>(c)));
+}
+
+std::string	Atom::fold(const std::string &name)
+{
+	std::string	folded(name);
+
+	for (size_t i = 0; i < folded.size(); ++i)
+		folded[i] = foldChar(static_cast<unsigned char>(folded[i]));
+	return folded;
+}
+
+// Stats
+// -----------------------------------------------------------------------------
+size_t	Atom::count()
+{
+	return _count;
+}
+
+size_t	Atom::bucketCount()
+{
+	return _buckets.size();
+}
+
+// Table
+// -----------------------------------------------------------------------------
+unsigned int	Atom::lookup(const char *name, size_t len, unsigned int hash)
+{
+	unsigned int id = _buckets[hash & (_buckets.size() - 1)];
+
+	while (id)
+	{
+		const Entry &entry = _entries[id];
+		if (entry.hash == hash && entry.folded.size() == len)
+		{
+			size_t i = 0;
+			while (i < len && entry.folded[i] == static_cast<char>(foldChar(static_cast<unsigned char>(name[i]))))
+				++i;
+			if (i == len)
+				return id;
+		}
+		id = entry.next;
+	}
+	return 0;
+}
+
+unsigned int	Atom::intern(const std::string &name)
+{
+	if (name.empty())
+		return 0;
+	if (_entries.empty())
+	{
+		_entries.push_back(Entry());	// the empty atom
+		_buckets.assign(64, 0);
+	}
+
+	unsigned int	hash = hashOf(name.data(), name.size());
+	unsigned int	id = lookup(name.data(), name.size(), hash);
+
+	if (id)
+	{
+		++_entries[id].refs;
+		return id;
+	}
+	if (_count >= _buckets.size())
+		rehash(_buckets.size() * 2);
+	if (_freeIds.empty())
+	{
+		id = _entries.size();
+		_entries.push_back(Entry());
+	}
+	else
+	{
+		id = _freeIds.back();
+		_freeIds.pop_back();
+	}
+
+	Entry		&entry = _entries[id];
+	unsigned int &bucket = _buckets[hash & (_buckets.size() - 1)];
+
+	entry.folded = fold(name);
+	entry.hash = hash;
+	entry.refs = 1;
+	entry.next = bucket;
+	bucket = id;
+	++_count;
+	return id;
+}
+
+void	Atom::retain(unsigned int id)
+{
+	if (id)
+		++_entries[id].refs;
+}
+
+// The last reference unlinks the entry from its bucket and frees the id
+void	Atom::release(unsigned int id)
+{
+	if (!id || --_entries[id].refs)
+		return ;
+
+	Entry			&entry = _entries[id];
+	unsigned int	*link = &_buckets[entry.hash & (_buckets.size() - 1)];
+
+	while (*link != id)
+		link = &_entries[*link].next;
+	*link = entry.next;
+	entry.folded.clear();
+	entry.next = 0;
+	_freeIds.push_back(id);
+	--_count;
+}
+
+void	Atom::rehash(size_t buckets)
+{
+	_buckets.assign(buckets, 0);
+	for (unsigned int id = 1; id < _entries.size(); ++id)
+	{
+		Entry &entry = _entries[id];
+		if (!entry.refs)
+			continue ;
+		unsigned int &bucket = _buckets[entry.hash & (buckets - 1)];
+		entry.next = bucket;
+		bucket = id;
+	}
+}
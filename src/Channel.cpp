@@ -17,13 +17,22 @@
 // -----------------------------------------------------------------------------
 Channel::Channel(const std::string &name, const std::string &topic) : 
 	_channelName(name),
+	_atom(name),
 	_topic(topic),
 	_topicChange(""),
 	_key(""),
 	_limit(0),
 	_inviteOnly(false),
 	_topicProtected(true),
-	_clients()
+	_clients(),
+	_invites(),
+	_pendingOps(),
+	_history(name),
+	_bans(),
+	_excepts(),
+	_inviteExcepts(),
+	_banGeneration(0),
+	_banCache()
 {
     Logger::log("Channel CREATED: " + _channelName);
 	logChanel();
@@ -43,6 +52,7 @@ void 	Channel::iniChannel(Client *client)
 	msg =	":" + client->getUniqueName() + "!" + client->getUsername() + "@localhost" +" JOIN " + _channelName + " * :realname";
 	client->sendMessage(msg);
     this->addClient(client, STATE_O);
+	addHistory(History::EVENT_JOIN, client, "");
     Logger::log("Channel INIT: " + _channelName);
 	logChanel();
 }
@@ -51,15 +61,24 @@ void 	Channel::iniChannel(Client *client)
 // -----------------------------------------------------------------------------
 Channel::Channel(const Channel &other) : 
 	_channelName(other._channelName),
+	_atom(other._atom),
 	_topic(other._topic),
 	_topicChange(other._topicChange),
 	_key(other._key),
 	_limit(other._limit),
 	_inviteOnly(other._inviteOnly),
-	_topicProtected(other._topicProtected)
+	_topicProtected(other._topicProtected),
+	_invites(other._invites),
+	_pendingOps(other._pendingOps),
+	_history(other._history),
+	_bans(other._bans),
+	_excepts(other._excepts),
+	_inviteExcepts(other._inviteExcepts),
+	_banGeneration(other._banGeneration),
+	_banCache(other._banCache)
 {
 	Logger::log("Channel COPIED: " + _channelName);
-	std::map<Client *, int>::const_iterator it;
+	ClientStateMap::const_iterator it;
 	for(it = other._clients.begin(); it != other._clients.end(); ++it)
 		_clients.insert(*it);
 	logChanel();
@@ -69,7 +88,7 @@ Channel::Channel(const Channel &other) :
 // -----------------------------------------------------------------------------
 Channel::~Channel()
 {
-	std::map<Client *, int>::const_iterator it;
+	ClientStateMap::const_iterator it;
 	for(it = _clients.begin(); it != _clients.end(); ++it)
 		it->first->removeChannel(this);
 	_clients.clear();
@@ -80,20 +99,29 @@ Channel::~Channel()
 // -----------------------------------------------------------------------------
 bool	Channel::operator==(const Channel &other) const
 {
-	return this->_channelName == other._channelName;
+	return _atom == other._atom;
 }
 
 // So the Server can check if the Channel still has an operator
 // -----------------------------------------------------------------------------
 bool	Channel::isActive() const
 {
-	std::map<Client *, int>::const_iterator it;
+	ClientStateMap::const_iterator it;
 	for(it = _clients.begin(); it != _clients.end(); ++it)
 		if (it->second == STATE_O)
 			return true;
 	return false;
 }
 
+// The lobby can't be left and doesn't die without operators
+// -----------------------------------------------------------------------------
+bool	Channel::isLobby() const
+{
+	static const Atom	lobby(LOBBY_NAME);
+
+	return _atom == lobby;
+}
+
 // Members & Operators funtionality
 // -----------------------------------------------------------------------------
 /*
@@ -110,14 +138,18 @@ void	Channel::joinChannel(Client *client, const std::string &pswd)
 		return ;
 
 	// IF ALREADY IN CHANNEL
-	if (getClientState(client) > STATE_I)
+	if (getClientState(client) >= STATE_C)
 	{
 		// SEND MESSAGE ALREADY IN CHANNEL
 		client->sendMessage(ERR_USERONCHANNEL, client->getUniqueName() + " " +  _channelName + " :is already on channel");
 		Logger::log("Client " + client->getUniqueName() + " is already in " + _channelName);
 		return ;
 	}
-	
+
+	// IS BANNED (+b WITHOUT A MATCHING +e)?
+	if (isBanned(client))
+		return client->sendMessage(ERR_BANNEDFROMCHAN, _channelName + " :Cannot join channel (+b)");
+
 	// IS K FLAG?
 	if (!_key.empty())
 	{
@@ -132,8 +164,8 @@ void	Channel::joinChannel(Client *client, const std::string &pswd)
 	// IF I FLAG
 	if (_inviteOnly)
 	{
-		// CHECK IF INVITED
-		if (getClientState(client) < STATE_I)
+		// CHECK IF INVITED (OR ON THE +I LIST)
+		if (!isInvited(client) && !_inviteExcepts.match(client->getHostmask()))
 		{
 			client->sendMessage(ERR_INVITEONLYCHAN, _channelName + " :Cannot join channel (+i)");
 			return ;
@@ -144,17 +176,15 @@ void	Channel::joinChannel(Client *client, const std::string &pswd)
 	if (_limit != 0)
 	{
 		// CHECK IF CHANNEL IS FULL
-		int noOfClients = 0;
-		std::map<Client *, int>::const_iterator it;
-		for(it = _clients.begin(); it != _clients.end(); ++it)
-			if (it->second > STATE_I)
-				noOfClients++;
-		if (noOfClients >= _limit)
+		if (_clients.size() >= static_cast<size_t>(_limit))
 			return client->sendMessage(ERR_CHANNELISFULL, _channelName + " :Cannot join channel (+l)");
 	}
 
 	// IF WE GOT HERE
 	// JOIN CHANNEL
+	// (AN OPERATOR FROM BEFORE THE RESTART GETS +o BACK, IF THE WHOLE HOSTMASK
+	// IS THE SAME, NOT JUST THE NICK)
+	bool	restoredOp = !_pendingOps.empty() && _pendingOps.erase(Atom::fold(client->getHostmask())) > 0;
 
 	// 1. MSG TO NEW CLIENT
 	std::string msgToSend;
@@ -162,11 +192,16 @@ void	Channel::joinChannel(Client *client, const std::string &pswd)
 	client->sendMessage(msgToSend);
 
 	// 2. ADD CLIENT TO CHANNEL (which will send him the mode and topic, and names)
+	// (AN INVITE IS USED UP BY THE JOIN)
+	dropInvite(client);
 	client->addChannel(this);
-	this->addClient(client, STATE_C);
+	this->addClient(client, restoredOp ? STATE_O : STATE_C);
 	
 	// 3. SEND JOIN MESSAGE TO EVERYONE ELSE
 	this->sendMessageToClients(msgToSend, client);
+	if (restoredOp)
+		this->sendMessageToClients(":localhost MODE " + _channelName + " +o " + client->getUniqueName());
+	addHistory(History::EVENT_JOIN, client, "");
 
 	Logger::log("Client " + client->getUniqueName() + " joined " + _channelName);
 }
@@ -181,7 +216,7 @@ void	Channel::inviteToChannel(Client *host, Client *guest)
 	}
 	
 	// IF GUEST ALREADY IN CHANNEL
-	if (getClientState(guest) >= STATE_I)
+	if (getClientState(guest) >= STATE_C)
 	{
 		host->sendMessage(ERR_USERONCHANNEL, guest->getUniqueName() + " " +  _channelName + " :is already on channel");
 		return ;
@@ -197,12 +232,12 @@ void	Channel::inviteToChannel(Client *host, Client *guest)
 		}
 	}
 	
-	// Add guest to the invitation list
-	this->addClient(guest, STATE_I);
+	// Add guest to the invitation list (or give him a new hour)
+	addInvite(guest);
 
 	// SEND INVITE
 	// host :Aurora.AfterNET.Org 341 astein astein__ #test3
-	host->sendMessage(RPL_INVITING, guest->getUniqueName() + " " + _channelName);
+	host->sendReply(Reply(RPL_INVITING, host->getUniqueName()) << guest->getUniqueName() << ' ' << _channelName);
 	
 	// guest :astein!alex@F456A.75198A.60D2B2.ADA236.IP INVITE astein__ #test3
 	guest->sendMessage(":" + host->getUniqueName() + "!" + host->getUsername() +
@@ -248,7 +283,7 @@ void	Channel::partChannel(Client *client, const std::string &reason)
 		return ;
 
 	// PREVENT CLEINT FROM LEAVING LOBBY CHANNEL
-	if (_channelName == "#lobby")
+	if (isLobby())
 	{
 		client->sendMessage(ERR_UNKNOWNCOMMAND, _channelName + " :You can't leave the Lobby channel!");
 		return ;
@@ -271,12 +306,19 @@ void	Channel::partChannel(Client *client, const std::string &reason)
 	std::string msg = ":" + client->getUniqueName() + "!" + client->getUsername() + "@localhost" +
 		" PART " + _channelName + " :" + r;
 	this->sendMessageToClients(msg);
+	addHistory(History::EVENT_PART, client, r);
 
 	client->removeChannel(this);
 	this->removeClient(client);
 	Logger::log("Client " + client->getUniqueName() + " left " + _channelName);
 }
 
+// Operators can always talk, a banned client (member or not) can't
+bool	Channel::canSend(const Client *client)
+{
+	return getClientState(client) == STATE_O || !isBanned(client);
+}
+
 // Modes & Topic funtionality
 // -----------------------------------------------------------------------------
 void	Channel::topicOfChannel(Client *sender, const std::string &topic)
@@ -323,18 +365,26 @@ void	Channel::topicOfChannel(Client *sender, const std::string &topic)
 		" TOPIC " + _channelName + " :" + _topic;
 
 	sendMessageToClients(confirmMsg);
+	addHistory(History::EVENT_TOPIC, sender, _topic);
 
 	Logger::log("Topic changed to: " + _topic + " by " + sender->getUniqueName());
 	Logger::log("Topic change message: " + _topicChange);
 }
 
-void	Channel::modeOfChannel(Client *sender, const std::string &flag, const std::string &value, Server *server)
+// MODE #<channelName> <modes> {<param>}, e.g. "+itk-l key" or "+ooo a b c"
+// Every change is checked against the state the earlier ones left behind and
+// all of them are applied together at the end, so the members get a single
+// MODE line with what really changed. Only MODES_MAX modes which take a
+// parameter are handled, the rest of the mode string is ignored.
+// b, e and I without a mask list the entries instead, which every member
+// may do.
+void	Channel::modeOfChannel(Client *sender, const std::string &modes, const std::vector<std::string> &params, Server *server)
 {
 	// IF FLAG IS NOT PROVIDED
-	if (flag.empty())
+	if (modes.empty())
 	{
 		// 	:Aurora.AfterNET.Org 324 ash2223 #test +tinrc 
-		sender->sendMessage(RPL_CHANNELMODEIS, _channelName + " " + getChannelFlags());
+		sender->sendReply(Reply(RPL_CHANNELMODEIS, sender->getUniqueName()) << _channelName << ' ' << getChannelFlags());
 		return ;
 	}
 
@@ -344,189 +394,219 @@ void	Channel::modeOfChannel(Client *sender, const std::string &flag, const std::
 		sender->sendMessage(ERR_NOTONCHANNEL, _channelName + " :You're not on that channel");
 		return ;
 	}
-	
-	std::string mode = "@";
-	char sign = '+';
-	
-	if (flag.size() == 1)
-	{
-		mode[0] = flag[0];
-	}
-	else if (flag.size() == 2)
-	{
-		sign = flag[0];
-		mode[0] = flag[1];
-	}
-
-	// MODE IS WRONG IF
-	// 	- SIGN IS NOT + OR -
-	// 	- FLAG IS NOT 1 OR 2 CHAR LONG
-	// 	- FLAG IS NOT ONE OFF THE FOLLOWING: itkol
-	if ((sign != '+' && sign != '-') || (flag.size() > 2) || (mode.find_first_not_of("itkol") != std::string::npos))
-	{
-		sender->sendMessage(ERR_UNKNOWNMODE, sender->getUniqueName() + " " + flag + " :is unknown mode char to me");
-		return ;
-	}
 
-	// CHECK IS OPERATOR
-	if (getClientState(sender) < STATE_O)
+	// CHECK IS OPERATOR (NOT NEEDED TO ONLY LOOK AT THE LISTS)
+	bool	listOnly = params.empty() && modes.find_first_not_of("+-beI") == std::string::npos;
+	if (!listOnly && getClientState(sender) < STATE_O)
 	{
 		sender->sendMessage(ERR_CHANOPRIVSNEEDED, _channelName + " :You're not channel operator");
 		return ;
 	}
 
-	switch (mode[0])
+	// THE NEW STATE, ONLY COMMITTED WHEN THE WHOLE STRING IS DONE
+	bool					inviteOnly = _inviteOnly;
+	bool					topicProtected = _topicProtected;
+	std::string				key = _key;
+	int						limit = _limit;
+	std::map<Client *, int>	states;
+	std::vector<std::string>	maskChanges;	// e.g. "+bnick!*@*"
+	std::string				listed;
+
+	std::string	applied;		// e.g. "+it-l"
+	std::string	appliedParams;	// e.g. " key"
+	char		appliedSign = 0;
+	char		sign = '+';
+	size_t		nextParam = 0;
+	size_t		withParam = 0;
+
+	for (size_t i = 0; i < modes.size(); i++)
 	{
-		// invite-only mode
-		case 'i':
+		char mode = modes[i];
+
+		if (mode == '+' || mode == '-')
 		{
-			if (_inviteOnly != (sign == '+'))
-			{
-				_inviteOnly = !_inviteOnly;
-				sendMessageToClients(":" + sender->getUniqueName() + "!" + sender->getUsername() + "@localhost" +
-					" MODE " + _channelName + " " + sign + mode);
-			}
-			break;
+			sign = mode;
+			continue ;
 		}
-		// topic change restriction 
-		case 't':
+		if (std::string("itkolbeI").find(mode) == std::string::npos)
 		{
-			if (_topicProtected != (sign == '+'))
-			{
-				_topicProtected = !_topicProtected;
-				sendMessageToClients(":" + sender->getUniqueName() + "!" + sender->getUsername() + "@localhost" +
-					" MODE " + _channelName + " " + sign + mode);
-			}
-			break;
+			sender->sendMessage(ERR_UNKNOWNMODE, std::string(1, mode) + " :is unknown mode char to me");
+			continue ;
 		}
-		case 'k':
+
+		// b, e AND I WITHOUT A MASK ARE A LOOK AT THE LIST
+		bool	isList = (mode == 'b' || mode == 'e' || mode == 'I');
+		if (isList && nextParam >= params.size())
 		{
-			// IF KEY IS NOT PROVIDED
-			if (value.empty())
-			{
-				sender->sendMessage(ERR_NEEDMOREPARAMS, "MODE " + mode + " :Not enough parameters");
+			if (listed.find(mode) == std::string::npos)
+				sendMaskList(sender, mode);
+			listed += mode;
+			continue ;
+		}
+
+		// k, o AND THE LISTS ALWAYS TAKE A PARAMETER, l ONLY WHEN IT'S SET
+		std::string	value;
+		if (mode == 'k' || mode == 'o' || isList || (mode == 'l' && sign == '+'))
+		{
+			if (withParam++ == MODES_MAX)
 				break ;
-			}
+			if (nextParam < params.size())
+				value = params[nextParam++];
+		}
 
-			// IF WE WANT TO SET ...
-			if (sign == '+')
+		bool changed = false;
+		switch (mode)
+		{
+			// invite-only mode
+			case 'i':
+				changed = (inviteOnly != (sign == '+'));
+				inviteOnly = (sign == '+');
+				break ;
+			// topic change restriction 
+			case 't':
+				changed = (topicProtected != (sign == '+'));
+				topicProtected = (sign == '+');
+				break ;
+			case 'k':
 			{
-				// ... AND KEY WAS SET BEFORE ...
-				if (!_key.empty())
+				// IF KEY IS NOT PROVIDED
+				if (value.empty())
 				{
-					// ... INFORM SENDER 
-					sender->sendMessage(ERR_KEYSET, _channelName + " :Channel key already set");
+					sender->sendMessage(ERR_NEEDMOREPARAMS, "MODE k :Not enough parameters");
+					break ;
 				}
-				// ...AND KEY WAS EMPTY BEFORE...
-				else
+				// A KEY CAN ONLY BE SET WHEN THERE IS NONE AND ONLY BE
+				// REMOVED WITH THE RIGHT ONE
+				if (sign == '+' && key.empty())
 				{
-					// ... SET IT
-					_key = value;
-					// :ash2223!anshovah@F456A.75198A.60D2B2.ADA236.IP MODE #test +k try
-					sendMessageToClients(":" + sender->getUniqueName() + "!" + sender->getUsername() + "@localhost" +
-						" MODE " + _channelName + " " + sign + mode + " " + value);
+					key = value;
+					changed = true;
 				}
-			}
-			// IF WE WANT TO REMOVE KEYWORD ...
-			else
-			{
-				// ... IF KEYWORD WAS SET BEFORE AND ...
-				if (!_key.empty())
+				else if (sign == '+' || (value != key && !key.empty()))
+					sender->sendMessage(ERR_KEYSET, _channelName + " :Channel key already set");
+				else if (!key.empty())
 				{
-					// ... IF VALUE IS CORRECT KEY
-					if (value == _key) // remove channel keyword
-					{
-						// :ash2223!anshovah@F456A.75198A.60D2B2.ADA236.IP MODE #test -k try
-						_key = "";
-						sendMessageToClients(":" + sender->getUniqueName() + "!" + sender->getUsername() + "@localhost" +
-						" MODE " + _channelName + " " + sign + mode + " " + value);
-					}
-					// ... IF VALUE IS NOT CORRECT KEY
-					else
-					{
-						// :luna.AfterNET.Org 467 ash2223 #test :Channel key already set
-						sender->sendMessage(ERR_KEYSET, _channelName + " :Channel key already set");
-						break ;
-					}
+					key = "";
+					changed = true;
 				}
-				// ... IF IT WAS NOT SET BEFORE --> IGNORE IT
 				break ;
 			}
-			break ;
-		}
-		case 'l':
-		{
-			if (sign == '-')
+			case 'l':
 			{
-				// IF FLAG WAS SET
-				if (_limit != 0)
+				if (sign == '-')
 				{
-					// UNSET IT AND INFORM
-					_limit = 0;
-					sendMessageToClients(":" + sender->getUniqueName() + "!" + sender->getUsername() + "@localhost" +
-						" MODE " + _channelName + " -l");
+					changed = (limit != 0);
+					limit = 0;
+					break ;
 				}
-				break ;
-			}
-			//IF SIGN IS +
-			else
-			{
-				if(value.empty())
+				if (value.empty())
 				{
 					sender->sendMessage(ERR_NEEDMOREPARAMS, "MODE +l :Not enough parameters");
 					break ;
 				}
-
 				// CHECK IF VALUE IS A POSITIVE SIGNED INTEGER
-				if (intNoOverflow(value))
+				if (!intNoOverflow(value))
+					break ;
+				int newLimit = std::atoi(value.c_str());
+				if (newLimit <= 0)
 				{
-					int newLimit = std::atoi(value.c_str());
-					if (_limit == newLimit)
-						break ;
-					if (newLimit <= 0)
-					{
-						sender->sendMessage(ERR_NEEDMOREPARAMS, "MODE +l :Not enough parameters");
-						break ;
-					}
-					_limit = newLimit;
-					sendMessageToClients(":" + sender->getUniqueName() + "!" + sender->getUsername() + "@localhost" +
-						" MODE " + _channelName + " +l " + to_string(_limit));
+					sender->sendMessage(ERR_NEEDMOREPARAMS, "MODE +l :Not enough parameters");
+					break ;
 				}
+				changed = (limit != newLimit);
+				limit = newLimit;
+				value = to_string(limit);
 				break ;
 			}
-			break ;
-		}
-		case 'o':
-		{
-			// IF TARGET IS NOT PROVIDED
-			if(value.empty())
-				break ;
-			// IF TARGET IS DOESN'T EXIST
-			Client *target = server->getClientByNick(value);
-			if (!target)
+			case 'o':
 			{
-				sender->sendMessage(ERR_NOSUCHNICK, value + " :No such nick/channel");
+				// IF TARGET IS NOT PROVIDED
+				if (value.empty())
+					break ;
+				// IF TARGET IS DOESN'T EXIST
+				Client *target = server->getClientByNick(value);
+				if (!target)
+				{
+					sender->sendMessage(ERR_NOSUCHNICK, value + " :No such nick/channel");
+					break ;
+				}
+				// IF TARGET IS NOT IN CHANNEL
+				if (getClientState(target) < STATE_C)
+				{
+					sender->sendMessage(ERR_USERNOTINCHANNEL, value + " " + _channelName + " :They aren't on that channel");
+					break ;
+				}
+				int state = states.count(target) ? states[target] : getClientState(target);
+				if ((state == STATE_O) != (sign == '+'))
+				{
+					states[target] = (sign == '+' ? STATE_O : STATE_C);
+					changed = true;
+				}
 				break ;
 			}
-			// IF TARGET IS NOT IN CHANNEL
-			if (getClientState(target) < STATE_C)
+			default:
 			{
-				sender->sendMessage(ERR_USERNOTINCHANNEL, value + " " + _channelName + " :They aren't on that channel");
+				// b, e OR I: IS THE MASK ON THE LIST AFTER THE EARLIER CHANGES?
+				value = MaskList::normalize(value);
+				MaskList	&list = getMaskList(mode);
+				bool		present = list.contains(value);
+				size_t		added = 0;
+				for (size_t c = 0; c < maskChanges.size(); ++c)
+				{
+					if (maskChanges[c][1] != mode)
+						continue ;
+					if (maskChanges[c][0] == '+')
+						added++;
+					if (Atom::fold(maskChanges[c].substr(2)) == Atom::fold(value))
+						present = (maskChanges[c][0] == '+');
+				}
+				if (present == (sign == '+'))
+					break ;
+				if (sign == '+' && list.size() + added >= MASKLIST_MAX)
+				{
+					sender->sendMessage(ERR_BANLISTFULL, _channelName + " " + mode + " :Channel list is full");
+					break ;
+				}
+				maskChanges.push_back(std::string(1, sign) + mode + value);
+				changed = true;
 				break ;
 			}
-
-			// IF TARGET IS NOT AN OPERATOR YET AND WE WANT TO MAKE HIM ONE...
-			// OR IF TARGET IS AN OPERATOR AND WE WANT TO REMOVE HIM
-			if ((getClientState(target) == STATE_O) != (sign == '+'))
-			{
-				// ... MAKE HIM ONE OR REMOVE HIM AND INFORM
-				addClient(target, sign == '+' ? STATE_O : STATE_C);
-				sendMessageToClients(":" + sender->getUniqueName() + "!" + sender->getUsername() + "@localhost" +
-					" MODE " + _channelName + " " + sign + "o " + value);
-			}
-			break ;
 		}
+		if (!changed)
+			continue ;
+		if (appliedSign != sign)
+		{
+			applied += sign;
+			appliedSign = sign;
+		}
+		applied += mode;
+		if (!value.empty())
+			appliedParams += " " + value;
 	}
+	if (applied.empty())
+		return ;
+
+	_inviteOnly = inviteOnly;
+	_topicProtected = topicProtected;
+	_key = key;
+	_limit = limit;
+	for (std::map<Client *, int>::const_iterator it = states.begin(); it != states.end(); ++it)
+		_clients[it->first] = it->second;
+	for (size_t i = 0; i < maskChanges.size(); ++i)
+	{
+		char				mode = maskChanges[i][1];
+		const std::string	mask = maskChanges[i].substr(2);
+
+		if (maskChanges[i][0] == '+')
+			getMaskList(mode).add(mask, sender->getHostmask(), std::time(0));
+		else
+			getMaskList(mode).remove(mask);
+		if (mode != 'I')
+			_banGeneration++;
+	}
+	// :ash2223!anshovah@F456A.75198A.60D2B2.ADA236.IP MODE #test +ok ash try
+	sendMessageToClients(":" + sender->getUniqueName() + "!" + sender->getUsername() + "@localhost" +
+		" MODE " + _channelName + " " + applied + appliedParams);
 }
 
 // Simple List Management
@@ -536,11 +616,8 @@ void	Channel::modeOfChannel(Client *sender, const std::string &flag, const std::
 void	Channel::addClient		(Client *client, int status)
 {
 	_clients[client] = status;
-	if (status > STATE_I)
-	{
-		sendTopicMessage(client);
-		sendNamesMessage(client);
-	}
+	sendTopicMessage(client);
+	sendNamesMessage(client);
 	Logger::log("Channel " + _channelName + " added/changed client: " + client->getUniqueName() + " to status " + to_string(status));
 	logChanel();
 }
@@ -548,6 +625,7 @@ void	Channel::addClient		(Client *client, int status)
 void	Channel::removeClient	(Client *client)
 {
 	_clients.erase(client);
+	_banCache.erase(client);
 }
 
 // Channel Broadcast Message
@@ -555,16 +633,17 @@ void	Channel::removeClient	(Client *client)
 // If sender is provided, it will not send the message to the sender
 void	Channel::sendMessageToClients(const std::string &ircMessage, Client *sender) const
 {
-    std::map<Client *, int>::const_iterator it;
+	AllocScope	scope(ALLOC_FANOUT);
+
+    ClientStateMap::const_iterator it;
 	for(it = _clients.begin(); it != _clients.end(); ++it)
 	{
 		if (sender && *it->first == *sender)
 			continue ;
-		// IF CLIENT IS NOT IN THE CHANNEL SKIP IT (INVITED CLIENTS)
-		if (it->second < STATE_C)
-			continue ;
 		it->first->sendMessage(ircMessage);
 	}
+	if (!Logger::isActive())
+		return ;
 	std::string logMsg ="Channel " + _channelName + " sent message to all clients";
 	if(sender)
 		logMsg += " except " + sender->getUniqueName();
@@ -574,24 +653,22 @@ void	Channel::sendMessageToClients(const std::string &ircMessage, Client *sender
 
 void	Channel::sendWhoMessage(Client *receiver) const
 {
-	std::map<Client *, int>::const_iterator it;
+	ClientStateMap::const_iterator it;
 	
 	if(_clients.empty())
 		return ;
 	for(it = _clients.begin(); it != _clients.end(); ++it)
 	{
 		// >> :Aurora.AfterNET.Org 352 astein #birdsandbees anshovah F456A.75198A.60D2B2.ADA236.IP *.afternet.org astein H@xz :0 realname
-		std::string flags = "H";
+		const Client	*member = it->first;
+		Reply			who(RPL_WHOREPLY, receiver->getUniqueName());
+		who << _channelName << ' ' << member->getUsername() << ' ' << member->getHostname() <<
+			" * " << member->getUniqueName() << " H";
 		if (it->second == STATE_O)
-			flags += "@";
-		else if (it->second == STATE_I)
-			flags += "*";
-		// flags += "xz";
-		receiver->sendMessage(RPL_WHOREPLY, _channelName + " " + it->first->getUsername() +
-			" " + it->first->getHostname() + " * " + it->first->getUniqueName() + " "  +
-			flags + " :0 " + it->first->getFullname());
-	}
-	receiver->sendMessage(RPL_ENDOFWHO, _channelName + " :End of /WHO list.");
+			who << '@';
+		receiver->sendReply(who << " :0 " << member->getFullname());
+	}
+	receiver->sendReply(Reply(RPL_ENDOFWHO, receiver->getUniqueName()) << _channelName << " :End of /WHO list.");
 	Logger::log("Channel " + _channelName + " sent WHO message to " + receiver->getUniqueName());
 }
 
@@ -599,24 +676,242 @@ void	Channel::sendTopicMessage(Client *receiver) const
 {
 	if (_topic.empty())
 	{
-		receiver->sendMessage(RPL_NOTOPIC, _channelName + " :No topic is set");
+		receiver->sendReply(Reply(RPL_NOTOPIC, receiver->getUniqueName()) << _channelName << " :No topic is set");
 		Logger::log("Channel " + _channelName + " sent NO TOPIC message to " + receiver->getUniqueName());
 		return ;
 	}
 
-	receiver->sendMessage(RPL_TOPIC, _channelName + " :" + _topic);
-	receiver->sendMessage(RPL_TOPICADDITIONAL, _channelName + " " + _topicChange);
+	const std::string	&nick = receiver->getUniqueName();
+	receiver->sendReply(Reply(RPL_TOPIC, nick) << _channelName << " :" << _topic);
+	receiver->sendReply(Reply(RPL_TOPICADDITIONAL, nick) << _channelName << ' ' << _topicChange);
 	Logger::log("Channel " + _channelName + " sent TOPIC message to " + receiver->getUniqueName());
 }
 
+// As many names per 353 as fit into a line
 void	Channel::sendNamesMessage(Client *receiver) const
 {
-	std::string names = getClientList();
-	receiver->sendMessage(RPL_NAMREPLY, "= " + _channelName + " :" + names);
-	receiver->sendMessage(RPL_ENDOFNAMES, _channelName + " :End of /NAMES list.");
+	const std::string	&nick = receiver->getUniqueName();
+	Reply				names(RPL_NAMREPLY, nick);
+	size_t				header;
+
+	names << "= " << _channelName << " :";
+	header = names.size();
+	for (ClientStateMap::const_iterator it = _clients.begin(); it != _clients.end(); ++it)
+	{
+		const std::string	&member = it->first->getUniqueName();
+		if (names.size() > header && names.room() < member.size() + 2)
+		{
+			receiver->sendReply(names);
+			names = Reply(RPL_NAMREPLY, nick);
+			names << "= " << _channelName << " :";
+		}
+		if (it->second == STATE_O)
+			names << '@';
+		names << member << ' ';
+	}
+	receiver->sendReply(names);
+	receiver->sendReply(Reply(RPL_ENDOFNAMES, nick) << _channelName << " :End of /NAMES list.");
 	Logger::log("Channel " + _channelName + " sent NAMES message to " + receiver->getUniqueName());
 }
 
+// Server links
+// -----------------------------------------------------------------------------
+// "<flags> <key> <limit>" e.g. "+ti * 0" (the key is never "*" because the
+// MODE parser doesn't allow it)
+const std::string	Channel::getBurstModes() const
+{
+	std::string flags = "+";
+
+	if (_topicProtected)
+		flags += "t";
+	if (_inviteOnly)
+		flags += "i";
+	return flags + " " + (_key.empty() ? "*" : _key) + " " + to_string(_limit);
+}
+
+const std::string	&Channel::getTopic() const
+{
+	return _topic;
+}
+
+const std::string	&Channel::getTopicChange() const
+{
+	return _topicChange;
+}
+
+void	Channel::applyBurstModes(const std::string &flags, const std::string &key, int limit)
+{
+	_topicProtected = flags.find('t') != std::string::npos;
+	_inviteOnly = flags.find('i') != std::string::npos;
+	_key = key == "*" ? "" : key;
+	_limit = limit < 0 ? 0 : limit;
+	Logger::log("Channel " + _channelName + " took the modes of the burst: " + getBurstModes());
+}
+
+void	Channel::applyBurstTopic(const std::string &topic, const std::string &topicChange)
+{
+	_topic = topic;
+	_topicChange = topicChange;
+}
+
+// A member of the other side of a new link: the local members see a JOIN
+// (and a MODE +o for an operator), no limits or keys are checked
+void	Channel::burstJoin(Client *client, bool op)
+{
+	int	state = getClientState(client);
+
+	if (state >= STATE_C && (!op || state == STATE_O))
+		return ;
+	std::string prefix = ":" + client->getUniqueName() + "!" + client->getUsername() + "@localhost";
+	if (state < STATE_C)
+	{
+		client->addChannel(this);
+		_clients[client] = STATE_C;
+		sendMessageToClients(prefix + " JOIN " + _channelName + " * :realname", client);
+	}
+	if (op)
+	{
+		_clients[client] = STATE_O;
+		sendMessageToClients(":localhost MODE " + _channelName + " +o " + client->getUniqueName(), client);
+	}
+}
+
+// Snapshots
+// -----------------------------------------------------------------------------
+// The operators are saved by nick (also the ones which didn't come back yet).
+// Called from the snapshot child, so nothing is logged here.
+void	Channel::getSnapshot(Snapshot::Record &record) const
+{
+	record.name = _channelName;
+	record.topic = _topic;
+	record.topicChange = _topicChange;
+	record.key = _key;
+	record.limit = _limit;
+	record.inviteOnly = _inviteOnly;
+	record.topicProtected = _topicProtected;
+	record.operators.clear();
+	for (ClientStateMap::const_iterator it = _clients.begin(); it != _clients.end(); ++it)
+		if (it->second == STATE_O)
+			record.operators.push_back(it->first->getHostmask());
+	for (std::set<std::string>::const_iterator it = _pendingOps.begin(); it != _pendingOps.end(); ++it)
+		record.operators.push_back(*it);
+	const MaskList	*lists[3] = {&_bans, &_excepts, &_inviteExcepts};
+	for (size_t list = 0; list < 3; ++list)
+	{
+		const std::vector<MaskList::Entry>	&entries = lists[list]->getEntries();
+		record.masks[list].resize(entries.size());
+		for (size_t i = 0; i < entries.size(); ++i)
+		{
+			record.masks[list][i].mask = entries[i].mask;
+			record.masks[list][i].setter = entries[i].setter;
+			record.masks[list][i].time = entries[i].time;
+		}
+	}
+}
+
+// The channel comes back empty; its operators get their status back when
+// they join again from the same hostmask. A plain nick (of an older snapshot)
+// would give +o to anyone who takes it, so it's dropped.
+void	Channel::restore(const Snapshot::Record &record)
+{
+	_topic = record.topic;
+	_topicChange = record.topicChange;
+	_key = record.key;
+	_limit = record.limit;
+	_inviteOnly = record.inviteOnly;
+	_topicProtected = record.topicProtected;
+	for (size_t i = 0; i < record.operators.size(); ++i)
+		if (record.operators[i].find('!') != std::string::npos)
+			_pendingOps.insert(Atom::fold(record.operators[i]));
+	for (size_t list = 0; list < 3; ++list)
+		for (size_t i = 0; i < record.masks[list].size() && i < MASKLIST_MAX; ++i)
+			getMaskList("beI"[list]).add(MaskList::normalize(record.masks[list][i].mask),
+				record.masks[list][i].setter, record.masks[list][i].time);
+	_banGeneration++;
+}
+
+// Hot upgrade
+// -----------------------------------------------------------------------------
+const ClientStateMap	&Channel::getMembers() const
+{
+	return _clients;
+}
+
+// The settings came with restore() already, so the member just takes its old
+// place; nobody sees a JOIN (invites of older binaries are dropped)
+void	Channel::resumeMember(Client *client, int state)
+{
+	if (state < STATE_C)
+		return ;
+	_pendingOps.erase(Atom::fold(client->getHostmask()));
+	client->addChannel(this);
+	_clients[client] = state;
+}
+
+// Message history
+// -----------------------------------------------------------------------------
+void	Channel::addHistory(int type, const Client *client, const std::string &text)
+{
+	_history.add(type, client->getUniqueName() + "!" + client->getUsername() + "@localhost", text);
+}
+
+// IRCv3 style: the events come in a BATCH, each one tagged with its time and
+// its id (the id is what the client pages with). Only what the client asked
+// for with CAP REQ is sent: without batch the JOINs, PARTs and TOPICs are
+// left out (they'd look like they happen right now) and the PRIVMSGs come as
+// plain lines.
+void	Channel::sendHistory(Client *receiver, uint64_t after, uint64_t before, size_t limit, bool newest) const
+{
+	static const char		*commands[] = {"PRIVMSG", "TOPIC", "JOIN", "PART"};
+	static unsigned long	batches = 0;
+
+	// IF RECEIVER IS NOT IN CHANNEL
+	if (getClientState(receiver) < STATE_C)
+	{
+		receiver->sendMessage(ERR_NOTONCHANNEL, _channelName + " :You're not on that channel");
+		return ;
+	}
+
+	std::vector<History::Event>	events;
+	bool						batched = receiver->hasCap(CAP_BATCH);
+	std::string					batch;
+	_history.query(after, before, limit, newest, events);
+	if (batched)
+	{
+		batch = to_string(++batches);
+		receiver->sendMessage(":localhost BATCH +" + batch + " chathistory " + _channelName);
+	}
+	for (size_t i = 0; i < events.size(); ++i)
+	{
+		if (events[i].type > History::EVENT_PART || (!batched && events[i].type != History::EVENT_PRIVMSG))
+			continue ;
+		std::string	tags;
+		if (batched)
+			tags += ";batch=" + batch;
+		if (receiver->hasCap(CAP_SERVER_TIME))
+		{
+			// 2024-05-22T18:27:51.123Z
+			std::time_t	seconds = events[i].time / 1000;
+			struct tm	utc;
+			char		stamp[32];
+			gmtime_r(&seconds, &utc);
+			size_t len = std::strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &utc);
+			std::snprintf(stamp + len, sizeof(stamp) - len, ".%03ldZ", events[i].time % 1000);
+			tags += ";time=" + std::string(stamp);
+		}
+		if (receiver->hasCap(CAP_MESSAGE_TAGS))
+			tags += ";msgid=" + to_string(events[i].id);
+
+		std::string line = (tags.empty() ? "" : "@" + tags.substr(1) + " ") +
+			":" + events[i].source + " " + commands[events[i].type] + " " + _channelName;
+		if (events[i].type != History::EVENT_JOIN)
+			line += " :" + events[i].text;
+		receiver->sendMessage(line);
+	}
+	if (batched)
+		receiver->sendMessage(":localhost BATCH -" + batch);
+}
+
 // Getters and Setters
 // -----------------------------------------------------------------------------
 const std::string	&Channel::getUniqueName() const
@@ -624,20 +919,22 @@ const std::string	&Channel::getUniqueName() const
     return _channelName;
 }
 
+const Atom	&Channel::getAtom() const
+{
+	return _atom;
+}
+
 const std::string Channel::getClientList() const
 {
 	std::string users = "";
 
-	std::map<Client *, int>::const_iterator it;
+	ClientStateMap::const_iterator it;
 	for(it = _clients.begin(); it != _clients.end(); ++it)
 	{
-		if (it->second > STATE_I)
-		{
-			if (it->second == STATE_O)
-				users += "@";
-			users += it->first->getUniqueName();
-			users += " ";
-		}
+		if (it->second == STATE_O)
+			users += "@";
+		users += it->first->getUniqueName();
+		users += " ";
 	}
 	Logger::log("Created user (clients & operators) list for channel " + _channelName + ": " + users);
 	return users;
@@ -647,6 +944,8 @@ const std::string Channel::getClientList() const
 // -----------------------------------------------------------------------------
 void Channel::logChanel() const
 {
+	if (!Logger::isActive())
+		return ;
 	std::ostringstream header, values;
 	
 	// Log headers
@@ -684,21 +983,128 @@ void Channel::logChanel() const
 
 // Checks the state of a client
 // -----------------------------------------------------------------------------
-// 	-1: Client not in the list
-// 	 0: Client is only invited
+// 	-1: Client not in the list (maybe invited, see isInvited())
 // 	 1: Client is in the list
 // 	 2: Client is an operator
 int	Channel::getClientState(const Client *client) const
 {
-	if (_clients.empty() || !client)
+	if (!client)
 		return -1;
-	std::map<Client *, int>::const_iterator it;
+	ClientStateMap::const_iterator it = _clients.find(const_cast<Client *>(client));
+	if (it == _clients.end())
+		return -1;
+	return it->second;
+}
+
+// Invites
+// -----------------------------------------------------------------------------
+// They are kept by the connection id of the invited client, so whoever takes
+// the nick later isn't invited. The server drops the invites of a client
+// which changes its nick or leaves (see Server::dropInvites). Run out invites
+// are dropped when they're looked at or when room is needed.
+bool	Channel::isInvited(const Client *client)
+{
+	InviteMap::iterator it = _invites.find(client->getConnectionId());
+	if (it == _invites.end())
+		return false;
+	if (it->second > monotonicMs())
+		return true;
+	_invites.erase(it);
+	return false;
+}
+
+// When the channel has INVITE_MAX open invites, the oldest one goes
+void	Channel::addInvite(Client *client)
+{
+	long	now = monotonicMs();
 
-	for (it = _clients.begin(); it != _clients.end(); ++it)
-		// Check if the client is in the list
-		if (*client == *it->first)
-			return it->second;
-	return -1;
+	if (!_invites.count(client->getConnectionId()) && _invites.size() >= INVITE_MAX)
+	{
+		InviteMap::iterator oldest = _invites.end();
+		for (InviteMap::iterator it = _invites.begin(); it != _invites.end();)
+		{
+			if (it->second <= now)
+			{
+				_invites.erase(it++);
+				continue ;
+			}
+			if (oldest == _invites.end() || it->second < oldest->second)
+				oldest = it;
+			++it;
+		}
+		if (_invites.size() >= INVITE_MAX)
+			_invites.erase(oldest);
+	}
+	_invites[client->getConnectionId()] = now + INVITE_TTL_MS;
+	client->setInvited(true);
+}
+
+void	Channel::dropInvite(const Client *client)
+{
+	_invites.erase(client->getConnectionId());
+}
+
+// +b without a matching +e; only the answer for members is kept
+bool	Channel::isBanned(const Client *client)
+{
+	if (_bans.size() == 0)
+		return false;
+
+	std::map<const Client *, BanCache>::iterator	it = _banCache.find(client);
+	if (it != _banCache.end() && it->second.maskSerial == client->getMaskSerial() &&
+		it->second.generation == _banGeneration)
+		return it->second.banned;
+
+	std::string	hostmask = client->getHostmask();
+	BanCache	entry;
+	entry.maskSerial = client->getMaskSerial();
+	entry.generation = _banGeneration;
+	entry.banned = _bans.match(hostmask) && !_excepts.match(hostmask);
+	if (getClientState(client) >= STATE_C)
+		_banCache[client] = entry;
+	return entry.banned;
+}
+
+MaskList	&Channel::getMaskList(char mode)
+{
+	if (mode == 'e')
+		return _excepts;
+	if (mode == 'I')
+		return _inviteExcepts;
+	return _bans;
+}
+
+void	Channel::sendMaskList(Client *receiver, char mode)
+{
+	const std::string					&nick = receiver->getUniqueName();
+	const std::vector<MaskList::Entry>	&entries = getMaskList(mode).getEntries();
+
+	// One mask per line
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		Reply	entry = maskListReply(mode, nick, false);
+		receiver->sendReply(entry << _channelName << ' ' << entries[i].mask << ' ' <<
+			entries[i].setter << ' ' << entries[i].time);
+	}
+	Reply	end = maskListReply(mode, nick, true);
+	end << _channelName;
+	if (mode == 'e')
+		end << " :End of channel exception list";
+	else if (mode == 'I')
+		end << " :End of channel invite list";
+	else
+		end << " :End of channel ban list";
+	receiver->sendReply(end);
+}
+
+// The numerics are checked at compile time, so they are picked here
+Reply	Channel::maskListReply(char mode, const std::string &nick, bool end)
+{
+	if (mode == 'e')
+		return end ? Reply(RPL_ENDOFEXCEPTLIST, nick) : Reply(RPL_EXCEPTLIST, nick);
+	if (mode == 'I')
+		return end ? Reply(RPL_ENDOFINVITELIST, nick) : Reply(RPL_INVITELIST, nick);
+	return end ? Reply(RPL_ENDOFBANLIST, nick) : Reply(RPL_BANLIST, nick);
 }
 
 std::string			Channel::getChannelFlags()
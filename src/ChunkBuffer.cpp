@@ -0,0 +1,180 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   ChunkBuffer.cpp                                    :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/18 18:31:44 by astein            #+#    #+#             */
+/*   Updated: 2024/05/18 18:31:44 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "ChunkBuffer.hpp"
+#include "Pool.hpp"
+#include <cstring>
+
+// Construction / Destruction
+// -----------------------------------------------------------------------------
+ChunkBuffer::ChunkBuffer() :
+	_head(NULL),
+	_tail(NULL),
+	_size(0),
+	_chunks(0)
+{
+	// Nothing to do
+}
+
+ChunkBuffer::ChunkBuffer(const ChunkBuffer &other) :
+	_head(NULL),
+	_tail(NULL),
+	_size(0),
+	_chunks(0)
+{
+	*this = other;
+}
+
+ChunkBuffer	&ChunkBuffer::operator=(const ChunkBuffer &other)
+{
+	if (this == &other)
+		return *this;
+	clear();
+	for (Chunk *chunk = other._head; chunk; chunk = chunk->next)
+		append(chunk->data + chunk->begin, chunk->end - chunk->begin);
+	return *this;
+}
+
+ChunkBuffer::~ChunkBuffer()
+{
+	clear();
+}
+
+// Modify
+// -----------------------------------------------------------------------------
+void	ChunkBuffer::append(const char *data, size_t len)
+{
+	while (len > 0)
+	{
+		if (!_tail || _tail->end == sizeof(_tail->data))
+		{
+			Chunk *chunk = static_cast<Chunk *>(Pool::allocate(sizeof(Chunk)));
+			chunk->next = NULL;
+			chunk->begin = 0;
+			chunk->end = 0;
+			if (_tail)
+				_tail->next = chunk;
+			else
+				_head = chunk;
+			_tail = chunk;
+			_chunks++;
+		}
+		size_t room = sizeof(_tail->data) - _tail->end;
+		size_t n = len < room ? len : room;
+		std::memcpy(_tail->data + _tail->end, data, n);
+		_tail->end += n;
+		_size += n;
+		data += n;
+		len -= n;
+	}
+}
+
+void	ChunkBuffer::append(const std::string &str)
+{
+	append(str.data(), str.size());
+}
+
+// Drops the first len bytes (and gives emptied chunks back to the pool)
+void	ChunkBuffer::consume(size_t len)
+{
+	while (len > 0 && _head)
+	{
+		size_t available = _head->end - _head->begin;
+		size_t n = len < available ? len : available;
+		_head->begin += n;
+		_size -= n;
+		len -= n;
+		if (_head->begin == _head->end)
+		{
+			Chunk *next = _head->next;
+			Pool::deallocate(_head, sizeof(Chunk));
+			_head = next;
+			_chunks--;
+		}
+	}
+	if (!_head)
+		_tail = NULL;
+}
+
+void	ChunkBuffer::clear()
+{
+	consume(_size);
+	// Also catches an empty chunk left at the tail
+	while (_head)
+	{
+		Chunk *next = _head->next;
+		Pool::deallocate(_head, sizeof(Chunk));
+		_head = next;
+		_chunks--;
+	}
+	_tail = NULL;
+}
+
+// Read
+// -----------------------------------------------------------------------------
+bool	ChunkBuffer::empty() const
+{
+	return _size == 0;
+}
+
+size_t	ChunkBuffer::size() const
+{
+	return _size;
+}
+
+size_t	ChunkBuffer::chunkCount() const
+{
+	return _chunks;
+}
+
+size_t	ChunkBuffer::find(char c) const
+{
+	size_t offset = 0;
+
+	for (Chunk *chunk = _head; chunk; chunk = chunk->next)
+	{
+		size_t len = chunk->end - chunk->begin;
+		const void *hit = std::memchr(chunk->data + chunk->begin, c, len);
+		if (hit)
+			return offset + (static_cast<const char *>(hit) - (chunk->data + chunk->begin));
+		offset += len;
+	}
+	return std::string::npos;
+}
+
+std::string	ChunkBuffer::copyFront(size_t len) const
+{
+	std::string str;
+
+	if (len > _size)
+		len = _size;
+	str.reserve(len);
+	for (Chunk *chunk = _head; chunk && len > 0; chunk = chunk->next)
+	{
+		size_t available = chunk->end - chunk->begin;
+		size_t n = len < available ? len : available;
+		str.append(chunk->data + chunk->begin, n);
+		len -= n;
+	}
+	return str;
+}
+
+const char	*ChunkBuffer::front(size_t &len) const
+{
+	if (!_head)
+	{
+		len = 0;
+		return NULL;
+	}
+	len = _head->end - _head->begin;
+	return _head->data + _head->begin;
+}
@@ -13,18 +13,59 @@
 #include "Client.hpp"
 #include "Server.hpp"
 #include "utils.hpp"
+#include "Arena.hpp"
+
+// Every client and every change of its hostmask gets a new number, so a
+// channel can tell if what it remembers about a hostmask still holds
+static unsigned long	nextMaskSerial()
+{
+	static unsigned long	serial = 0;
+
+	return ++serial;
+}
+
+// Every connection (and every remote user) gets its own number, which isn't
+// given out again while the server runs
+static unsigned long	nextConnectionId()
+{
+	static unsigned long	id = 0;
+
+	return ++id;
+}
 
 // Constructors and Destructor
 // -----------------------------------------------------------------------------
 Client::Client(const int socketFd) : 
 	_socketFd(socketFd),
-	_inputBuffer(""),
+	_inputBuffer(),
 	_authenticated(false),
 	_nickname(""),
+	_nickAtom(),
 	_username(""),
 	_fullname(""),
 	_hostname("localhost"),
-	_channels()
+	_peerAddress(),
+	_channels(),
+	_floodTokens(FLOOD_BURST * 1000L),
+	_floodLastRefill(monotonicMs()),
+	_floodThrottled(false),
+	_outputBuffer(),
+	_sendqPeak(0),
+	_outputBlocked(false),
+	_livenessTimer(),
+	_lastActivity(monotonicMs()),
+	_pingPending(false),
+	_caps(0),
+	_negotiatingCaps(false),
+	_serverLink(false),
+	_linkName(""),
+	_uplink(NULL),
+	_markedForDisconnect(false),
+	_disconnectReason(""),
+	_epoch(0),
+	_maskSerial(nextMaskSerial()),
+	_connectionId(nextConnectionId()),
+	_invited(false)
 {
 	Logger::log("CREATED Client Instance with fd: " + to_string(socketFd));
 	logClient();
@@ -36,34 +77,50 @@ Client::Client(const Client &other) :
 	_inputBuffer(other._inputBuffer),
 	_authenticated(other._authenticated),
 	_nickname(other._nickname),
+	_nickAtom(other._nickAtom),
 	_username(other._username),
 	_fullname(other._fullname),
-	_hostname(other._hostname)
+	_hostname(other._hostname),
+	_peerAddress(other._peerAddress),
+	_floodTokens(other._floodTokens),
+	_floodLastRefill(other._floodLastRefill),
+	_floodThrottled(other._floodThrottled),
+	_outputBuffer(other._outputBuffer),
+	_sendqPeak(other._sendqPeak),
+	_outputBlocked(other._outputBlocked),
+	_livenessTimer(),	// the copy has to be armed again by the server
+	_lastActivity(other._lastActivity),
+	_pingPending(other._pingPending),
+	_caps(other._caps),
+	_negotiatingCaps(other._negotiatingCaps),
+	_serverLink(other._serverLink),
+	_linkName(other._linkName),
+	_uplink(other._uplink),
+	_markedForDisconnect(other._markedForDisconnect),
+	_disconnectReason(other._disconnectReason),
+	_epoch(other._epoch),
+	_maskSerial(other._maskSerial),
+	_connectionId(other._connectionId),
+	_invited(other._invited)
 {
 	Logger::log("COPIED Client Instance with fd: " + to_string(_socketFd));
 	logClient();
 	if (!other._channels.empty())
 	{
-		for(std::list<Channel *>::const_iterator it = other._channels.begin(); it != other._channels.end(); ++it)
+		for(ChannelPtrList::const_iterator it = other._channels.begin(); it != other._channels.end(); ++it)
 			_channels.push_back(*it);
 	}
 }
 
 // Destructor
+// The server already sent the QUIT to the neighbours (see Server::sendQuit),
+// a client which is still in channels here just leaves them silently
 Client::~Client()
 {
-	std::list<Channel *>::iterator it;
+	ChannelPtrList::iterator it;
 	
-	if (!_channels.empty())
-	{
-		std::string msg;
-		for (it = _channels.begin(); it != _channels.end(); ++it)
-		{
-			msg = ":" + _nickname + "!" + _username + "@localhost" +" PART " + (*it)->getUniqueName() + " :client died... *sad*";
-			(*it)->sendMessageToClients(msg, this);
-			(*it)->removeClient(this);
-		}
-	}
+	for (it = _channels.begin(); it != _channels.end(); ++it)
+		(*it)->removeClient(this);
 	_channels.clear();
 	Logger::log("DESTRUCTED Client Instance " + _nickname);
 	logClient();
@@ -71,14 +128,17 @@ Client::~Client()
 
 // Equal Overload (for list remove)
 // -----------------------------------------------------------------------------
+// Remote clients have no socket, so they are only equal to themselves
 bool	Client::operator==(const Client &other) const
 {
+	if (_socketFd < 0)
+		return this == &other;
 	return _socketFd == other._socketFd;
 }
 
 bool	Client::operator!=(const Client &other) const
 {
-	return _socketFd != other._socketFd;
+	return !(*this == other);
 }
 
 // Simple List Management
@@ -104,10 +164,12 @@ void Client::removeChannel(Channel *channel)
 
 // Read message from client to buffer
 // -----------------------------------------------------------------------------
-bool	Client::appendBuffer(const char *buffer)
+// With the length of the read, so a NUL byte gets to the validation instead
+// of cutting the read short
+bool	Client::appendBuffer(const char *buffer, size_t len)
 {
-	_inputBuffer += std::string(buffer);
-	if (_inputBuffer.size() > BUFFER_SIZE - 1 && (_inputBuffer.find("\n") == std::string::npos || _inputBuffer.find("\n") > BUFFER_SIZE - 1))
+	_inputBuffer.append(buffer, len);
+	if (_inputBuffer.size() > BUFFER_SIZE - 1 && (_inputBuffer.find('\n') == std::string::npos || _inputBuffer.find('\n') > BUFFER_SIZE - 1))
 	{
 		_inputBuffer.clear();
 		return false;
@@ -117,42 +179,361 @@ bool	Client::appendBuffer(const char *buffer)
 
 // Get the full message from the buffer
 // -----------------------------------------------------------------------------
+bool	Client::hasFullMessage() const
+{
+	return _inputBuffer.find('\n') != std::string::npos;
+}
+
+// Returns the first word of the next full message without consuming it
+// (so the flood control can price the line before it gets processed)
+std::string	Client::peekCommand() const
+{
+	size_t end = _inputBuffer.find('\n');
+	if (end == std::string::npos)
+		return std::string("");
+	// A command is never longer than a few chars
+	std::string line = _inputBuffer.copyFront(end < 64 ? end : 64);
+	size_t start = line.find_first_not_of(" \t\r", 0);
+	if (start == std::string::npos)
+		return std::string("");
+	size_t stop = line.find_first_of(" \t\r", start);
+	return line.substr(start, stop - start);
+}
+
 std::string	Client::getFullMessage()
 {
-	size_t pos = _inputBuffer.find("\n");
+	size_t pos = _inputBuffer.find('\n');
 	if(pos != std::string::npos)
 	{
-		std::string _fullMsg;
-		_fullMsg = _inputBuffer.substr(0, pos);
-		_inputBuffer = _inputBuffer.substr(pos + 1);
+		std::string _fullMsg = _inputBuffer.copyFront(pos);
+		_inputBuffer.consume(pos + 1);
 		return _fullMsg;
 	}
 	return std::string("");
 }
 
+size_t	Client::getInputBacklog() const
+{
+	return _inputBuffer.size();
+}
+
+// Flood control (token bucket)
+// -----------------------------------------------------------------------------
+// The bucket refills with FLOOD_RATE tokens per second up to FLOOD_BURST.
+// Every line costs some tokens (depending on the command). If there are not
+// enough tokens the line stays in the input buffer and is retried later.
+bool	Client::consumeFloodTokens(int cost)
+{
+	long now = monotonicMs();
+
+	// ms * tokens/s == 1/1000 tokens
+	_floodTokens += (now - _floodLastRefill) * FLOOD_RATE;
+	_floodLastRefill = now;
+	if (_floodTokens > FLOOD_BURST * 1000L)
+		_floodTokens = FLOOD_BURST * 1000L;
+
+	// A command can never cost more than a full bucket
+	if (cost > FLOOD_BURST)
+		cost = FLOOD_BURST;
+	if (_floodTokens < cost * 1000L)
+		return false;
+	_floodTokens -= cost * 1000L;
+	return true;
+}
+
+bool	Client::isThrottled() const
+{
+	return _floodThrottled;
+}
+
+void	Client::setThrottled(bool throttled)
+{
+	_floodThrottled = throttled;
+}
+
+// Liveness
+// -----------------------------------------------------------------------------
+Timer	&Client::getLivenessTimer()
+{
+	return _livenessTimer;
+}
+
+// Called whenever the client sent something
+void	Client::touch()
+{
+	_lastActivity = monotonicMs();
+}
+
+long	Client::getIdleMs() const
+{
+	return monotonicMs() - _lastActivity;
+}
+
+bool	Client::isPingPending() const
+{
+	return _pingPending;
+}
+
+void	Client::setPingPending(bool pending)
+{
+	_pingPending = pending;
+}
+
+// PASS, NICK and USER are done and no CAP negotiation holds the registration
+// back (for a link: the SERVER handshake)
+bool	Client::isRegistered() const
+{
+	if (_serverLink)
+		return !_linkName.empty();
+	return _authenticated && !_nickname.empty() && !_username.empty() && !_negotiatingCaps;
+}
+
+// IRCv3 capabilities
+// -----------------------------------------------------------------------------
+unsigned	Client::getCaps() const
+{
+	return _caps;
+}
+
+bool	Client::hasCap(unsigned cap) const
+{
+	return (_caps & cap) != 0;
+}
+
+void	Client::setCaps(unsigned caps)
+{
+	_caps = caps;
+}
+
+bool	Client::isNegotiatingCaps() const
+{
+	return _negotiatingCaps;
+}
+
+void	Client::setNegotiatingCaps(bool negotiating)
+{
+	_negotiatingCaps = negotiating;
+}
+
+// Server links
+// -----------------------------------------------------------------------------
+void	Client::setServerLink(const std::string &name)
+{
+	_serverLink = true;
+	_linkName = name;
+}
+
+bool	Client::isServerLink() const
+{
+	return _serverLink;
+}
+
+const std::string	&Client::getLinkName() const
+{
+	return _linkName;
+}
+
+void	Client::setUplink(Client *link)
+{
+	_uplink = link;
+}
+
+Client	*Client::getUplink() const
+{
+	return _uplink;
+}
+
+// The server of a remote client delivers everything to it by itself
+bool	Client::isRemote() const
+{
+	return _uplink != NULL;
+}
+
+// Epoch marks
+// -----------------------------------------------------------------------------
+// Visiting all neighbours of a client reaches the same client once per shared
+// channel. A new epoch per visit and one mark per client replace a set of the
+// visited clients: returns false if the client was reached in this epoch already
+bool	Client::markEpoch(unsigned long epoch)
+{
+	if (_epoch == epoch)
+		return false;
+	_epoch = epoch;
+	return true;
+}
+
+const ChannelPtrList	&Client::getChannels() const
+{
+	return _channels;
+}
+
+// Disconnect handling
+// -----------------------------------------------------------------------------
+void	Client::markForDisconnect(const std::string &reason)
+{
+	if (_markedForDisconnect)
+		return ;
+	_markedForDisconnect = true;
+	_disconnectReason = reason;
+	Logger::log("Client " + _nickname + " marked for disconnect: " + reason);
+}
+
+bool	Client::isMarkedForDisconnect() const
+{
+	return _markedForDisconnect;
+}
+
+const std::string	&Client::getDisconnectReason() const
+{
+	return _disconnectReason;
+}
+
 // Send message to client
 // -----------------------------------------------------------------------------
-void Client::sendMessage(const std::string &ircMessage) const
+// The message is appended to the send queue. The server flushes all queues
+// once per loop iteration, so all replies to a client in one iteration go
+// out with one send. Whatever is left is sent once poll reports POLLOUT.
+// If a client doesn't read, its queue would grow forever, so it will be
+// disconnected once it holds more than SENDQ_MAX bytes.
+void Client::sendMessage(const std::string &ircMessage)
 {
 	if (ircMessage.empty())
 		return ;
-	std::string msg = ircMessage;
-	if(msg[msg.size() - 1] != '\n')
-		msg += "\n";
-	ssize_t bytesSent = send(_socketFd, msg.c_str(), msg.length(), 0);
+	queueLine(ircMessage.data(), ircMessage.size());
+}
+
+// The reply is formatted in the arena of the loop iteration, so building it
+// doesn't need any temporary strings
+void	Client::sendMessage(const std::string &code, const std::string &message)
+{
+	static const char	prefix[] = ":localhost ";
+	if (_uplink)
+		return ;
+	size_t				len = (sizeof(prefix) - 1) + code.size() + 1 + _nickname.size() + 1 + message.size();
+	char				*line = Arena::frame().allocateArray<char>(len);
+	char				*pos = line;
+
+	std::memcpy(pos, prefix, sizeof(prefix) - 1);
+	pos += sizeof(prefix) - 1;
+	std::memcpy(pos, code.data(), code.size());
+	pos += code.size();
+	*pos++ = ' ';
+	std::memcpy(pos, _nickname.data(), _nickname.size());
+	pos += _nickname.size();
+	*pos++ = ' ';
+	std::memcpy(pos, message.data(), message.size());
+	queueLine(line, len);
+}
+
+// The reply was rendered on the stack, so this is the only copy of it
+void	Client::sendReply(const Reply &reply)
+{
+	if (!reply.size())
+		return ;
+	if (reply.overflowed())
+		Logger::log("Reply to " + _nickname + " was cut at " + to_string(REPLY_MAX) + " bytes");
+	queueLine(reply.data(), reply.size());
+}
+
+// Appends one line (+ the missing newline) to the send queue and flushes it
+void	Client::queueLine(const char *line, size_t len)
+{
+	AllocScope	scope(ALLOC_FANOUT);
+
+	if (_markedForDisconnect || _uplink)
+		return ;
+	bool newline = line[len - 1] != '\n';
+	if (_outputBuffer.size() + len + newline > (_serverLink ? LINK_SENDQ_MAX : SENDQ_MAX))
+	{
+		Logger::log("SendQ of client " + _nickname + " exceeded (" + to_string(_outputBuffer.size()) + " bytes)");
+		// Drop the backlog so at least the ERROR has a chance to get through
+		_outputBuffer.clear();
+		_outputBuffer.append("ERROR :Closing Link: localhost (SendQ exceeded)\n");
+		markForDisconnect("SendQ exceeded");
+		return ;
+	}
+	_outputBuffer.append(line, len);
+	if (newline)
+		_outputBuffer.append("\n", 1);
+	if (_outputBuffer.size() > _sendqPeak)
+		_sendqPeak = _outputBuffer.size();
 	// LOGGER
-	if (!msg.empty() && msg[msg.length() - 1] == '\n')
-		msg.erase(msg.length() - 1);
-	Logger::log("Message sent:\tMSG -->\t\t" 		+ msg);
-	if (bytesSent == -1)
-		Logger::log("\t ERROR -->\t" + std::string(strerror(errno)));
+	if (Logger::isActive())
+		Logger::log("Message queued:\tMSG -->\t\t" + std::string(line, newline ? len : len - 1));
+	// Big replies (e.g. WHO of a big channel) don't wait for the flush phase
+	if (_outputBuffer.size() >= SENDQ_SOFT && !_outputBlocked)
+		flushOutput();
+}
+
+// Sends as much of the send queue as the socket accepts right now
+// Returns false if the socket is broken
+bool	Client::flushOutput()
+{
+	_outputBlocked = false;
+	while (!_outputBuffer.empty())
+	{
+		// MSG_NOSIGNAL: don't raise SIGPIPE if the peer is already gone
+		size_t		len;
+		const char	*data = _outputBuffer.front(len);
+		ssize_t bytesSent = send(_socketFd, data, len, MSG_NOSIGNAL);
+		if (bytesSent < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				_outputBlocked = true;
+				break ;
+			}
+			if (errno == EINTR)
+				continue ;
+			Logger::log("\t ERROR -->\t" + std::string(strerror(errno)));
+			_outputBuffer.clear();
+			markForDisconnect("Write error");
+			return false;
+		}
+		_outputBuffer.consume(bytesSent);
+	}
+	return true;
+}
+
+bool	Client::hasPendingOutput() const
+{
+	return !_outputBuffer.empty();
+}
+
+bool	Client::isOutputBlocked() const
+{
+	return _outputBlocked;
+}
+
+size_t	Client::getSendQueueSize() const
+{
+	return _outputBuffer.size();
+}
+
+size_t	Client::getSendQueuePeak() const
+{
+	return _sendqPeak;
+}
+
+// Hot upgrade
+// -----------------------------------------------------------------------------
+std::string	Client::getPendingInput() const
+{
+	return _inputBuffer.copyFront(_inputBuffer.size());
 }
 
-void	Client::sendMessage(const std::string &code, const std::string &message) const
+std::string	Client::getPendingOutput() const
 {
-	std::string ircMessage = 
-		":localhost " + code + " " + _nickname + " " + message + "\n";
-	sendMessage(ircMessage);
+	return _outputBuffer.copyFront(_outputBuffer.size());
+}
+
+void	Client::restoreBuffers(const std::string &input, const std::string &output)
+{
+	_inputBuffer.clear();
+	_inputBuffer.append(input);
+	_outputBuffer.clear();
+	_outputBuffer.append(output);
+	_outputBlocked = false;
 }
 
 void Client::sendWhoIsMsg(Client *reciever) const
@@ -161,26 +542,32 @@ void Client::sendWhoIsMsg(Client *reciever) const
 		return;
 
 	// localhost 311 <nick> <nick> <user> <host> * :<real name>
-	reciever->sendMessage(
-		":localhost " + std::string(RPL_WHOISUSER) + " " +
-		_nickname + " " +
-		_nickname + " " +
-		_username + " " +
-		_hostname + " * :" +
-		_fullname);
+	reciever->sendReply(Reply(RPL_WHOISUSER, _nickname) << _nickname << ' ' <<
+		_username << ' ' << _hostname << " * :" << _fullname);
 
 	// localhost 319 <nick> :{[@|+]<channel><space>}
-	std::string channels = getChannelList();	
-	if(!channels.empty())
-		reciever->sendMessage(
-			":localhost " + std::string(RPL_WHOISCHANNELS) + " " +
-			_nickname + " " +_nickname + " :" +
-			channels);
+	// (as many channels per line as fit)
+	Reply	channels(RPL_WHOISCHANNELS, _nickname);
+	size_t	header;
+
+	channels << _nickname << " :";
+	header = channels.size();
+	for (ChannelPtrList::const_iterator it = _channels.begin(); it != _channels.end(); ++it)
+	{
+		const std::string	&name = (*it)->getUniqueName();
+		if (channels.size() > header && channels.room() < name.size() + 2)
+		{
+			reciever->sendReply(channels);
+			channels = Reply(RPL_WHOISCHANNELS, _nickname);
+			channels << _nickname << " :";
+		}
+		channels << '@' << name << ' ';
+	}
+	if (channels.size() > header)
+		reciever->sendReply(channels);
 
 	// localhost 318 <nick> :End of /WHOIS list.
-	reciever->sendMessage(
-		":localhost " + std::string(RPL_ENDOFWHOIS) + " " +
-		_nickname + " " +_nickname + " :End of /WHOIS list.");	
+	reciever->sendReply(Reply(RPL_ENDOFWHOIS, _nickname) << _nickname << " :End of /WHOIS list.");
 
 	logClient();
 }
@@ -196,11 +583,14 @@ void    Client::setUniqueName(const std::string &nickname)
 {
 	info("set nickname " + nickname, CLR_GRN);
 	_nickname = nickname;
+	_nickAtom = Atom(nickname);
+	_maskSerial = nextMaskSerial();
 }
 
 void Client::setUsername(const std::string &username)
 {
 	_username = username;
+	_maskSerial = nextMaskSerial();
 }
 
 void Client::setFullname(const std::string &fullname)
@@ -211,6 +601,12 @@ void Client::setFullname(const std::string &fullname)
 void Client::setHostname(const std::string &hostname)
 {
 	_hostname = hostname;
+	_maskSerial = nextMaskSerial();
+}
+
+void Client::setPeerAddress(const struct sockaddr_storage &address)
+{
+	std::memcpy(&_peerAddress, &address, sizeof(_peerAddress));
 }
 
 // Getters
@@ -230,6 +626,11 @@ const std::string &Client::getUniqueName() const
 	return _nickname;
 }
 
+const Atom &Client::getAtom() const
+{
+	return _nickAtom;
+}
+
 const std::string &Client::getUsername() const
 {
 	return _username;
@@ -245,6 +646,15 @@ const std::string &Client::getHostname() const
 	return _hostname;
 }
 
+struct sockaddr_storage Client::getPeerAddress() const
+{
+	struct sockaddr_storage	address;
+
+	std::memset(&address, 0, sizeof(address));
+	std::memcpy(&address, &_peerAddress, sizeof(_peerAddress));
+	return address;
+}
+
 const std::string Client::getChannelList() const
 {
 	std::string channels = "";
@@ -252,7 +662,7 @@ const std::string Client::getChannelList() const
 	if(_channels.empty())
 		return channels;
 
-	for (std::list<Channel *>::const_iterator it = _channels.begin(); it != _channels.end(); ++it)
+	for (ChannelPtrList::const_iterator it = _channels.begin(); it != _channels.end(); ++it)
 	{
 		channels += "@"; 
 		channels += (*it)->getUniqueName();
@@ -263,10 +673,63 @@ const std::string Client::getChannelList() const
 	return channels;
 }
 
+// Memory accounting
+// -----------------------------------------------------------------------------
+// The client and the nodes of its channel list come from the pool (see the
+// ClientList and ChannelPtrList allocators), so the pool block sizes are
+// what they really take; a list node is the value and two links.
+Client::MemoryUsage Client::getMemoryUsage() const
+{
+	MemoryUsage	usage;
+
+	usage.object = Pool::getBlockSize(sizeof(Client) + 2 * sizeof(void *));
+	usage.strings = stringHeapBytes(_nickname) + stringHeapBytes(_username) +
+		stringHeapBytes(_fullname) + stringHeapBytes(_hostname) +
+		stringHeapBytes(_linkName) + stringHeapBytes(_disconnectReason);
+	usage.buffers = (_inputBuffer.chunkCount() + _outputBuffer.chunkCount()) * IO_CHUNK_SIZE;
+	usage.channels = _channels.size() * Pool::getBlockSize(3 * sizeof(void *));
+	return usage;
+}
+
+// Returns the bytes given back (the buffers give their chunks back as soon
+// as they're consumed, so only the strings can have slack)
+size_t Client::compact()
+{
+	return shrinkString(_nickname) + shrinkString(_username) + shrinkString(_fullname) +
+		shrinkString(_hostname) + shrinkString(_linkName) + shrinkString(_disconnectReason);
+}
+
+const std::string Client::getHostmask() const
+{
+	return _nickname + "!" + _username + "@" + _hostname;
+}
+
+unsigned long Client::getMaskSerial() const
+{
+	return _maskSerial;
+}
+
+unsigned long Client::getConnectionId() const
+{
+	return _connectionId;
+}
+
+bool Client::hasInvites() const
+{
+	return _invited;
+}
+
+void Client::setInvited(bool invited)
+{
+	_invited = invited;
+}
+
 // LOG
 // -----------------------------------------------------------------------------
 void Client::logClient() const
 {
+	if (!Logger::isActive())
+		return ;
 	std::ostringstream header, values;
 
 	// Constructing headers
@@ -284,7 +747,7 @@ void Client::logClient() const
 	values 	<< std::left 
 			<< "| " << std::setw(15) << _socketFd
 			<< "| " << std::setw(15) << (_authenticated ? "TRUE" : "FALSE")
-			<< "| " << std::setw(15)  << (_inputBuffer.length() > 14 ? _inputBuffer.substr(0, 14) + "." : _inputBuffer.empty() ? "(NULL)" : _inputBuffer)
+			<< "| " << std::setw(15)  << (_inputBuffer.size() > 14 ? _inputBuffer.copyFront(14) + "." : _inputBuffer.empty() ? "(NULL)" : _inputBuffer.copyFront(14))
 			<< "| " << std::setw(15) << (_nickname.length() > 14 ? _nickname.substr(0, 14) + "." : _nickname.empty() ? "(NULL)" : _nickname)
 			<< "| " << std::setw(15) << (_username.length() > 14 ? _username.substr(0, 14) + "." : _username.empty() ? "(NULL)" : _username)
 			<< "| " << std::setw(15) << (_fullname.length() > 14 ? _fullname.substr(0, 14) + "." : _fullname.empty() ? "(NULL)" : _fullname)
@@ -0,0 +1,248 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   ConnectionLimiter.cpp                              :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/17 14:26:53 by astein            #+#    #+#             */
+/*   Updated: 2024/05/17 14:26:53 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "ConnectionLimiter.hpp"
+#include <arpa/inet.h>
+#include <cstring>
+
+#define MIN_CAPACITY	64
+
+// Construction / Destruction
+// -----------------------------------------------------------------------------
+ConnectionLimiter::ConnectionLimiter() :
+	_table(MIN_CAPACITY),
+	_used(0),
+	_rejectedTooMany(0),
+	_rejectedTooFast(0)
+{
+	for (size_t i = 0; i < _table.size(); ++i)
+		_table[i].used = 0;
+}
+
+ConnectionLimiter::~ConnectionLimiter()
+{
+	// Nothing to do
+}
+
+// Addresses
+// -----------------------------------------------------------------------------
+ConnectionLimiter::HostKey	ConnectionLimiter::keyOf(const struct sockaddr_storage &addr)
+{
+	HostKey key;
+
+	key.prefix = 0;
+	key.family = addr.ss_family;
+	if (addr.ss_family == AF_INET)
+	{
+		const struct sockaddr_in *in = reinterpret_cast<const struct sockaddr_in *>(&addr);
+		key.prefix = ntohl(in->sin_addr.s_addr);
+	}
+	else if (addr.ss_family == AF_INET6)
+	{
+		const struct sockaddr_in6 *in6 = reinterpret_cast<const struct sockaddr_in6 *>(&addr);
+		const unsigned char *bytes = in6->sin6_addr.s6_addr;
+		// An IPv4 host connecting to an IPv6 socket (::ffff:a.b.c.d)
+		if (IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr))
+		{
+			key.family = AF_INET;
+			for (int i = 12; i < 16; ++i)
+				key.prefix = (key.prefix << 8) | bytes[i];
+		}
+		else
+		{
+			// Only the /64 counts
+			for (int i = 0; i < 8; ++i)
+				key.prefix = (key.prefix << 8) | bytes[i];
+		}
+	}
+	return key;
+}
+
+std::string	ConnectionLimiter::addressToString(const struct sockaddr_storage &addr)
+{
+	char buffer[INET6_ADDRSTRLEN];
+
+	if (addr.ss_family == AF_INET)
+	{
+		const struct sockaddr_in *in = reinterpret_cast<const struct sockaddr_in *>(&addr);
+		if (inet_ntop(AF_INET, &in->sin_addr, buffer, sizeof(buffer)))
+			return std::string(buffer);
+	}
+	else if (addr.ss_family == AF_INET6)
+	{
+		const struct sockaddr_in6 *in6 = reinterpret_cast<const struct sockaddr_in6 *>(&addr);
+		if (inet_ntop(AF_INET6, &in6->sin6_addr, buffer, sizeof(buffer)))
+			return std::string(buffer);
+	}
+	return std::string("unknown");
+}
+
+// Admission
+// -----------------------------------------------------------------------------
+ConnectionLimiter::Verdict	ConnectionLimiter::admit(const HostKey &key, long nowMs)
+{
+	long	index = find(key);
+	Entry	&entry = (index < 0) ? insert(key, nowMs) : _table[index];
+
+	refill(entry, nowMs);
+	if (entry.connections >= IP_MAX_CONNECTIONS)
+	{
+		_rejectedTooMany++;
+		return TOO_MANY_CONNECTIONS;
+	}
+	if (entry.tokens < 1000)
+	{
+		_rejectedTooFast++;
+		return TOO_FAST;
+	}
+	entry.tokens -= 1000;
+	entry.connections++;
+	return ADMIT;
+}
+
+void	ConnectionLimiter::release(const HostKey &key)
+{
+	long index = find(key);
+
+	if (index >= 0 && _table[index].connections > 0)
+		_table[index].connections--;
+}
+
+// The connection is open already, so no limit applies (it's just counted)
+void	ConnectionLimiter::restore(const HostKey &key, long nowMs)
+{
+	long	index = find(key);
+	Entry	&entry = (index < 0) ? insert(key, nowMs) : _table[index];
+
+	entry.connections++;
+}
+
+// Stats
+// -----------------------------------------------------------------------------
+size_t	ConnectionLimiter::getHostCount() const
+{
+	return _used;
+}
+
+size_t	ConnectionLimiter::getCapacity() const
+{
+	return _table.size();
+}
+
+unsigned long	ConnectionLimiter::getRejected(Verdict reason) const
+{
+	if (reason == TOO_MANY_CONNECTIONS)
+		return _rejectedTooMany;
+	if (reason == TOO_FAST)
+		return _rejectedTooFast;
+	return 0;
+}
+
+// Private Methods
+// -----------------------------------------------------------------------------
+size_t	ConnectionLimiter::hash(const HostKey &key)
+{
+	// splitmix64 finalizer
+	uint64_t h = key.prefix ^ (static_cast<uint64_t>(key.family) << 56);
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	return static_cast<size_t>(h ^ (h >> 31));
+}
+
+long	ConnectionLimiter::find(const HostKey &key) const
+{
+	size_t mask = _table.size() - 1;
+
+	for (size_t i = hash(key) & mask; _table[i].used; i = (i + 1) & mask)
+	{
+		if (_table[i].prefix == key.prefix && _table[i].family == key.family)
+			return i;
+	}
+	return -1;
+}
+
+// A new host starts with a full bucket
+ConnectionLimiter::Entry	&ConnectionLimiter::insert(const HostKey &key, long nowMs)
+{
+	// Keep the load factor below 1/2
+	if ((_used + 1) * 2 > _table.size())
+		purgeIdle(nowMs);
+
+	size_t mask = _table.size() - 1;
+	size_t i = hash(key) & mask;
+	while (_table[i].used)
+		i = (i + 1) & mask;
+	_table[i].prefix = key.prefix;
+	_table[i].family = key.family;
+	_table[i].lastRefill = nowMs;
+	_table[i].tokens = IP_CONNECT_BURST * 1000;
+	_table[i].connections = 0;
+	_table[i].used = 1;
+	_used++;
+	return _table[i];
+}
+
+void	ConnectionLimiter::refill(Entry &entry, long nowMs) const
+{
+	long elapsed = nowMs - entry.lastRefill;
+
+	entry.lastRefill = nowMs;
+	if (elapsed >= static_cast<long>(IP_CONNECT_RATE_MS) * IP_CONNECT_BURST)
+		entry.tokens = IP_CONNECT_BURST * 1000;
+	else if (elapsed > 0)
+		entry.tokens += elapsed * 1000 / IP_CONNECT_RATE_MS;
+	if (entry.tokens > IP_CONNECT_BURST * 1000)
+		entry.tokens = IP_CONNECT_BURST * 1000;
+}
+
+// Rebuilds the table without the hosts which have no connections and
+// a full bucket again (they are no different from unknown hosts).
+// The new size leaves room for as many new hosts as there are left.
+void	ConnectionLimiter::purgeIdle(long nowMs)
+{
+	std::vector<Entry>	old;
+	size_t				capacity = MIN_CAPACITY;
+
+	old.swap(_table);
+	for (size_t i = 0; i < old.size(); ++i)
+	{
+		if (!old[i].used)
+			continue ;
+		refill(old[i], nowMs);
+		if (old[i].connections == 0 && old[i].tokens == IP_CONNECT_BURST * 1000)
+			old[i].used = 0;
+	}
+	size_t live = 0;
+	for (size_t i = 0; i < old.size(); ++i)
+		live += old[i].used;
+	while (capacity < live * 4)
+		capacity *= 2;
+
+	_table.resize(capacity);
+	for (size_t i = 0; i < capacity; ++i)
+		_table[i].used = 0;
+	_used = 0;
+	size_t mask = capacity - 1;
+	for (size_t i = 0; i < old.size(); ++i)
+	{
+		if (!old[i].used)
+			continue ;
+		HostKey key;
+		key.prefix = old[i].prefix;
+		key.family = old[i].family;
+		size_t j = hash(key) & mask;
+		while (_table[j].used)
+			j = (j + 1) & mask;
+		_table[j] = old[i];
+		_used++;
+	}
+}
@@ -0,0 +1,109 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Glob.cpp                                           :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/24 14:03:18 by astein            #+#    #+#             */
+/*   Updated: 2024/05/24 14:03:18 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "Glob.hpp"
+#include "Atom.hpp"
+
+// Constructor
+// -----------------------------------------------------------------------------
+// "a*b?c**d" -> head "a", middle "b?c", tail "d"
+Glob::Glob(const std::string &mask) :
+	_hasStar(false),
+	_minLength(0)
+{
+	std::string	folded = Atom::fold(mask);
+	size_t		start = 0;
+	size_t		star = folded.find('*');
+
+	_head = folded.substr(0, star);
+	while (star != std::string::npos)
+	{
+		_hasStar = true;
+		start = star + 1;
+		star = folded.find('*', start);
+		if (star != std::string::npos && star > start)
+			_middle.push_back(folded.substr(start, star - start));
+	}
+	if (_hasStar)
+	{
+		_tail = folded.substr(start);
+		size_t wild = _tail.rfind('?');
+		_suffix = wild == std::string::npos ? _tail : _tail.substr(wild + 1);
+	}
+	_prefix = _head.substr(0, _head.find('?'));
+	_minLength = _head.size() + _tail.size();
+	for (size_t i = 0; i < _middle.size(); ++i)
+		_minLength += _middle[i].size();
+}
+
+// Matching
+// -----------------------------------------------------------------------------
+bool	Glob::match(const std::string &subject) const
+{
+	if (!_hasStar)
+		return subject.size() == _head.size() && matchAt(subject, 0, _head);
+	if (subject.size() < _minLength || !matchAt(subject, 0, _head) ||
+		!matchAt(subject, subject.size() - _tail.size(), _tail))
+		return false;
+
+	// THE MIDDLE PARTS IN ORDER, EACH AS FAR LEFT AS POSSIBLE
+	size_t	pos = _head.size();
+	size_t	end = subject.size() - _tail.size();
+	for (size_t i = 0; i < _middle.size(); ++i)
+	{
+		const std::string	&part = _middle[i];
+		char				first = part[0];
+
+		while (true)
+		{
+			if (end - pos < part.size())
+				return false;
+			if (!isWild(first))
+			{
+				// SKIP TO THE NEXT CHAR WHICH CAN START THE PART
+				while (pos + part.size() <= end && Atom::foldByte(subject[pos]) != first)
+					pos++;
+				if (pos + part.size() > end)
+					return false;
+			}
+			if (matchAt(subject, pos, part))
+				break ;
+			pos++;
+		}
+		pos += part.size();
+	}
+	return true;
+}
+
+const std::string	&Glob::getPrefix() const
+{
+	return _prefix;
+}
+
+const std::string	&Glob::getSuffix() const
+{
+	return _suffix;
+}
+
+// The part is folded already, the subject is folded on the way
+bool	Glob::matchAt(const std::string &subject, size_t pos, const std::string &part)
+{
+	for (size_t i = 0; i < part.size(); ++i)
+		if (part[i] != '?' && Atom::foldByte(subject[pos + i]) != part[i])
+			return false;
+	return true;
+}
+
+bool	Glob::isWild(char c)
+{
+	return c == '?';
+}
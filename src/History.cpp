@@ -0,0 +1,462 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   History.cpp                                        :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/22 18:27:51 by astein            #+#    #+#             */
+/*   Updated: 2024/05/22 18:27:51 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "History.hpp"
+#include "Atom.hpp"
+#include "utils.hpp"
+#include <cstring>
+#include <cstdio>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+size_t			History::_memoryUsed = 0;
+size_t			History::_buffers = 0;
+unsigned long	History::_spilled = 0;
+unsigned long	History::_dropped = 0;
+
+// Varints (7 bits per byte, the high bit says another byte follows)
+// -----------------------------------------------------------------------------
+namespace
+{
+	void	putVarint(std::string &out, uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			out += static_cast<char>((value & 0x7F) | 0x80);
+			value >>= 7;
+		}
+		out += static_cast<char>(value);
+	}
+
+	// Returns the bytes read (0 if the data ends in the middle)
+	size_t	getVarint(const char *data, size_t size, uint64_t &value)
+	{
+		value = 0;
+		for (size_t i = 0; i < size && i < 10; ++i)
+		{
+			value |= static_cast<uint64_t>(data[i] & 0x7F) << (7 * i);
+			if (!(data[i] & 0x80))
+				return i + 1;
+		}
+		return 0;
+	}
+
+	// Created once; if that fails there is nothing to spill to
+	bool	hasHistoryDir()
+	{
+		static int	state = 0;	// 0 unknown, 1 ok, -1 failed
+
+		if (state == 0)
+			state = (mkdir(HISTORY_DIR, 0700) == 0 || errno == EEXIST) ? 1 : -1;
+		return state > 0;
+	}
+}
+
+// Constructors and Destructor
+// -----------------------------------------------------------------------------
+History::History(const std::string &channelName) :
+	_fileName(),
+	_buffer(NULL),
+	_used(0),
+	_firstId(1),
+	_nextId(1),
+	_firstTime(0),
+	_lastTime(0),
+	_segments(),
+	_nextSegment(0),
+	_spillTime(0)
+{
+	static const char	hex[] = "0123456789abcdef";
+	std::string			folded = Atom::fold(channelName);
+
+	for (size_t i = 0; i < folded.size(); ++i)
+	{
+		_fileName += hex[static_cast<unsigned char>(folded[i]) >> 4];
+		_fileName += hex[static_cast<unsigned char>(folded[i]) & 0xF];
+	}
+}
+
+// The buffer is copied if the memory limit allows it (the channels are only
+// copied into the server's list before they have any history anyway)
+History::History(const History &other) :
+	_fileName(other._fileName),
+	_buffer(NULL),
+	_used(0),
+	_firstId(other._nextId),
+	_nextId(other._nextId),
+	_firstTime(other._firstTime),
+	_lastTime(other._lastTime),
+	_segments(other._segments),
+	_nextSegment(other._nextSegment),
+	_spillTime(other._spillTime)
+{
+	if (!other._buffer)
+		return ;
+	if (!allocateBuffer())
+	{
+		_dropped += other._nextId - other._firstId;
+		return ;
+	}
+	std::memcpy(_buffer, other._buffer, other._used);
+	_used = other._used;
+	_firstId = other._firstId;
+}
+
+History::~History()
+{
+	if (!_buffer)
+		return ;
+	delete[] _buffer;
+	_memoryUsed -= HISTORY_RING_BYTES;
+	_buffers--;
+}
+
+// Recording
+// -----------------------------------------------------------------------------
+void	History::add(int type, const std::string &source, const std::string &text)
+{
+	long		now = realtimeMs();
+	std::string	body = text.size() > HISTORY_TEXT_MAX ? text.substr(0, HISTORY_TEXT_MAX) : text;
+
+	if (!_buffer && !allocateBuffer())
+	{
+		// Over the memory limit: straight to the segments
+		std::vector<Event>	events(1);
+		events[0].id = _nextId++;
+		events[0].time = now;
+		events[0].type = type;
+		events[0].source = source;
+		events[0].text = body;
+		_firstId = _nextId;
+		spill(events);
+		return ;
+	}
+
+	std::string	record;
+	if (_used == 0)
+		_firstTime = _lastTime = now;
+	encode(record, now - _lastTime, type, source, body);
+	if (_used + record.size() > HISTORY_RING_BYTES)
+	{
+		evict(record.size() > HISTORY_RING_BYTES / 4 ? record.size() : HISTORY_RING_BYTES / 4);
+		// The buffer might be empty now -> the delta starts from 0 again
+		if (_used == 0)
+		{
+			_firstTime = now;
+			record.clear();
+			encode(record, 0, type, source, body);
+		}
+	}
+	std::memcpy(_buffer + _used, record.data(), record.size());
+	_used += record.size();
+	_lastTime = now;
+	_nextId++;
+}
+
+bool	History::allocateBuffer()
+{
+	if (_memoryUsed + HISTORY_RING_BYTES > HISTORY_MEMORY_MAX)
+		return false;
+	_buffer = new char[HISTORY_RING_BYTES];
+	_memoryUsed += HISTORY_RING_BYTES;
+	_buffers++;
+	return true;
+}
+
+// Moves at least the given bytes of the oldest events to the segments
+void	History::evict(size_t bytes)
+{
+	std::vector<Event>	events;
+	size_t				pos = 0;
+	long				time = _firstTime;
+
+	while (pos < _used && pos < bytes)
+	{
+		Event	event;
+		long	delta;
+		size_t	len = decode(_buffer + pos, _used - pos, delta, event);
+		if (!len)
+			break ;
+		if (pos > 0)
+			time += delta;
+		event.id = _firstId + events.size();
+		event.time = time;
+		events.push_back(event);
+		pos += len;
+	}
+	std::memmove(_buffer, _buffer + pos, _used - pos);
+	_used -= pos;
+	_firstId += events.size();
+	if (_used > 0)
+	{
+		// The delta of the new first event is to the last evicted one
+		Event	event;
+		long	delta;
+		decode(_buffer, _used, delta, event);
+		_firstTime = time + delta;
+	}
+	spill(events);
+}
+
+// Spilling
+// -----------------------------------------------------------------------------
+void	History::spill(const std::vector<Event> &events)
+{
+	if (!hasHistoryDir())
+	{
+		_dropped += events.size();
+		return ;
+	}
+	size_t i = 0;
+	while (i < events.size())
+	{
+		// Fill the newest segment as far as it takes the events
+		if ((_segments.empty() || _segments.back().bytes >= HISTORY_SEGMENT_BYTES) && !startSegment(events[i].id))
+		{
+			_dropped += events.size() - i;
+			return ;
+		}
+		Segment		&segment = _segments.back();
+		std::string	data;
+		size_t		first = i;
+		for (; i < events.size() && segment.bytes + data.size() < HISTORY_SEGMENT_BYTES; ++i)
+		{
+			encode(data, events[i].time - _spillTime, events[i].type, events[i].source, events[i].text);
+			_spillTime = events[i].time;
+		}
+
+		int fd = open(getSegmentPath(segment.number).c_str(), O_WRONLY | O_APPEND);
+		ssize_t written = fd < 0 ? -1 : write(fd, data.data(), data.size());
+		if (fd >= 0)
+			close(fd);
+		if (written != static_cast<ssize_t>(data.size()))
+		{
+			_dropped += events.size() - first;
+			return ;
+		}
+		segment.bytes += data.size();
+		segment.count += i - first;
+		_spilled += i - first;
+	}
+}
+
+// A new (empty) segment file; the oldest one goes if there are too many
+bool	History::startSegment(uint64_t firstId)
+{
+	Segment	segment;
+
+	segment.number = _nextSegment++;
+	segment.firstId = firstId;
+	segment.count = 0;
+	segment.bytes = 0;
+	int fd = open(getSegmentPath(segment.number).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		return false;
+	close(fd);
+	_segments.push_back(segment);
+	_spillTime = 0;
+	if (_segments.size() > HISTORY_SEGMENTS)
+	{
+		unlink(getSegmentPath(_segments.front().number).c_str());
+		_segments.pop_front();
+	}
+	return true;
+}
+
+std::string	History::getSegmentPath(unsigned number) const
+{
+	return std::string(HISTORY_DIR) + "/" + _fileName + "." + to_string(number) + ".seg";
+}
+
+// Which events a segment holds is only known to the process which wrote it
+// (it's neither in the snapshot nor in the upgrade state), so the files of
+// an earlier run are of no use; a channel of the same name would even start
+// again at segment 0 and write over them
+size_t	History::removeSegments()
+{
+	DIR		*dir = opendir(HISTORY_DIR);
+	size_t	removed = 0;
+
+	if (!dir)
+		return 0;
+	for (struct dirent *entry = readdir(dir); entry; entry = readdir(dir))
+	{
+		std::string	name(entry->d_name);
+		if (name.size() > 4 && name.compare(name.size() - 4, 4, ".seg") == 0 &&
+			unlink((std::string(HISTORY_DIR) + "/" + name).c_str()) == 0)
+			removed++;
+	}
+	closedir(dir);
+	return removed;
+}
+
+// Reading
+// -----------------------------------------------------------------------------
+// The ids of the buffer and of every segment are known without reading them,
+// so only the sources (and in them the events) which make it into the answer
+// are decoded: for the newest ones the buffer comes first and then the
+// segments from the newest back, for the oldest ones the other way round.
+// Either way it stops once limit events are found.
+void	History::query(uint64_t after, uint64_t before, size_t limit, bool newest, std::vector<Event> &events) const
+{
+	events.clear();
+	if (before > _nextId)
+		before = _nextId;
+	if (!limit || after + 1 >= before)
+		return ;
+
+	std::vector<Event>	part;
+	size_t				sources = _segments.size() + 1;		// the buffer is the last one
+	for (size_t n = 0; n < sources && events.size() < limit; ++n)
+	{
+		size_t		source = newest ? sources - 1 - n : n;
+		bool		inBuffer = (source == _segments.size());
+		uint64_t	first = inBuffer ? _firstId : _segments[source].firstId;
+		uint64_t	end = inBuffer ? (_used ? _nextId : _firstId) : first + _segments[source].count;
+		uint64_t	from = first > after + 1 ? first : after + 1;
+		uint64_t	to = end < before ? end : before;
+		if (from >= to)
+			continue ;
+		uint64_t	need = limit - events.size();
+		if (to - from > need && newest)
+			from = to - need;
+		else if (to - from > need)
+			to = from + need;
+
+		part.clear();
+		if (inBuffer)
+			decodeRange(_buffer, _used, first, &_firstTime, from, to, part);
+		else
+			readSegment(_segments[source], from, to, part);
+		events.insert(newest ? events.begin() : events.end(), part.begin(), part.end());
+	}
+}
+
+// The events from <= id < to of a segment
+void	History::readSegment(const Segment &segment, uint64_t from, uint64_t to, std::vector<Event> &events) const
+{
+	int	fd = open(getSegmentPath(segment.number).c_str(), O_RDONLY);
+	if (fd < 0)
+		return ;
+	void	*map = segment.bytes ? mmap(NULL, segment.bytes, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (map == MAP_FAILED)
+		return ;
+	decodeRange(static_cast<const char *>(map), segment.bytes, segment.firstId, NULL, from, to, events);
+	munmap(map, segment.bytes);
+}
+
+// The events from <= id < to of the buffer or of a segment whose first event
+// has the given id. The first event of a segment has the absolute time, the
+// one of the buffer a delta to an event which is gone (firstTime is given).
+// The events before from are only skimmed for their length and time.
+void	History::decodeRange(const char *data, size_t size, uint64_t firstId, const long *firstTime,
+	uint64_t from, uint64_t to, std::vector<Event> &events)
+{
+	size_t	pos = 0;
+	long	time = firstTime ? *firstTime : 0;
+
+	for (uint64_t id = firstId; pos < size && id < to; ++id)
+	{
+		Event	event;
+		long	delta;
+		size_t	len = (id < from) ? skim(data + pos, size - pos, delta) : decode(data + pos, size - pos, delta, event);
+		if (!len)
+			break ;
+		if (pos > 0 || !firstTime)
+			time += delta;
+		pos += len;
+		if (id < from)
+			continue ;
+		event.id = id;
+		event.time = time;
+		events.push_back(event);
+	}
+}
+
+// Encoding
+// -----------------------------------------------------------------------------
+void	History::encode(std::string &out, long delta, int type, const std::string &source, const std::string &text)
+{
+	std::string	body;
+
+	putVarint(body, delta < 0 ? 0 : delta);
+	body += static_cast<char>(type);
+	putVarint(body, source.size());
+	body += source;
+	body += text;
+	putVarint(out, body.size());
+	out += body;
+}
+
+// Only the length and the time delta of an event (0 if it's broken)
+size_t	History::skim(const char *data, size_t size, long &delta)
+{
+	uint64_t	length, value;
+	size_t		head = getVarint(data, size, length);
+
+	if (!head || size - head < length || !getVarint(data + head, length, value))
+		return 0;
+	delta = value;
+	return head + length;
+}
+
+// Returns the bytes of the event (0 if it's broken); id and time are the
+// caller's business
+size_t	History::decode(const char *data, size_t size, long &delta, Event &event)
+{
+	uint64_t	length, value, sourceLen;
+	size_t		head = getVarint(data, size, length);
+
+	if (!head || size - head < length)
+		return 0;
+	const char	*body = data + head;
+	size_t		pos = getVarint(body, length, value);
+	if (!pos || pos >= length)
+		return 0;
+	delta = value;
+	event.type = static_cast<unsigned char>(body[pos++]);
+	size_t	len = getVarint(body + pos, length - pos, sourceLen);
+	if (!len || length - pos - len < sourceLen)
+		return 0;
+	pos += len;
+	event.source.assign(body + pos, sourceLen);
+	pos += sourceLen;
+	event.text.assign(body + pos, length - pos);
+	return head + length;
+}
+
+// Stats
+// -----------------------------------------------------------------------------
+size_t	History::getBufferCount()
+{
+	return _buffers;
+}
+
+size_t	History::getMemoryUsed()
+{
+	return _memoryUsed;
+}
+
+unsigned long	History::getSpilled()
+{
+	return _spilled;
+}
+
+unsigned long	History::getDropped()
+{
+	return _dropped;
+}
@@ -0,0 +1,324 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   LineScan.cpp                                       :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/23 21:10:37 by astein            #+#    #+#             */
+/*   Updated: 2024/05/23 21:10:37 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "LineScan.hpp"
+#include <cstring>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+// Byte classes
+// -----------------------------------------------------------------------------
+#define BYTE_SPACE		0x01	// separates tokens (isspace)
+#define BYTE_CONTROL	0x02	// C0 controls and DEL
+#define BYTE_FORMAT		0x04	// controls which are fine in text (CTCP, bold, ...)
+#define BYTE_FORBIDDEN	0x08	// ' " : backslash
+#define BYTE_HASH		0x10
+#define BYTE_COMMA		0x20
+#define BYTE_HIGH		0x40	// part of a multibyte character
+
+namespace
+{
+	struct ByteTable
+	{
+		unsigned char	classes[256];
+
+		ByteTable()
+		{
+			std::memset(classes, 0, sizeof(classes));
+			for (int c = 0; c < 0x20; ++c)
+				classes[c] = BYTE_CONTROL;
+			classes[0x7F] = BYTE_CONTROL;
+			for (int c = 0x80; c < 0x100; ++c)
+				classes[c] = BYTE_HIGH;
+			const char	*spaces = " \t\n\v\f\r";
+			for (; *spaces; ++spaces)
+				classes[static_cast<unsigned char>(*spaces)] = BYTE_SPACE;
+			const char	*format = "\x01\x02\x03\x0F\x16\x1D\x1E\x1F";
+			for (; *format; ++format)
+				classes[static_cast<unsigned char>(*format)] |= BYTE_FORMAT;
+			classes[static_cast<unsigned char>('\'')] = BYTE_FORBIDDEN;
+			classes[static_cast<unsigned char>('"')] = BYTE_FORBIDDEN;
+			classes[static_cast<unsigned char>(':')] = BYTE_FORBIDDEN;
+			classes[static_cast<unsigned char>('\\')] = BYTE_FORBIDDEN;
+			classes[static_cast<unsigned char>('#')] = BYTE_HASH;
+			classes[static_cast<unsigned char>(',')] = BYTE_COMMA;
+		}
+	};
+
+	const ByteTable	table;
+}
+
+LineScan::Chunking	LineScan::_chunking = CHUNK_SSE2;
+
+// Constructor
+// -----------------------------------------------------------------------------
+LineScan::LineScan(const std::string &line) :
+	_verdict(LINE_OK),
+	_count(0),
+	_hasTrailing(false)
+{
+	const unsigned char	*bytes = reinterpret_cast<const unsigned char *>(line.data());
+	size_t				size = line.size();
+	size_t				args = 0;
+	size_t				i = 0;
+
+	_bad.start = 0;
+	_bad.length = 0;
+	_trailing.start = 0;
+	_trailing.length = 0;
+	while (i < size)
+	{
+		if (table.classes[bytes[i]] & BYTE_SPACE)
+		{
+			i++;
+			continue ;
+		}
+		if (bytes[i] == ':' && _count > 0)
+		{
+			scanTrailing(bytes, i + 1, size);
+			return ;
+		}
+
+		// ONE TOKEN (AND THE ELEMENTS OF A LIST) UP TO THE NEXT SPACE
+		size_t		start = i;
+		size_t		element = i;
+		unsigned	mask = 0;
+		unsigned	elementMask = 0;
+		while (i < size)
+		{
+			unsigned char	cls = table.classes[bytes[i]];
+
+			if (cls & BYTE_SPACE)
+				break ;
+			if (cls & BYTE_HIGH)
+			{
+				size_t length = utf8Length(bytes + i, size - i);
+				if (!length)
+				{
+					fail(LINE_ENCODING);
+					return ;
+				}
+				i += length;
+				continue ;
+			}
+			if (cls & BYTE_CONTROL)
+			{
+				fail(LINE_CONTROL);
+				return ;
+			}
+			if ((cls & BYTE_COMMA) && _count > 0)
+			{
+				if (!checkElement(bytes, element, i, elementMask))
+					return ;
+				element = i + 1;
+				elementMask = 0;
+			}
+			mask |= cls;
+			elementMask |= cls;
+			i++;
+		}
+		if (_count > 0)
+		{
+			if (!checkElement(bytes, element, i, elementMask))
+				return ;
+			if (bytes[start] != '#' && ++args <= 3 && !(mask & BYTE_COMMA) &&
+				(mask & (BYTE_FORBIDDEN | BYTE_HASH)))
+			{
+				fail(LINE_BAD_ARG);
+				return ;
+			}
+		}
+		if (_count < LINE_TOKENS_MAX)
+		{
+			_tokens[_count].start = start;
+			_tokens[_count].length = i - start;
+			_count++;
+		}
+	}
+}
+
+// The text after the colon: mostly printable ASCII, which is skipped in
+// chunks; the whitespace at the end doesn't belong to it (a closing CTCP
+// \x01 does)
+void	LineScan::scanTrailing(const unsigned char *bytes, size_t start, size_t size)
+{
+	size_t	i = start;
+
+	while (i < size)
+	{
+		size_t	plain = plainRun(bytes + i, size - i);
+		if (plain)
+		{
+			i += plain;
+			continue ;
+		}
+		unsigned char	cls = table.classes[bytes[i]];
+		if (cls & BYTE_HIGH)
+		{
+			size_t length = utf8Length(bytes + i, size - i);
+			if (!length)
+				return fail(LINE_ENCODING);
+			i += length;
+			continue ;
+		}
+		if ((cls & BYTE_CONTROL) && !(cls & BYTE_FORMAT))
+			return fail(LINE_CONTROL);
+		i++;
+	}
+	while (size > start && (table.classes[bytes[size - 1]] & BYTE_SPACE))
+		size--;
+	_hasTrailing = true;
+	_trailing.start = start;
+	_trailing.length = size - start;
+}
+
+// An element of a list which starts with '#' has to be a valid channel name
+bool	LineScan::checkElement(const unsigned char *bytes, size_t start, size_t end, unsigned mask)
+{
+	if (start == end || bytes[start] != '#')
+		return true;
+	if (end - start >= 2 && !(mask & BYTE_FORBIDDEN))
+		return true;
+	_bad.start = start;
+	_bad.length = end - start;
+	fail(LINE_BAD_CHANNEL);
+	return false;
+}
+
+void	LineScan::fail(Verdict verdict)
+{
+	_verdict = verdict;
+}
+
+// Length of the UTF-8 character at bytes, 0 if it's malformed (overlong
+// forms, surrogates and code points past U+10FFFF included)
+size_t	LineScan::utf8Length(const unsigned char *bytes, size_t left)
+{
+	unsigned char	lead = bytes[0];
+	size_t			length;
+	unsigned char	low = 0x80;
+	unsigned char	high = 0xBF;
+
+	if (lead >= 0xC2 && lead <= 0xDF)
+		length = 2;
+	else if (lead >= 0xE0 && lead <= 0xEF)
+	{
+		length = 3;
+		if (lead == 0xE0)
+			low = 0xA0;
+		else if (lead == 0xED)
+			high = 0x9F;
+	}
+	else if (lead >= 0xF0 && lead <= 0xF4)
+	{
+		length = 4;
+		if (lead == 0xF0)
+			low = 0x90;
+		else if (lead == 0xF4)
+			high = 0x8F;
+	}
+	else
+		return 0;
+	if (left < length || bytes[1] < low || bytes[1] > high)
+		return 0;
+	for (size_t i = 2; i < length; ++i)
+		if (bytes[i] < 0x80 || bytes[i] > 0xBF)
+			return 0;
+	return length;
+}
+
+// How many bytes at the start are printable ASCII, in whole chunks (0 means
+// the next byte has to be looked at alone)
+size_t	LineScan::plainRun(const unsigned char *bytes, size_t left)
+{
+	size_t	run = 0;
+
+	if (_chunking == CHUNK_NONE)
+		return 0;
+#ifdef __SSE2__
+	const __m128i	space = _mm_set1_epi8(0x20);
+	const __m128i	del = _mm_set1_epi8(0x7F);
+	while (_chunking == CHUNK_SSE2 && left - run >= 16)
+	{
+		// signed compare: the bytes from 0x80 on are "less than a space" too
+		__m128i	chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + run));
+		__m128i	special = _mm_or_si128(_mm_cmplt_epi8(chunk, space), _mm_cmpeq_epi8(chunk, del));
+		if (_mm_movemask_epi8(special))
+			return run;
+		run += 16;
+	}
+#endif
+	const uint64_t	ones = ~static_cast<uint64_t>(0) / 255;
+	while (left - run >= 8)
+	{
+		uint64_t	word;
+		std::memcpy(&word, bytes + run, sizeof(word));
+		uint64_t	delZero = word ^ (ones * 0x7F);
+		if ((word | ((word - ones * 0x20) & ~word) | ((delZero - ones) & ~delZero)) & (ones * 0x80))
+			return run;
+		run += 8;
+	}
+	return run;
+}
+
+void	LineScan::setChunking(Chunking chunking)
+{
+	_chunking = chunking;
+}
+
+// Getters
+// -----------------------------------------------------------------------------
+LineScan::Verdict	LineScan::getVerdict() const
+{
+	return _verdict;
+}
+
+size_t	LineScan::getBadStart() const
+{
+	return _bad.start;
+}
+
+size_t	LineScan::getBadLength() const
+{
+	return _bad.length;
+}
+
+size_t	LineScan::getTokenCount() const
+{
+	return _count;
+}
+
+size_t	LineScan::getTokenStart(size_t index) const
+{
+	return _tokens[index].start;
+}
+
+size_t	LineScan::getTokenLength(size_t index) const
+{
+	return _tokens[index].length;
+}
+
+bool	LineScan::hasTrailing() const
+{
+	return _hasTrailing;
+}
+
+size_t	LineScan::getTrailingStart() const
+{
+	return _trailing.start;
+}
+
+size_t	LineScan::getTrailingLength() const
+{
+	return _trailing.length;
+}
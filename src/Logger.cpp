@@ -11,6 +11,7 @@
 /* ************************************************************************** */
 
 #include "Logger.hpp"
+#include "AllocScope.hpp"
 
 std::ofstream Logger::_logFile;
 bool Logger::_active = true;
@@ -33,11 +34,17 @@ void Logger::deactivateLogger()
 	_active = false;
 }
 
+bool Logger::isActive()
+{
+	return _active;
+}
+
 void Logger::log(const std::string& logmsg)
 {
 	// If not active, return
 	if (!_active)
 		return;
+	AllocScope	scope(ALLOC_LOGGING);
 
     // If the file is not open, return
     if (!_logFile.is_open())
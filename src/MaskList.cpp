@@ -0,0 +1,192 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   MaskList.cpp                                       :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/25 11:20:07 by astein            #+#    #+#             */
+/*   Updated: 2024/05/25 11:20:07 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "MaskList.hpp"
+#include "Atom.hpp"
+
+// Constructor and Destructor
+// -----------------------------------------------------------------------------
+MaskList::MaskList() :
+	_entries(),
+	_globs(),
+	_folded(),
+	_prefixes(1),
+	_suffixes(1),
+	_wild()
+{
+}
+
+MaskList::~MaskList()
+{
+	// Nothing to do
+}
+
+// The missing parts of the mask match anything
+std::string	MaskList::normalize(const std::string &mask)
+{
+	size_t		bang = mask.find('!');
+	size_t		at = mask.find('@', bang == std::string::npos ? 0 : bang);
+	std::string	nick;
+	std::string	user = "*";
+	std::string	host = "*";
+
+	if (bang != std::string::npos)
+	{
+		nick = mask.substr(0, bang);
+		user = mask.substr(bang + 1, at == std::string::npos ? std::string::npos : at - bang - 1);
+	}
+	else if (at != std::string::npos)
+	{
+		nick = "*";
+		user = mask.substr(0, at);
+	}
+	else
+		nick = mask;
+	if (at != std::string::npos)
+		host = mask.substr(at + 1);
+	return (nick.empty() ? "*" : nick) + "!" + (user.empty() ? "*" : user) + "@" + (host.empty() ? "*" : host);
+}
+
+// Changes
+// -----------------------------------------------------------------------------
+// The masks have to be normalized already; false if nothing changed
+bool	MaskList::add(const std::string &mask, const std::string &setter, long time)
+{
+	std::string	folded = Atom::fold(mask);
+
+	if (_folded.count(folded))
+		return false;
+	Entry	entry;
+	entry.mask = mask;
+	entry.setter = setter;
+	entry.time = time;
+	_entries.push_back(entry);
+	_globs.push_back(Glob(mask));
+	_folded[folded] = _entries.size() - 1;
+	index(_entries.size() - 1);
+	return true;
+}
+
+// The ids behind the removed one move, so the tries are built again
+bool	MaskList::remove(const std::string &mask)
+{
+	std::map<std::string, size_t>::iterator	it = _folded.find(Atom::fold(mask));
+
+	if (it == _folded.end())
+		return false;
+	_entries.erase(_entries.begin() + it->second);
+	_globs.erase(_globs.begin() + it->second);
+	rebuild();
+	return true;
+}
+
+bool	MaskList::contains(const std::string &mask) const
+{
+	return _folded.count(Atom::fold(mask)) > 0;
+}
+
+// Matching
+// -----------------------------------------------------------------------------
+bool	MaskList::match(const std::string &hostmask) const
+{
+	if (_entries.empty())
+		return false;
+	if (walk(_prefixes, hostmask, false) || walk(_suffixes, hostmask, true))
+		return true;
+	for (size_t i = 0; i < _wild.size(); ++i)
+		if (_globs[_wild[i]].match(hostmask))
+			return true;
+	return false;
+}
+
+// Every node on the way holds masks whose literal part the hostmask has
+bool	MaskList::walk(const std::vector<Node> &trie, const std::string &hostmask, bool reversed) const
+{
+	size_t	node = 0;
+	size_t	len = hostmask.size();
+
+	for (size_t i = 0; ; ++i)
+	{
+		const std::vector<size_t>	&masks = trie[node].masks;
+		for (size_t m = 0; m < masks.size(); ++m)
+			if (_globs[masks[m]].match(hostmask))
+				return true;
+		if (i == len)
+			return false;
+		char c = Atom::foldByte(hostmask[reversed ? len - 1 - i : i]);
+		std::map<char, size_t>::const_iterator	next = trie[node].next.find(c);
+		if (next == trie[node].next.end())
+			return false;
+		node = next->second;
+	}
+}
+
+// Getters
+// -----------------------------------------------------------------------------
+size_t	MaskList::size() const
+{
+	return _entries.size();
+}
+
+const std::vector<MaskList::Entry>	&MaskList::getEntries() const
+{
+	return _entries;
+}
+
+// The tries
+// -----------------------------------------------------------------------------
+void	MaskList::index(size_t id)
+{
+	const Glob	&glob = _globs[id];
+
+	if (!glob.getPrefix().empty())
+		insert(_prefixes, glob.getPrefix(), false, id);
+	else if (!glob.getSuffix().empty())
+		insert(_suffixes, glob.getSuffix(), true, id);
+	else
+		_wild.push_back(id);
+}
+
+void	MaskList::rebuild()
+{
+	_folded.clear();
+	_prefixes.assign(1, Node());
+	_suffixes.assign(1, Node());
+	_wild.clear();
+	for (size_t id = 0; id < _entries.size(); ++id)
+	{
+		_folded[Atom::fold(_entries[id].mask)] = id;
+		index(id);
+	}
+}
+
+// The key is folded already (it comes out of a Glob)
+void	MaskList::insert(std::vector<Node> &trie, const std::string &key, bool reversed, size_t id)
+{
+	size_t	node = 0;
+	size_t	len = key.size();
+
+	for (size_t i = 0; i < len; ++i)
+	{
+		char c = key[reversed ? len - 1 - i : i];
+		std::map<char, size_t>::iterator	next = trie[node].next.find(c);
+		if (next != trie[node].next.end())
+		{
+			node = next->second;
+			continue ;
+		}
+		trie.push_back(Node());
+		trie[node].next[c] = trie.size() - 1;
+		node = trie.size() - 1;
+	}
+	trie[node].masks.push_back(id);
+}
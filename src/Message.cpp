@@ -15,12 +15,15 @@
 
 // Constructor
 Message::Message(Client *sender, const std::string &ircMessage) :
+	_scan(ircMessage),
 	_sender(sender),
 	_receiver(NULL),
 	_channel(NULL),
 	_cmd(""),
 	_channelName(""),
-	_colon("")
+	_colon(""),
+	_params(),
+	_targets()
 {
 	_args[0] = "";
 	_args[1] = "";
@@ -40,35 +43,30 @@ Message::Message(Client *sender, const std::string &ircMessage) :
 */
 void Message::parseMessage(const std::string &ircMessage)
 {
-	std::istringstream iss(ircMessage);
-    std::string token;
-
-    while (iss >> token)
+	// THE TOKENS WERE FOUND BY THE SCAN ALREADY
+	for (size_t i = 0; i < _scan.getTokenCount(); i++)
 	{
-		if (_cmd.empty())
+		std::string token(ircMessage, _scan.getTokenStart(i), _scan.getTokenLength(i));
+
+		if (i == 0)
+		{
 			_cmd = token;
-		else if (token[0] == '#')
+			continue ;
+		}
+		_params.push_back(token);
+		if (token[0] == '#')
 			_channelName = token;
-		else if (_args[0].empty() && token[0] != ':')
+		else if (_args[0].empty())
 			_args[0] = token;
-		else if (_args[1].empty() && token[0] != ':')
+		else if (_args[1].empty())
 			_args[1] = token;
-		else if (_args[2].empty() && token[0] != ':')
+		else if (_args[2].empty())
 			_args[2] = token;
-		else if (token[0] == ':')
-		{	
-			_colon = ircMessage.substr(ircMessage.find(':') + 1);
-			for (int i = _colon.length() - 1; i >= 0; i--)
-			{
-        		// Check if the character is non-printable or whitespace
-        		if (_colon[i] < 32 || std::isspace(static_cast<unsigned char>(_colon[i])))
-            		_colon.erase(i, 1); // Remove the character
-				else
-					break;
-			}
-			break;
-		}
 	}
+	if (_scan.hasTrailing())
+		_colon.assign(ircMessage, _scan.getTrailingStart(), _scan.getTrailingLength());
+	if (!_params.empty())
+		_targets = splitList(_params[0]);
 }
 
 // Destructor
@@ -116,6 +114,42 @@ const std::string &Message::getArg(size_t index) const
     return _args[index];
 }
 
+const LineScan &Message::getScan() const
+{
+	return _scan;
+}
+
+const std::string &Message::getParam(size_t index) const
+{
+	static const std::string	none;
+
+	if (index >= _params.size())
+		return none;
+	return _params[index];
+}
+
+const std::vector<std::string> &Message::getTargets() const
+{
+	return _targets;
+}
+
+std::vector<std::string> Message::splitList(const std::string &list)
+{
+	std::vector<std::string>	items;
+	size_t						start = 0;
+
+	while (start <= list.size())
+	{
+		size_t end = list.find(',', start);
+		if (end == std::string::npos)
+			end = list.size();
+		if (end > start)
+			items.push_back(list.substr(start, end - start));
+		start = end + 1;
+	}
+	return items;
+}
+
 
 // Setters
 // -----------------------------------------------------------------------------
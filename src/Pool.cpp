@@ -0,0 +1,146 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Pool.cpp                                           :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/18 16:40:27 by astein            #+#    #+#             */
+/*   Updated: 2024/05/18 16:40:27 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "Pool.hpp"
+
+// Steps of about 1.5x keep the waste per block below a third
+Pool::SizeClass	Pool::_classes[POOL_CLASSES] =
+{
+	{16, NULL, 0, 0, 0},	{32, NULL, 0, 0, 0},	{48, NULL, 0, 0, 0},	{64, NULL, 0, 0, 0},
+	{96, NULL, 0, 0, 0},	{128, NULL, 0, 0, 0},	{192, NULL, 0, 0, 0},	{256, NULL, 0, 0, 0},
+	{384, NULL, 0, 0, 0},	{512, NULL, 0, 0, 0},	{768, NULL, 0, 0, 0},	{1024, NULL, 0, 0, 0},
+	{1536, NULL, 0, 0, 0},	{2048, NULL, 0, 0, 0},	{3072, NULL, 0, 0, 0},	{4096, NULL, 0, 0, 0}
+};
+Pool::Slab		*Pool::_slabs = NULL;
+size_t			Pool::_bigBytes = 0;
+
+// Allocate / Deallocate
+// -----------------------------------------------------------------------------
+void	*Pool::allocate(size_t size)
+{
+	int index = classOf(size);
+
+	if (index < 0)
+	{
+		_bigBytes += size;
+		return ::operator new(size);
+	}
+	SizeClass &sizeClass = _classes[index];
+	if (!sizeClass.free)
+		refill(sizeClass);
+	FreeBlock *block = sizeClass.free;
+	sizeClass.free = block->next;
+	sizeClass.freeCount--;
+	sizeClass.inUse++;
+	return block;
+}
+
+void	Pool::deallocate(void *ptr, size_t size)
+{
+	if (!ptr)
+		return ;
+	int index = classOf(size);
+
+	if (index < 0)
+	{
+		_bigBytes -= size;
+		::operator delete(ptr);
+		return ;
+	}
+	SizeClass	&sizeClass = _classes[index];
+	FreeBlock	*block = static_cast<FreeBlock *>(ptr);
+	block->next = sizeClass.free;
+	sizeClass.free = block;
+	sizeClass.freeCount++;
+	sizeClass.inUse--;
+}
+
+void	Pool::purge()
+{
+	for (int i = 0; i < POOL_CLASSES; ++i)
+		if (_classes[i].inUse)
+			return ;
+	while (_slabs)
+	{
+		Slab *next = _slabs->next;
+		::operator delete(_slabs);
+		_slabs = next;
+	}
+	for (int i = 0; i < POOL_CLASSES; ++i)
+	{
+		_classes[i].free = NULL;
+		_classes[i].freeCount = 0;
+		_classes[i].reserved = 0;
+	}
+}
+
+// Stats
+// -----------------------------------------------------------------------------
+int	Pool::getClassCount()
+{
+	return POOL_CLASSES;
+}
+
+Pool::ClassStats	Pool::getClassStats(int index)
+{
+	ClassStats stats;
+
+	stats.size = _classes[index].size;
+	stats.inUse = _classes[index].inUse;
+	stats.free = _classes[index].freeCount;
+	stats.reserved = _classes[index].reserved;
+	return stats;
+}
+
+size_t	Pool::getBigBytes()
+{
+	return _bigBytes;
+}
+
+size_t	Pool::getBlockSize(size_t size)
+{
+	int index = classOf(size);
+
+	return index < 0 ? size : _classes[index].size;
+}
+
+// Private Methods
+// -----------------------------------------------------------------------------
+int	Pool::classOf(size_t size)
+{
+	for (int i = 0; i < POOL_CLASSES; ++i)
+		if (size <= _classes[i].size)
+			return i;
+	return -1;
+}
+
+// Cuts a new slab into blocks of the class
+// The first 16 bytes of the slab link it into the list of all slabs.
+// The slab is sized to a multiple of the block size so nothing is left over.
+void	Pool::refill(SizeClass &sizeClass)
+{
+	size_t	blocks = (POOL_SLAB_SIZE - 16) / sizeClass.size;
+	size_t	slabSize = 16 + blocks * sizeClass.size;
+	char	*memory = static_cast<char *>(::operator new(slabSize));
+	Slab	*slab = reinterpret_cast<Slab *>(memory);
+
+	slab->next = _slabs;
+	_slabs = slab;
+	sizeClass.reserved += slabSize;
+	for (size_t offset = 16; offset < slabSize; offset += sizeClass.size)
+	{
+		FreeBlock *block = reinterpret_cast<FreeBlock *>(memory + offset);
+		block->next = sizeClass.free;
+		sizeClass.free = block;
+		sizeClass.freeCount++;
+	}
+}
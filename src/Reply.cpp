@@ -0,0 +1,51 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Reply.cpp                                          :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/23 16:42:10 by astein            #+#    #+#             */
+/*   Updated: 2024/05/23 16:42:10 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "Reply.hpp"
+
+Reply	&Reply::append(const char *text, size_t len)
+{
+	if (len > REPLY_MAX - _size)
+	{
+		len = REPLY_MAX - _size;
+		_overflowed = true;
+	}
+	std::memcpy(_line + _size, text, len);
+	_size += len;
+	return *this;
+}
+
+// Numbers
+// -----------------------------------------------------------------------------
+Reply	&Reply::operator<<(int number)
+{
+	return *this << static_cast<long>(number);
+}
+
+Reply	&Reply::operator<<(unsigned int number)
+{
+	return *this << static_cast<unsigned long>(number);
+}
+
+Reply	&Reply::operator<<(long number)
+{
+	char	digits[NUMBER_MAX];
+
+	return append(digits, formatNumber(digits, number));
+}
+
+Reply	&Reply::operator<<(unsigned long number)
+{
+	char	digits[NUMBER_MAX];
+
+	return append(digits, formatNumber(digits, number));
+}
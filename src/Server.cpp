@@ -21,8 +21,17 @@ Server::Server(const std::string &port, const std::string &password) :
 	_socket(0),
 	_port(0),
 	_password(""),
+	_limiter(),
+	_timers(monotonicMs() / TIMER_TICK_MS),
 	_clients(),
-	_channels()
+	_remoteClients(),
+	_channels(),
+	_epoch(0),
+	_snapshotTimer(),
+	_snapshotChild(0),
+	_memoryTimer(),
+	_lineFiltered(false),
+	_serverName("localhost")
 {
 	// Initialize the list of allowed cmds
 	_cmds["PASS"] = &Server::pass;
@@ -37,19 +46,78 @@ Server::Server(const std::string &port, const std::string &password) :
     _cmds["MODE"] = &Server::mode;
     _cmds["KICK"] = &Server::kick;
     _cmds["PART"] = &Server::part;
+    _cmds["STATS"] = &Server::stats;
+    _cmds["PING"] = &Server::ping;
+    _cmds["PONG"] = &Server::pong;
+    _cmds["QUIT"] = &Server::quit;
+    _cmds["CHATHISTORY"] = &Server::chathistory;
+    _cmds["LIST"] = &Server::list;
+    _cmds["CAP"] = &Server::cap;
+
+	// Token cost of the cmds for the flood control (default is 1)
+	// Expensive cmds (lots of replies or broadcasts) cost more
+	_cmdCosts["WHO"] = 4;
+	_cmdCosts["JOIN"] = 3;
+	_cmdCosts["WHOIS"] = 2;
+	_cmdCosts["MODE"] = 2;
+	_cmdCosts["INVITE"] = 2;
+	_cmdCosts["KICK"] = 2;
+	_cmdCosts["TOPIC"] = 2;
+	_cmdCosts["PART"] = 2;
+	_cmdCosts["STATS"] = 2;
+	_cmdCosts["CHATHISTORY"] = 4;
+	_cmdCosts["LIST"] = 4;
+
+	// Cmds which change the state of the network (or deliver to a user of
+	// another server) are replayed by all other servers
+	_linkedCmds.insert("NICK");
+	_linkedCmds.insert("JOIN");
+	_linkedCmds.insert("PART");
+	_linkedCmds.insert("KICK");
+	_linkedCmds.insert("MODE");
+	_linkedCmds.insert("TOPIC");
+	_linkedCmds.insert("INVITE");
+	_linkedCmds.insert("PRIVMSG");
+	_floodStats.throttledClients = 0;
+	_floodStats.deferredLines = 0;
+	_floodStats.excessFloods = 0;
+	_sendqStats.exceeded = 0;
+	_sendqStats.peak = 0;
+	_timerStats.pingsSent = 0;
+	_timerStats.pingTimeouts = 0;
+	_timerStats.registerTimeouts = 0;
+	_ioStats.iterations = 0;
+	_ioStats.reads = 0;
+	_ioStats.flushes = 0;
+	_ioStats.lines = 0;
+	_ioStats.ioNs = 0;
+	_ioStats.coreNs = 0;
+	_snapshotStats.written = 0;
+	_snapshotStats.failed = 0;
+	_snapshotStats.channels = 0;
+	_snapshotStats.loadMs = 0;
+	std::memset(&_memoryStats, 0, sizeof(_memoryStats));
 	parseArgs(port, password);
+	buildBurst();
+	reloadFilter();
 
 	// Create a lobby channel
-	_channels.push_back(Channel("#lobby", "Welcome to the lobby of: " + std::string(PROMT)));
+	_channels.push_back(Channel(LOBBY_NAME, "Welcome to the lobby of: " + std::string(PROMT)));
+
+	// Bring back the channels of the last run
+	loadSnapshot();
+	_timers.arm(_snapshotTimer, SNAPSHOT_INTERVAL, NULL);
+	_timers.arm(_memoryTimer, MEMORY_SCAN_INTERVAL, NULL);
 }
 
 Server::~Server()
 {
 	// Close all client sockets
-	std::list<Client>::iterator it;
+	ClientList::iterator it;
 	for(it = _clients.begin(); it != _clients.end(); ++it)
 	{
 		it->sendMessage("Bye " + it->getUniqueName() + "!");
+		it->flushOutput();
 		if(it->getSocketFd() > 4)
 		close(it->getSocketFd());
 	}
@@ -73,7 +141,8 @@ void Server::parseArgs(const std::string &port, const std::string &password)
 	// https://en.wikipedia.org/wiki/Port_(computer_networking)
 	// The ports up to 49151 are not as strictly controlled
 	// The ports from 49152 to 65535 are called dynamic ports
-	if (portInt != 194 && (portInt < 1024 || portInt > 65535))
+	// (values above 65535 already fail the extraction into the u_int16_t)
+	if (portInt != 194 && portInt < 1024)
 		throw ServerException("Port is not the IRC port (194) or in the range 1024-65535!");
 	_port = portInt;
 	info ("port accepted:\t" + port, CLR_YLW);
@@ -88,6 +157,45 @@ void Server::parseArgs(const std::string &port, const std::string &password)
 	_password = password;
 }
 
+// The name of this server in the network (has to be unique if linked)
+void	Server::setServerName(const std::string &name)
+{
+	if (name.empty() || name.find_first_of(" \t\n\r\f\v:#,") != std::string::npos)
+		throw ServerException("Invalid server name: " + name);
+	_serverName = name;
+	info ("server name:\t" + name, CLR_YLW);
+}
+
+// <host>:<port> of a server to link to
+void	Server::addLinkPeer(const std::string &hostPort)
+{
+	size_t colon = hostPort.rfind(':');
+	if (colon == std::string::npos || colon == 0 || colon + 1 == hostPort.size() ||
+		hostPort.find_first_not_of("0123456789", colon + 1) != std::string::npos)
+		throw ServerException("Invalid link peer (expected <host>:<port>): " + hostPort);
+	LinkPeer peer;
+	peer.host = hostPort.substr(0, colon);
+	peer.port = hostPort.substr(colon + 1);
+	peer.connection = NULL;
+	_peers.push_back(peer);
+	info ("link peer:\t" + hostPort, CLR_YLW);
+}
+
+// The binary on disk is what a hot upgrade runs (it may be a newer build by
+// then), so its path is taken now
+void	Server::enableUpgrade(char **argv)
+{
+	char	path[4096];
+	ssize_t	len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+
+	if (len > 0)
+		_execPath.assign(path, len);
+	else
+		_execPath = argv[0];
+	for (int i = 0; argv[i]; ++i)
+		_execArgs.push_back(argv[i]);
+}
+
 // -----------------------------------------------------------------------------
 // Server Methods
 // -----------------------------------------------------------------------------
@@ -142,18 +250,46 @@ void	Server::initNetwork()
     }
 	info("Local IP Address:\t" + std::string(inet_ntoa(_address.sin_addr)), CLR_BLU);
 	info("Local port:\t\t" + to_string(ntohs(_address.sin_port)), CLR_BLU);
+	removeStaleHistory();
+
+	// Link to the other servers of the network
+	for (std::list<LinkPeer>::iterator it = _peers.begin(); it != _peers.end(); ++it)
+		connectLink(*it);
 	info("[>DONE] Init network", CLR_GRN);
 }
 
 void	Server::goOnline()
 {
 	info("[START] Go online", CLR_GRN);
-	std::vector<pollfd> fds;
+	pollfd	*fds;
+	size_t	nfds;
 	while (_keepRunning)
 	{
-		fds = getFdsAsVector();
+		// SIGUSR2: hand everything to the binary on disk (only returns if
+		// the new one didn't take over)
+		if (_upgradeRequested)
+		{
+			_upgradeRequested = 0;
+			upgrade();
+		}
+		// SIGHUP: the filter patterns changed (the old ones stay if the
+		// new file is broken)
+		if (_reloadRequested)
+		{
+			_reloadRequested = 0;
+			reloadFilter();
+		}
+		// SIGUSR1: tracing on, or off and written to TRACE_FILE
+		if (_traceRequested)
+		{
+			_traceRequested = 0;
+			toggleTrace();
+		}
+		fds = getPollFds(nfds);
 		info ("Waiting for messages ...", CLR_ORN);
-		int pollReturn = poll(fds.data(), fds.size() , -1);
+		TraceSpan	waiting("poll");
+		int pollReturn = poll(fds, nfds, getPollTimeout());
+		waiting.close();
 		if (pollReturn == -1)
 		{
 			if (!_keepRunning)
@@ -161,110 +297,276 @@ void	Server::goOnline()
 				shutDown();
 				return ;
 			}
+			// Any other signal just woke poll up
+			if (errno == EINTR)
+				continue ;
 			throw ServerException("Poll failed\n\t" + std::string(strerror(errno)));
 		}
-		if (pollReturn == 0)
-			continue;
+
+		_ioStats.iterations++;
+
+		// Handle the timers which expired while waiting
+		{
+			TraceSpan	span("timers");
+			processTimers();
+		}
 
 		// Check for new connections
         if (fds[0].revents & POLLIN)
 		{
-			// https://pubs.opengroup.org/onlinepubs/009695399/functions/accept.html
-			int	addrlen = sizeof(_address);
-			int new_socket = accept(fds[0].fd, (struct sockaddr *)&_address, (socklen_t*)&addrlen);
-            if (new_socket < 0)
-				throw ServerException("Accept failed\n\t" + std::string(strerror(errno)));
-			// Use fcntl to set the socket to non-blocking
-			// https://pubs.opengroup.org/onlinepubs/009695399/functions/fcntl.html
-			if (fcntl(new_socket, F_SETFL, O_NONBLOCK) < 0)
-				throw ServerException("Fcntl failed\n\t" +	std::string(strerror(errno)));
-			_clients.push_back(Client(new_socket));
-			info ("DONE handling NEW CONNECTION msg from fd: " + to_string(new_socket), CLR_ORN);
-        }
-		
-		// Read from clients
-		char buffer[BUFFER_SIZE+1];	// +1 for the null terminator
-		Client *cur_client;
-		for (size_t i = 1; i < fds.size(); ++i)
+			TraceSpan	span("accept");
+			acceptConnection();
+		}
+
+		// The phases are timed for STATS p (see IO_READ_SIZE in Server.hpp)
+		long	phaseStart = monotonicNs();
+
+		// 1. I/O phase: read whatever the sockets have (the input buffers do
+		//    the framing) and continue the sendqs which can take data again
+		Client	**ready = Arena::frame().allocateArray<Client *>(nfds);
+		size_t	readyCount = 0;
+		Client	*cur_client;
+		for (size_t i = 1; i < nfds; ++i)
 		{
-            if (fds[i].revents & POLLIN)
-			{
-				cur_client = getClientByFd(fds[i].fd);
-				if (!cur_client)
-					continue ; // should never happen by arcitechture
-					
-				int result = recv(fds[i].fd, buffer, BUFFER_SIZE, 0);
-                if (result <= 0)
-				{
-					// Some read error happend
-					// The server doesn't bother to much and just deletes this client
-					Logger::log("Client " + cur_client->getUniqueName() + " disconnected");
-					info ("DONE handling DISCONNECTING msg from fd: " + to_string(fds[i].fd), CLR_ORN);
-                    close(fds[i].fd);
-                    fds.erase(fds.begin() + i);		// erase the client fd from the fd vector
-					_clients.remove(*cur_client);	// erase the client from the client list
-                    --i; // Adjust loop counter since we removed an element
-                }
-				else
-				{
-                    buffer[result] = '\0';
-					// Since the buffer could only be a part of a msg we
-					// 1. append it to the client buffer
-					if (!cur_client->appendBuffer(buffer))
-					{
-						cur_client->sendMessage("Message was to long and will be deleted");
-						// The msg was to long
-						// The full messages will be deleted and the client will be informed
-					}
-					// 2. get the full msg(s) from the client buffer
-					std::string fullMsg;
-					while (!(fullMsg = cur_client->getFullMessage()).empty())
-					{
-						// 3. process the msg(s)
-						Logger::log("start processing msg from " + cur_client->getUniqueName() + " -> " + fullMsg);
-						processMessage(cur_client, fullMsg);
-						info ("DONE handling NORMAL msg from fd: " + to_string(fds[i].fd), CLR_ORN);
-					}
-                }
-            }
+			if (!fds[i].revents)
+				continue ;
+			cur_client = getClientByFd(fds[i].fd);
+			if (!cur_client || cur_client->isMarkedForDisconnect())
+				continue ; // should never happen by arcitechture
+
+			// The socket accepts data again -> continue sending the sendq
+			if (fds[i].revents & POLLOUT)
+				cur_client->flushOutput();
+
+			// Peer is gone but we didn't ask for POLLIN (backpressure)
+			if ((fds[i].revents & (POLLHUP | POLLERR)) && !(fds[i].revents & POLLIN))
+				cur_client->markForDisconnect("Connection closed");
+
+            if ((fds[i].revents & POLLIN) && !cur_client->isMarkedForDisconnect() && readClient(cur_client))
+				ready[readyCount++] = cur_client;
 		}
-		
+
+		long	phaseEnd = monotonicNs();
+		_ioStats.ioNs += phaseEnd - phaseStart;
+		phaseStart = phaseEnd;
+
+		// 2. Core phase: execute the full messages the flood control allows
+		for (size_t i = 0; i < readyCount; ++i)
+		{
+			if (!ready[i]->isMarkedForDisconnect())
+				processInput(ready[i]);
+		}
+
+		// Retry the lines the flood control deferred in earlier iterations
+		processDeferredInput();
+
+		// Refill the sendqs of the LISTs which drained
+		continueListings();
+
+		phaseEnd = monotonicNs();
+		_ioStats.coreNs += phaseEnd - phaseStart;
+		phaseStart = phaseEnd;
+
+		// 3. I/O phase: one send per client for all replies of this iteration
+		flushClients();
+		_ioStats.ioNs += monotonicNs() - phaseStart;
+
+		// Remove all clients which got disconnected in this iteration
+		reapClients();
+
+		// Everything formatted in this iteration is sent or queued by now
+		Arena::frame().reset();
 	}	
+	shutDown();
 	info("[>DONE] Go online", CLR_YLW);
 }
 
+// Reads until the socket is empty (or the budget of one iteration is used)
+// Returns true if there is new input for the core phase
+bool	Server::readClient(Client *client)
+{
+	AllocScope	scope(ALLOC_RECV);
+	TraceSpan	span("recv", client->getSocketFd());
+	char		buffer[IO_READ_SIZE + 1];	// +1 for the null terminator
+	bool		gotInput = false;
+
+	for (int reads = 0; reads < IO_READ_BUDGET; ++reads)
+	{
+		_ioStats.reads++;
+		int result = recv(client->getSocketFd(), buffer, IO_READ_SIZE, 0);
+		if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			break ;
+		if (result <= 0)
+		{
+			// Some read error happend
+			// The server doesn't bother to much and just deletes this client
+			Logger::log("Client " + client->getUniqueName() + " disconnected");
+			info ("DONE handling DISCONNECTING msg from fd: " + to_string(client->getSocketFd()), CLR_ORN);
+			client->markForDisconnect("Connection closed");
+			break ;
+		}
+		buffer[result] = '\0';
+		client->touch();
+		gotInput = true;
+		// Since the buffer could only be a part of a msg we append it to the
+		// client buffer; the full msg(s) are processed in the core phase
+		if (!client->appendBuffer(buffer, result))
+		{
+			// The msg was to long
+			// The full messages will be deleted and the client will be informed
+			client->sendMessage("Message was to long and will be deleted");
+		}
+		if (result < IO_READ_SIZE)
+			break ;
+	}
+	return gotInput;
+}
+
+// Sends the sendqs which got new output in this iteration
+// (sockets which were full already wait for POLLOUT)
+void	Server::flushClients()
+{
+	AllocScope	scope(ALLOC_FLUSH);
+
+	for (ClientList::iterator it = _clients.begin(); it != _clients.end(); ++it)
+	{
+		if (it->hasPendingOutput() && !it->isOutputBlocked() && !it->isMarkedForDisconnect())
+		{
+			TraceSpan	span("flush", it->getSocketFd());
+			_ioStats.flushes++;
+			it->flushOutput();
+		}
+	}
+}
+
 void	Server::shutDown()
 {
 	info("[START] Shut down", CLR_YLW);
 	broadcastMessage("!!!Server is shutting down now!!!");
+	// The last snapshot is written right here (there is no loop to block anymore)
+	reapSnapshotChild(true);
+	saveSnapshot(false);
 	info("[>DONE] Shut down", CLR_GRN);
 }
 
-std::vector<pollfd>	Server::getFdsAsVector() const
+// The poll set only lives for one loop iteration -> it's cut from the arena
+pollfd	*Server::getPollFds(size_t &count) const
 {
-	std::vector<pollfd> fds;
-	pollfd fd;
-	fd.fd = _socket;
+	pollfd	*fds = Arena::frame().allocateArray<pollfd>(_clients.size() + 1);
+
+	count = 0;
+	fds[count].fd = _socket;
 	// POLLIN: There is data to read
-	fd.events = POLLIN;
-	fds.push_back(fd);
-	for (std::list<Client>::const_iterator it = _clients.begin(); it != _clients.end(); ++it)
+	fds[count].events = POLLIN;
+	fds[count].revents = 0;
+	count++;
+	for (ClientList::const_iterator it = _clients.begin(); it != _clients.end(); ++it)
 	{
-		fd.fd = it->getSocketFd();
-		fd.events = POLLIN;
-		fds.push_back(fd);
+		fds[count].fd = it->getSocketFd();
+		fds[count].events = 0;
+		fds[count].revents = 0;
+		// Backpressure: a client which doesn't read its own replies
+		// won't get any more input processed until its sendq drained
+		if (it->getSendQueueSize() <= SENDQ_SOFT)
+			fds[count].events |= POLLIN;
+		// POLLOUT: The socket accepts data again
+		if (it->hasPendingOutput())
+			fds[count].events |= POLLOUT;
+		count++;
 	}
-	if(fds.size() == 0)
-		throw ServerException("No socket file descriptors found");
 	return fds;
 }
 
-void	Server::broadcastMessage(const std::string &msg) const
+// Accepts a new connection if the limits of its host allow it
+// -----------------------------------------------------------------------------
+// The limits are checked before a Client is created, so a rejected
+// connection costs nothing but the accept() and close()
+void	Server::acceptConnection()
+{
+	struct sockaddr_storage	peer;
+	socklen_t				addrlen = sizeof(peer);
+
+	// https://pubs.opengroup.org/onlinepubs/009695399/functions/accept.html
+	int new_socket = accept(_socket, reinterpret_cast<struct sockaddr *>(&peer), &addrlen);
+	if (new_socket < 0)
+	{
+		// Out of fds or the peer already gave up: try again next time
+		Logger::log("Accept failed: " + std::string(strerror(errno)));
+		return ;
+	}
+
+	std::string					host = ConnectionLimiter::addressToString(peer);
+
+	// Better a refused connection than the OOM killer taking all of them.
+	// (Before the limiter counts the connection, which then isn't there.)
+	if (getMemoryTotal() >= MEMORY_CAP)
+	{
+		std::string error = "ERROR :Closing Link: " + host + " (Server is out of memory)\n";
+		send(new_socket, error.c_str(), error.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+		close(new_socket);
+		_memoryStats.refused++;
+		Logger::log("Rejected connection from " + host + ": out of memory");
+		return ;
+	}
+
+	ConnectionLimiter::Verdict	verdict = _limiter.admit(ConnectionLimiter::keyOf(peer), monotonicMs());
+	if (verdict != ConnectionLimiter::ADMIT)
+	{
+		std::string error = "ERROR :Closing Link: " + host + " (" +
+			(verdict == ConnectionLimiter::TOO_FAST ? "Connecting too fast" : "Too many connections from your host") + ")\n";
+		send(new_socket, error.c_str(), error.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+		close(new_socket);
+		Logger::log("Rejected connection from " + host + ": " + error);
+		return ;
+	}
+
+	// Use fcntl to set the socket to non-blocking
+	// https://pubs.opengroup.org/onlinepubs/009695399/functions/fcntl.html
+	if (fcntl(new_socket, F_SETFL, O_NONBLOCK) < 0)
+	{
+		std::string reason = strerror(errno);
+		close(new_socket);
+		_limiter.release(ConnectionLimiter::keyOf(peer));
+		throw ServerException("Fcntl failed\n\t" + reason);
+	}
+	_clients.push_back(Client(new_socket));
+	_clients.back().setPeerAddress(peer);
+	_clients.back().setHostname(host);
+	// Arm the timer of the client in the list (not the one of the copied temporary)
+	_timers.arm(_clients.back().getLivenessTimer(), REGISTER_TIMEOUT, &_clients.back());
+	info ("DONE handling NEW CONNECTION msg from fd: " + to_string(new_socket) + " (" + host + ")", CLR_ORN);
+}
+
+// Blocks forever if there is nothing to do except waiting for input.
+// If the flood control deferred some lines, poll has to wake up again
+// to process them once the clients' token buckets got refilled
+// The timers wake poll up when the next one of them is due
+int	Server::getPollTimeout() const
+{
+	for (ClientList::const_iterator it = _clients.begin(); it != _clients.end(); ++it)
+	{
+		if (it->isThrottled())
+			return FLOOD_RETRY_MS;
+	}
+	// A LIST which doesn't wait for its socket goes on right away
+	for (std::list<Listing>::const_iterator it = _listings.begin(); it != _listings.end(); ++it)
+	{
+		if (!it->client->isOutputBlocked())
+			return 0;
+	}
+	long nextTick = _timers.nextEventTick();
+	if (nextTick < 0)
+		return -1;
+	long timeout = nextTick * TIMER_TICK_MS - monotonicMs();
+	return timeout < 0 ? 0 : timeout;
+}
+
+void	Server::broadcastMessage(const std::string &msg)
 {
 	info("[START] Broadcast msg", CLR_YLW);
 
 	// Send it to all clients
-	for (std::list<Client>::const_iterator it = _clients.begin(); it != _clients.end(); ++it)
+	for (ClientList::iterator it = _clients.begin(); it != _clients.end(); ++it)
 	{
 		std::string ircMessage = ":localhost NOTICE ";
 		ircMessage += it->getUniqueName() + " :" + msg;
@@ -273,421 +575,2181 @@ void	Server::broadcastMessage(const std::string &msg) const
 	info("[>DONE] Broadcast msg", CLR_GRN);
 }
 
-// -----------------------------------------------------------------------------
-// Processing the Messages
-// -----------------------------------------------------------------------------
-void	Server::processMessage(Client *sender, const std::string &ircMessage)
+// Removes (and closes) all clients which were marked for disconnect
+// Doing this only at the end of a loop iteration makes sure no one is
+// still working with a pointer to the client
+void	Server::reapClients()
 {
-	// Parse the IRC Message
-	Message     msg(sender, ircMessage);
-	
-	// Check if args contain non valid chars
-	std::string nonValidChars = "'\":\\";
-	// Check if channelname contain non valid chars
-	if (!msg.getChannelName().empty() &&
-		(msg.getChannelName().find_first_of(nonValidChars) != std::string::npos || msg.getChannelName().size() < 2))
-	{
-		msg.getSender()->sendMessage(ERR_NOSUCHCHANNEL, msg.getChannelName() + " :channelname contains invalid characters");
-		return ;
-	}
-	nonValidChars += "#";
-	for (int i = 0; i < 3; i++)
+	ClientList::iterator it = _clients.begin();
+	while (it != _clients.end())
 	{
-		if (msg.getArg(i).find_first_of(nonValidChars) != std::string::npos)
+		if (!it->isMarkedForDisconnect())
 		{
-			msg.getSender()->sendMessage(":localhost NOTICE " + msg.getSender()->getUniqueName() + " :Your message contains invalid characters and was not delivered.");
-			return ;
+			++it;
+			continue ;
+		}
+		Logger::log("Reaping client " + it->getUniqueName() + " (" + it->getDisconnectReason() + ")");
+		// Tell the rest of the network (killed clients are already gone there)
+		if (it->isServerLink() && it->isRegistered())
+			linkLost(&(*it));
+		else if (it->isRegistered() && it->getDisconnectReason().compare(0, 6, "Killed") != 0)
+			propagate(":" + it->getUniqueName() + " QUIT :" + it->getDisconnectReason(), NULL);
+		if (!it->isServerLink())
+		{
+			sendQuit(&(*it), it->getDisconnectReason());
+			unindexClient(&(*it));
+			cancelListing(&(*it));
+		}
+		LinkPeer *peer = getPeerByConnection(&(*it));
+		if (peer)
+		{
+			// An outgoing link: connect again later
+			peer->connection = NULL;
+			_timers.arm(peer->retry, LINK_RETRY, peer);
 		}
+		if (it->getDisconnectReason() == "SendQ exceeded")
+			_sendqStats.exceeded++;
+		if (it->getSendQueuePeak() > _sendqStats.peak)
+			_sendqStats.peak = it->getSendQueuePeak();
+		// Last try to get the pending output (e.g. the ERROR) out
+		it->flushOutput();
+		close(it->getSocketFd());
+		if (!peer)
+			_limiter.release(ConnectionLimiter::keyOf(it->getPeerAddress()));
+		it = _clients.erase(it);
 	}
-	
-	//Execute IRC Message
-	//	1. Check if CLIENT is loggedin
-	if (!isLoggedIn(&msg))
+}
+
+// An invite is for the client, not for its nick: it goes with a NICK or QUIT.
+// Only clients which were invited at all have to look at the channels.
+void	Server::dropInvites(Client *client)
+{
+	if (!client->hasInvites())
 		return ;
-	
-	//	2. Execute normal commands
-	//		3.1. Find the channel if there is  channelname in the msg
-	msg.setChannel(getInstanceByName(_channels, msg.getChannelName()));
-	
-	// 		3.2 Process the msg aka call the right function
-	chooseCommand(&msg);
+	for (ChannelList::iterator it = _channels.begin(); it != _channels.end(); ++it)
+		it->dropInvite(client);
+	client->setInvited(false);
 }
 
-bool	Server::isLoggedIn(Message *msg)
+// One QUIT line per neighbour, no matter how many channels they share.
+// Afterwards the client is out of all its channels and invites.
+void	Server::sendQuit(Client *client, const std::string &reason)
 {
-	if (!msg->getSender())
-		return false;
+	const ChannelPtrList	&channels = client->getChannels();
 
-	// CHECK IF PASSWORD WAS PROVIDED
-	if(!msg->getSender()->isAuthenticated())
+	dropInvites(client);
+	sendToNeighbours(client, ":" + client->getUniqueName() + "!" + client->getUsername() +
+		"@localhost QUIT :" + reason, false);
+	while (!channels.empty())
 	{
-		if (msg->getCmd() == "PASS")
-		{
-			pass(msg);
-			return false;
-		}
-		else
+		Channel *channel = channels.front();
+		client->removeChannel(channel);
+		channel->removeClient(client);
+	}
+}
+
+// Sends the (once rendered) line to every client which shares a channel with
+// the given one. Every neighbour is marked with a new epoch when it's reached
+// the first time, so a neighbour in many of the channels still gets one line.
+void	Server::sendToNeighbours(Client *client, const std::string &line, bool self)
+{
+	AllocScope				scope(ALLOC_FANOUT);
+	const ChannelPtrList	&channels = client->getChannels();
+
+	_epoch++;
+	client->markEpoch(_epoch);
+	if (self)
+		client->sendMessage(line);
+	for (ChannelPtrList::const_iterator it = channels.begin(); it != channels.end(); ++it)
+	{
+		const ClientStateMap &members = (*it)->getMembers();
+		for (ClientStateMap::const_iterator member = members.begin(); member != members.end(); ++member)
 		{
-			msg->getSender()->sendMessage(ERR_NOTREGISTERED, ":You have not provided the correct password (this is the first thing u have to do!)");
-			return false;
+			if (member->first->markEpoch(_epoch))
+				member->first->sendMessage(line);
 		}
 	}
-
-	if(!msg->getSender()->getUniqueName().empty() && !msg->getSender()->getUsername().empty())
-		return true;
-	
-	//	1. Check if NICK is set
-	if (msg->getCmd() == "NICK")
-		nick(msg);
-	else if (msg->getCmd() == "USER")
-		user(msg);
-	else
-		msg->getSender()->sendMessage(ERR_NOTREGISTERED, ":You have not registered");
-	return false;
 }
 
-void	Server::chooseCommand(Message *msg)
+void	Server::processTimers()
 {
-	std::string cmd = msg->getCmd();
-	if (cmd.empty())
-		return ; // this should not happen by design
+	std::vector<Timer *>	expired;
 
-	for (std::map<std::string, CommandFunction>::iterator it = _cmds.begin(); it != _cmds.end(); ++it)
+	reapSnapshotChild(false);
+	_timers.advance(monotonicMs() / TIMER_TICK_MS, expired);
+	for (size_t i = 0; i < expired.size(); ++i)
 	{
-		if (cmd == it->first)
+		LinkPeer *peer = getPeerByTimer(expired[i]);
+		if (expired[i] == &_snapshotTimer)
 		{
-			(this->*(it->second))(msg);
-			return ;
+			saveSnapshot(true);
+			_timers.arm(_snapshotTimer, SNAPSHOT_INTERVAL, NULL);
+		}
+		else if (expired[i] == &_memoryTimer)
+		{
+			scanMemory(true);
+			_timers.arm(_memoryTimer, MEMORY_SCAN_INTERVAL, NULL);
 		}
+		else if (peer)
+			connectLink(*peer);
+		else
+			handleLivenessTimer(static_cast<Client *>(expired[i]->getData()));
 	}
-	// :10.11.3.6 421 anshovah_ PRIMSG :Unknown command
-	msg->getSender()->sendMessage(ERR_UNKNOWNCOMMAND, msg->getCmd() + " :Unknown command");
 }
 
-//PASS
-void	Server::pass(Message *msg)
+// One timer per client checks (depending on its state) if
+//	- the client registered in time
+//	- the client was idle for too long -> PING
+//	- the client answered the PING in time
+// Activity doesn't move the timer; if it fires too early it's just armed
+// again for the remaining idle time
+void	Server::handleLivenessTimer(Client *client)
 {
-	// CHECK IF USER ALREADY LOGGED IN
-	if (msg->getSender()->isAuthenticated())
+	if (client->isMarkedForDisconnect())
+		return ;
+	if (!client->isRegistered())
 	{
-		msg->getSender()->sendMessage(ERR_ALREADYREGISTRED, msg->getSender()->getUniqueName() + " :You may not reregister");
+		_timerStats.registerTimeouts++;
+		client->sendMessage("ERROR :Closing Link: localhost (Registration timeout)");
+		client->markForDisconnect("Registration timeout");
 		return ;
 	}
-	if (msg->getArg(0).empty())
+	if (client->isPingPending())
 	{
-		msg->getSender()->sendMessage(ERR_NEEDMOREPARAMS, "PASS :Not enough parameters");
+		_timerStats.pingTimeouts++;
+		client->sendMessage("ERROR :Closing Link: localhost (Ping timeout: " + to_string(PONG_TIMEOUT) + " seconds)");
+		client->markForDisconnect("Ping timeout");
 		return ;
 	}
-	if (msg->getArg(0) == _password)
+	long idle = client->getIdleMs() / 1000;
+	if (idle < PING_IDLE)
 	{
-		msg->getSender()->setAuthenticated(true);
-		msg->getSender()->logClient();
+		_timers.arm(client->getLivenessTimer(), PING_IDLE - idle, client);
+		return ;
 	}
+	_timerStats.pingsSent++;
+	client->sendMessage("PING :localhost");
+	client->setPingPending(true);
+	_timers.arm(client->getLivenessTimer(), PONG_TIMEOUT, client);
 }
 
-// /NICK
-void	Server::nick(Message *msg)
-{	
-	std::string oldNickname = msg->getSender()->getUniqueName();
-	std::string newNickname = msg->getArg(0);
-	bool 		isFirstNick = oldNickname.empty();
-
-	if (oldNickname.empty())
-		oldNickname = newNickname;
+// Channel snapshots
+// -----------------------------------------------------------------------------
+// The channels (without members) and their operators' nicks survive a
+// restart. The lobby is created by the constructor anyway.
+void	Server::loadSnapshot()
+{
+	std::vector<Snapshot::Record>	records;
+	long							start = monotonicMs();
 
-	if (newNickname.empty())
-		msg->getSender()->sendMessage(ERR_NONICKNAMEGIVEN, ":No nickname given");
-	else if (!isNameAvailable(_clients, newNickname))
-		msg->getSender()->sendMessage(ERR_NICKNAMEINUSE, oldNickname + " " + newNickname + " :Nickname is already in use");
-	else
+	if (!Snapshot::load(SNAPSHOT_FILE, records))
 	{
-		msg->getSender()->setUniqueName(newNickname);
-		std::string ircMessage = 
-			":" + oldNickname + "!" +
-			msg->getSender()->getUsername() +
-			"@localhost NICK :" +
-			newNickname;
-		msg->getSender()->sendMessage(ircMessage);
-
-		// CHECK IF NEED tO SEND A WELCOME MSG NOW
-		if (isFirstNick && !msg->getSender()->getUsername().empty())
-		{
-			//:luna.AfterNET.Org 001 ash_ :Welcome to the FINISHERS' IRC Network, ash_
-			msg->getSender()->sendMessage(RPL_WELCOME, msg->getSender()->getUniqueName() + " :Welcome to " + std::string(PROMT) + ", " + msg->getSender()->getUniqueName());
-			// ADD THE CLIENT TO THE LOBBY
-			_channels.front().joinChannel(msg->getSender(), "");
-		}
+		info("No (valid) channel snapshot found", CLR_YLW);
+		return ;
+	}
+	// Logging every channel would take longer than the whole load
+	bool			logging = Logger::isActive();
+	std::set<Atom>	names;
+	Logger::deactivateLogger();
+	names.insert(_channels.front().getAtom());
+	for (size_t i = 0; i < records.size(); ++i)
+	{
+		if (records[i].name.size() < 2 || records[i].name[0] != '#' ||
+			!names.insert(Atom(records[i].name)).second)
+			continue ;
+		_channels.push_back(Channel(records[i].name));
+		_channels.back().restore(records[i]);
 	}
+	if (logging)
+		Logger::activateLogger();
+	_snapshotStats.channels = records.size();
+	_snapshotStats.loadMs = monotonicMs() - start;
+	info("Restored " + to_string(records.size()) + " channels in " + to_string(_snapshotStats.loadMs) + "ms", CLR_GRN);
 }
 
-void	Server::user(Message *msg)
+// Memory accounting
+// -----------------------------------------------------------------------------
+// Everything a connection holds, per part. The member maps of the channels
+// come from the pool too; the WHO index uses the heap (its nodes are the
+// value and four links). Clients idle for COMPACT_IDLE_MS give back the
+// slack of their strings.
+void	Server::scanMemory(bool compact)
 {
-	std::string oldUsername = msg->getSender()->getUsername();
-	std::string newUsername = msg->getArg(0);
-	
-	// CAN'T RE-REGISTER!
-	if(!oldUsername.empty())
+	std::map<const Client *, size_t>	indexBytes;
+	size_t	memberNode = Pool::getBlockSize(sizeof(ClientStateMap::value_type) + 4 * sizeof(void *));
+	size_t	indexNode = sizeof(std::multimap<std::string, Client *>::value_type) + 4 * sizeof(void *);
+
+	_memoryStats.index = 0;
+	for (std::multimap<std::string, Client *>::const_iterator it = _whoIndex.begin(); it != _whoIndex.end(); ++it)
 	{
-		msg->getSender()->sendMessage(ERR_ALREADYREGISTRED, msg->getSender()->getUniqueName() + " :You may not reregister");
-		return ;
+		size_t bytes = indexNode + stringHeapBytes(it->first);
+		indexBytes[it->second] += bytes;
+		_memoryStats.index += bytes;
 	}
 
-	if (!msg->getArg(0).empty() && !msg->getArg(1).empty() &&
-		!msg->getArg(2).empty() && !msg->getColon().empty())
+	_memoryStats.clients = 0;
+	_memoryStats.object = 0;
+	_memoryStats.strings = 0;
+	_memoryStats.buffers = 0;
+	_memoryStats.channels = 0;
+	_memoryStats.memberships = 0;
+	_memoryStats.idleClients = 0;
+	_memoryStats.idleBytes = 0;
+	for (ClientList::iterator it = _clients.begin(); it != _clients.end(); ++it)
 	{
-		msg->getSender()->setUsername(msg->getArg(0));
-		msg->getSender()->setFullname(msg->getColon());
-		// CHECK IF NEED tO SEND A WELCOME MSG NOW
-		if (oldUsername.empty() && !msg->getSender()->getUniqueName().empty())
+		if (compact && it->getIdleMs() >= COMPACT_IDLE_MS)
+			_memoryStats.compacted += it->compact();
+
+		Client::MemoryUsage	usage = it->getMemoryUsage();
+		size_t				memberships = it->getChannels().size() * memberNode;
+		_memoryStats.clients++;
+		_memoryStats.object += usage.object;
+		_memoryStats.strings += usage.strings;
+		_memoryStats.buffers += usage.buffers;
+		_memoryStats.channels += usage.channels;
+		_memoryStats.memberships += memberships;
+		if (it->isRegistered() && !it->hasPendingOutput() && it->getInputBacklog() == 0)
 		{
-			msg->getSender()->sendMessage(RPL_WELCOME, msg->getSender()->getUniqueName() + " :Welcome to " + std::string(PROMT) + ", " + msg->getSender()->getUniqueName());
-			// ADD THE CLIENT TO THE LOBBY
-			_channels.front().joinChannel(msg->getSender(), "");
+			_memoryStats.idleClients++;
+			_memoryStats.idleBytes += usage.object + usage.strings + usage.buffers + usage.channels +
+				memberships + indexBytes[&*it];
 		}
 	}
-	else
-		msg->getSender()->sendMessage(ERR_NEEDMOREPARAMS, "USER :Not enough parameters");
 }
 
-void	Server::who	(Message *msg)
+// What the cap is checked against: the pool (clients, buffers, nodes), the
+// big blocks, the heap parts of the last scan, the history, the arena and
+// the filter
+size_t	Server::getMemoryTotal() const
 {
-	// FIRST CHECK IF CHANNEL
-	if(msg->getChannel())
-	{
-		msg->getChannel()->sendWhoMessage(msg->getSender());
-		return ;
-	}
+	size_t total = Pool::getBigBytes() + _memoryStats.strings + _memoryStats.index +
+		History::getMemoryUsed() + Arena::frame().getCapacity() + _filter.getMemoryUsed();
+
+	for (int i = 0; i < Pool::getClassCount(); ++i)
+		total += Pool::getClassStats(i).reserved;
+	return total;
 }
 
-void	Server::whois	(Message *msg)
+// Loop tracing
+// -----------------------------------------------------------------------------
+void	Server::toggleTrace()
 {
-	if (msg->getArg(0).empty())
-	{
-		msg->getSender()->sendMessage(ERR_NONICKNAMEGIVEN, ":No nickname given");
-		return ;
-	}
-	Client *whoIsClient = getClientByNick(msg->getArg(0));
-	if (!whoIsClient)
+	if (!Trace::_enabled)
 	{
-		msg->getSender()->sendMessage(ERR_NOSUCHNICK, msg->getArg(0) + " :No such nick/channel");
+		Trace::enable();
+		info("Tracing the loop (kill -USR1 again to write " + std::string(TRACE_FILE) + ")", CLR_GRN);
 		return ;
 	}
-
-	whoIsClient->sendWhoIsMsg(msg->getSender());
+	Trace::disable();
+	if (Trace::dump(TRACE_FILE))
+		info("Wrote " + to_string(Trace::getEventCount()) + " trace events to " + TRACE_FILE, CLR_GRN);
+	else
+		info("Could not write " + std::string(TRACE_FILE) + ": " + strerror(errno), CLR_RED);
 }
 
-/* 
-	receiver not found				ERR_NOSUCHNICK
-		inform sender about it
-	send msg to receiver
- */
-void	Server::privmsg(Message *msg)
+// Content filter
+// -----------------------------------------------------------------------------
+void	Server::reloadFilter()
 {
-	std::string recipientNick 	= msg->getArg(0);
-	std::string channelName 	= msg->getChannelName();
-
-	// IF CHANNEL AND RECEIPENT BOTH ARE GIVEN DON'T DO SHIT
-	if (!channelName.empty() && !recipientNick.empty())
-		return ;
-
-	// IF CHANNEL AND RECEIPENT BOTH ARE NOT GIVEN
-	if (channelName.empty() && recipientNick.empty())
-	{
-		msg->getSender()->sendMessage(ERR_NORECIPIENT, ":No recipient given (PRIVMSG)");
-		return ;
-	}
+	std::string	error;
 
-	// NO TEXT TO SEND
-	if (msg->getColon().empty())
+	if (!_filter.load(FILTER_FILE, error))
 	{
-		msg->getSender()->sendMessage(ERR_NOTEXTTOSEND, ":No text to send");
+		info("Filter not reloaded: " + error, CLR_RED);
 		return ;
 	}
+	info("Filter loaded: " + to_string(_filter.getPatternCount()) + " patterns, " +
+		to_string(_filter.getStateCount()) + " states", CLR_GRN);
+}
 
-	// CASE RECIPIENT
-	if (!recipientNick.empty())
+// In the background a child writes the snapshot of its copy-on-write view of
+// the channels, so the loop only pays for the fork. The child must not touch
+// anything shared (no logging, no sockets) and leaves with _exit.
+void	Server::saveSnapshot(bool background)
+{
+	if (_snapshotChild)
+		return ;	// the last one is still being written
+	if (background)
 	{
-		msg->setReceiver(getInstanceByName(_clients, recipientNick));
-		if (!msg->getReceiver())
+		pid_t pid = fork();
+		if (pid < 0)
 		{
-			msg->getSender()->sendMessage(ERR_NOSUCHNICK, recipientNick + " :No such nick");
+			Logger::log("Snapshot fork failed: " + std::string(strerror(errno)));
+			_snapshotStats.failed++;
 			return ;
 		}
+		if (pid > 0)
+		{
+			_snapshotChild = pid;
+			_snapshotStats.channels = _channels.size() - 1;
+			return ;
+		}
+	}
+
+	Snapshot			snapshot;
+	Snapshot::Record	record;
+	for (ChannelList::const_iterator it = _channels.begin(); it != _channels.end(); ++it)
+	{
+		if (it->isLobby())
+			continue ;
+		it->getSnapshot(record);
+		snapshot.add(record);
+	}
+	bool ok = snapshot.writeTo(SNAPSHOT_FILE);
+	if (background)
+		_exit(ok ? 0 : 1);
+	ok ? _snapshotStats.written++ : _snapshotStats.failed++;
+	_snapshotStats.channels = snapshot.getCount();
+	info("Wrote snapshot of " + to_string(snapshot.getCount()) + " channels", ok ? CLR_GRN : CLR_RED);
+}
+
+void	Server::reapSnapshotChild(bool wait)
+{
+	int	status;
+
+	if (!_snapshotChild || waitpid(_snapshotChild, &status, wait ? 0 : WNOHANG) <= 0)
+		return ;
+	_snapshotChild = 0;
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		_snapshotStats.written++;
+	else
+		_snapshotStats.failed++;
+	Logger::log("Snapshot child done (status " + to_string(status) + ")");
+}
+
+// Hot upgrade
+// -----------------------------------------------------------------------------
+// A forked child execs the binary on disk; this process sends it the listener,
+// the client sockets and the state over a socketpair and leaves without
+// closing anything, so the clients never see a disconnect. The links are not
+// handed over: they drop and the peers get linked again by the new process.
+void	Server::upgrade()
+{
+	info("[START] Upgrade to " + _execPath, CLR_YLW);
+	int	pair[2];
+	if (_execPath.empty() || socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0)
+	{
+		info("[FAIL] Upgrade: no socketpair", CLR_RED);
+		return ;
+	}
+	// A running snapshot child would be nobody's child anymore
+	reapSnapshotChild(true);
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		close(pair[0]);
+		close(pair[1]);
+		info("[FAIL] Upgrade: fork failed: " + std::string(strerror(errno)), CLR_RED);
+		return ;
+	}
+	if (pid == 0)
+	{
+		// The sockets arrive as SCM_RIGHTS; inherited copies would keep the
+		// connections open after the new process closed them
+		close(pair[0]);
+		close(_socket);
+		for (ClientList::const_iterator it = _clients.begin(); it != _clients.end(); ++it)
+			close(it->getSocketFd());
+		std::vector<char *>	argv;
+		for (size_t i = 0; i < _execArgs.size(); ++i)
+			argv.push_back(const_cast<char *>(_execArgs[i].c_str()));
+		argv.push_back(NULL);
+		setenv(UPGRADE_ENV, to_string(pair[1]).c_str(), 1);
+		execv(_execPath.c_str(), &argv[0]);
+		_exit(127);
+	}
+	close(pair[1]);
+
+	Upgrade	state;
+	writeUpgradeState(state);
+	struct timeval	timeout = {UPGRADE_TIMEOUT_MS / 1000, 0};
+	setsockopt(pair[0], SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	bool ok = state.sendTo(pair[0]) && Upgrade::waitForAck(pair[0]);
+	close(pair[0]);
+	if (!ok)
+	{
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		info("[FAIL] Upgrade: the new binary didn't take over", CLR_RED);
+		return ;
+	}
+	info("[>DONE] Upgrade: pid " + to_string(pid) + " took over", CLR_GRN);
+	Logger::close();
+	_exit(0);
+}
+
+// Listener | channels (as snapshot) | clients | members of the channels
+void	Server::writeUpgradeState(Upgrade &state) const
+{
+	state.putU32(state.addFd(_socket));
+
+	Snapshot			snapshot;
+	Snapshot::Record	record;
+	for (ChannelList::const_iterator it = _channels.begin(); it != _channels.end(); ++it)
+	{
+		if (it->isLobby())
+			continue ;
+		it->getSnapshot(record);
+		snapshot.add(record);
+	}
+	state.putString(snapshot.getData());
+
+	// Clients are referenced by their position in this list
+	std::map<const Client *, uint32_t>	index;
+	for (ClientList::const_iterator it = _clients.begin(); it != _clients.end(); ++it)
+	{
+		if (!it->isServerLink() && !it->isMarkedForDisconnect())
+		{
+			uint32_t i = index.size();
+			index[&(*it)] = i;
+		}
+	}
+	state.putU32(index.size());
+	for (ClientList::const_iterator it = _clients.begin(); it != _clients.end(); ++it)
+	{
+		if (index.find(&(*it)) == index.end())
+			continue ;
+		struct sockaddr_storage	peer = it->getPeerAddress();
+		state.putU32(state.addFd(it->getSocketFd()));
+		state.putBytes(&peer, sizeof(peer));
+		state.putU32(it->isAuthenticated());
+		state.putU32(it->isPingPending());
+		state.putString(it->getUniqueName());
+		state.putString(it->getUsername());
+		state.putString(it->getFullname());
+		state.putString(it->getHostname());
+		state.putString(it->getPendingInput());
+		state.putString(it->getPendingOutput());
+	}
+
+	state.putU32(_channels.size());
+	for (ChannelList::const_iterator it = _channels.begin(); it != _channels.end(); ++it)
+	{
+		const ClientStateMap	&members = it->getMembers();
+		uint32_t				count = 0;
+		for (ClientStateMap::const_iterator m = members.begin(); m != members.end(); ++m)
+			count += index.count(m->first);
+		state.putString(it->getUniqueName());
+		state.putU32(count);
+		for (ClientStateMap::const_iterator m = members.begin(); m != members.end(); ++m)
+		{
+			if (!index.count(m->first))
+				continue ;
+			state.putU32(index[m->first]);
+			state.putU32(m->second);
+		}
+	}
+
+	// Caps of the clients, in the order of the clients above (at the end, as
+	// older binaries don't know them)
+	for (ClientList::const_iterator it = _clients.begin(); it != _clients.end(); ++it)
+	{
+		if (index.find(&(*it)) == index.end())
+			continue ;
+		state.putU32(it->getCaps());
+		state.putU32(it->isNegotiatingCaps());
+	}
+}
+
+// Only once this process owns the port: another one in the same directory
+// which didn't get it may not take the files of the running one
+void	Server::removeStaleHistory()
+{
+	size_t removed = History::removeSegments();
+	if (removed)
+		info("Removed " + to_string(removed) + " history segments of the last run", CLR_BLU);
+}
+
+// Started with UPGRADE_ENV: instead of initNetwork() everything is taken over
+// from the old process, which leaves once it got the answer
+void	Server::resumeUpgrade(int sock)
+{
+	info("[START] Resume upgrade", CLR_YLW);
+	Upgrade	state;
+	bool	logging = Logger::isActive();
+
+	// Logging every channel would take longer than the whole upgrade
+	Logger::deactivateLogger();
+	bool ok = state.receiveFrom(sock) && readUpgradeState(state) && Upgrade::sendAck(sock);
+	if (logging)
+		Logger::activateLogger();
+	close(sock);
+	if (!ok)
+		throw ServerException("Upgrade failed: the state of the old process is broken");
+	info("Local IP Address:\t" + std::string(inet_ntoa(_address.sin_addr)), CLR_BLU);
+	info("Local port:\t\t" + to_string(ntohs(_address.sin_port)), CLR_BLU);
+	info("Took over " + to_string(_clients.size()) + " clients and " + to_string(_channels.size()) + " channels", CLR_GRN);
+	// (the old process is gone for good only now)
+	removeStaleHistory();
+
+	for (std::list<LinkPeer>::iterator it = _peers.begin(); it != _peers.end(); ++it)
+		connectLink(*it);
+	info("[>DONE] Resume upgrade", CLR_GRN);
+}
+
+bool	Server::readUpgradeState(Upgrade &state)
+{
+	uint32_t	listener;
+	std::string	data;
+
+	if (!state.getU32(listener) || (_socket = state.takeFd(listener)) < 0)
+		return false;
+	socklen_t len = sizeof(_address);
+	if (getsockname(_socket, (struct sockaddr *)&_address, &len) == -1)
+		return false;
+
+	// The channels of the old process replace the ones of the snapshot file
+	std::vector<Snapshot::Record>	records;
+	std::map<Atom, Channel *>		channels;
+	if (!state.getString(data) || !Snapshot::parse(data.data(), data.size(), records))
+		return false;
+	_channels.erase(++_channels.begin(), _channels.end());
+	channels[_channels.front().getAtom()] = &_channels.front();
+	for (size_t i = 0; i < records.size(); ++i)
+	{
+		_channels.push_back(Channel(records[i].name));
+		_channels.back().restore(records[i]);
+		channels[_channels.back().getAtom()] = &_channels.back();
+	}
+
+	uint32_t				count;
+	std::vector<Client *>	clients;
+	if (!state.getU32(count))
+		return false;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		uint32_t				fd, auth, pingPending;
+		struct sockaddr_storage	peer;
+		std::string				nick, user, fullname, host, input, output;
+
+		if (!state.getU32(fd) || !state.getBytes(&peer, sizeof(peer)) ||
+			!state.getU32(auth) || !state.getU32(pingPending) ||
+			!state.getString(nick) || !state.getString(user) ||
+			!state.getString(fullname) || !state.getString(host) ||
+			!state.getString(input) || !state.getString(output))
+			return false;
+		int sock = state.takeFd(fd);
+		if (sock < 0)
+			return false;
+		_clients.push_back(Client(sock));
+		Client	*client = &_clients.back();
+		client->setPeerAddress(peer);
+		client->setHostname(host);
+		client->setAuthenticated(auth);
+		if (!nick.empty())
+			client->setUniqueName(nick);
+		client->setUsername(user);
+		client->setFullname(fullname);
+		client->restoreBuffers(input, output);
+		client->setPingPending(pingPending);
+		// Lines which were read already run with the deferred ones
+		client->setThrottled(client->hasFullMessage());
+		_limiter.restore(ConnectionLimiter::keyOf(peer), monotonicMs());
+		if (!client->isRegistered())
+			_timers.arm(client->getLivenessTimer(), REGISTER_TIMEOUT, client);
+		else
+			_timers.arm(client->getLivenessTimer(), pingPending ? PONG_TIMEOUT : PING_IDLE, client);
+		if (client->isRegistered())
+			indexClient(client);
+		clients.push_back(client);
+	}
+
+	if (!state.getU32(count))
+		return false;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		std::string	name;
+		uint32_t	members, index, memberState;
+
+		if (!state.getString(name) || !state.getU32(members))
+			return false;
+		std::map<Atom, Channel *>::iterator channel = channels.find(Atom::find(name));
+		for (uint32_t m = 0; m < members; ++m)
+		{
+			if (!state.getU32(index) || !state.getU32(memberState) || index >= clients.size())
+				return false;
+			if (channel != channels.end())
+				channel->second->resumeMember(clients[index], memberState);
+		}
+	}
+
+	// An older binary didn't write the caps. A client in the middle of the
+	// negotiation was taken for registered above.
+	uint32_t	caps, negotiating;
+	for (size_t i = 0; i < clients.size() && state.getU32(caps) && state.getU32(negotiating); ++i)
+	{
+		clients[i]->setCaps(caps);
+		if (!negotiating)
+			continue ;
+		if (clients[i]->isRegistered())
+			unindexClient(clients[i]);
+		clients[i]->setNegotiatingCaps(true);
+		_timers.arm(clients[i]->getLivenessTimer(), REGISTER_TIMEOUT, clients[i]);
+	}
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+// Processing the Messages
+// -----------------------------------------------------------------------------
+// Processes the full messages of a client as long as its token bucket allows.
+// Lines which are too expensive right now stay in the input buffer
+void	Server::processInput(Client *sender)
+{
+	AllocScope	scope(ALLOC_PARSE);
+	std::string fullMsg;
+
+	while (!sender->isMarkedForDisconnect() && sender->hasFullMessage())
+	{
+		// Links are trusted (their lines are the ones of many users)
+		if (!sender->isServerLink() && !sender->consumeFloodTokens(getCommandCost(sender->peekCommand())))
+		{
+			_floodStats.deferredLines++;
+			if (!sender->isThrottled())
+			{
+				_floodStats.throttledClients++;
+				sender->setThrottled(true);
+				Logger::log("Flood control throttled client " + sender->getUniqueName());
+			}
+			// Deferring is not enough if the client keeps on sending
+			if (sender->getInputBacklog() > FLOOD_MAX_BACKLOG)
+			{
+				_floodStats.excessFloods++;
+				sender->sendMessage("ERROR :Closing Link: localhost (Excess Flood)");
+				sender->markForDisconnect("Excess Flood");
+			}
+			return ;
+		}
+		TraceSpan	framing("frame", sender->getSocketFd());
+		fullMsg = sender->getFullMessage();
+		framing.close();
+		// Skip empty lines (e.g. "\r\n" keep alives)
+		if (fullMsg.find_first_not_of(" \t\r") == std::string::npos)
+			continue ;
+		_ioStats.lines++;
+		Logger::log("start processing msg from " + sender->getUniqueName() + " -> " + fullMsg);
+		if (sender->isServerLink() || (!sender->isRegistered() && fullMsg.compare(0, 7, "SERVER ") == 0))
+		{
+			processLinkLine(sender, fullMsg);
+			continue ;
+		}
+		std::string	nickname = sender->getUniqueName();
+		bool		wasRegistered = sender->isRegistered();
+		_lineFiltered = false;
+		processMessage(sender, fullMsg);
+		if (!_lineFiltered)
+			propagateMessage(sender, nickname, wasRegistered, fullMsg);
+		info ("DONE handling NORMAL msg from fd: " + to_string(sender->getSocketFd()), CLR_ORN);
+	}
+	sender->setThrottled(false);
+}
+
+void	Server::processDeferredInput()
+{
+	for (ClientList::iterator it = _clients.begin(); it != _clients.end(); ++it)
+	{
+		if (it->isThrottled())
+			processInput(&(*it));
+	}
+}
+
+int	Server::getCommandCost(const std::string &cmd) const
+{
+	std::map<std::string, int>::const_iterator it = _cmdCosts.find(cmd);
+	if (it == _cmdCosts.end())
+		return 1;
+	return it->second;
+}
+
+void	Server::processMessage(Client *sender, const std::string &ircMessage)
+{
+	// Parse the IRC Message
+	TraceSpan	parsing("parse", sender->getSocketFd());
+	Message     msg(sender, ircMessage);
+	parsing.close();
+	
+	// The scan of the line checked the channel names, the args, the control
+	// bytes and the encoding already
+	const LineScan	&scan = msg.getScan();
+	switch (scan.getVerdict())
+	{
+		case LineScan::LINE_OK:
+			break ;
+		case LineScan::LINE_BAD_CHANNEL:
+			msg.getSender()->sendMessage(ERR_NOSUCHCHANNEL, ircMessage.substr(scan.getBadStart(), scan.getBadLength()) +
+				" :channelname contains invalid characters");
+			return ;
+		case LineScan::LINE_ENCODING:
+			msg.getSender()->sendMessage(":localhost NOTICE " + msg.getSender()->getUniqueName() + " :Your message is not valid UTF-8 and was not delivered.");
+			return ;
+		default:
+			msg.getSender()->sendMessage(":localhost NOTICE " + msg.getSender()->getUniqueName() + " :Your message contains invalid characters and was not delivered.");
+			return ;
+	}
+	
+	//Execute IRC Message
+	AllocScope	dispatching(ALLOC_DISPATCH);
+	//	1. Check if CLIENT is loggedin
+	if (!isLoggedIn(&msg))
+		return ;
+	
+	//	2. Execute normal commands
+	//		3.1. Find the channel if there is  channelname in the msg
+	msg.setChannel(getInstanceByName(_channels, msg.getChannelName()));
+	
+	// 		3.2 Process the msg aka call the right function
+	chooseCommand(&msg);
+}
+
+bool	Server::isLoggedIn(Message *msg)
+{
+	if (!msg->getSender())
+		return false;
+
+	// CAP COMES BEFORE EVERYTHING (AND HOLDS THE REGISTRATION BACK)
+	if (msg->getCmd() == "CAP" && !msg->getSender()->isRegistered())
+	{
+		cap(msg);
+		return false;
+	}
+
+	// CHECK IF PASSWORD WAS PROVIDED
+	if(!msg->getSender()->isAuthenticated())
+	{
+		if (msg->getCmd() == "PASS")
+		{
+			pass(msg);
+			return false;
+		}
+		else
+		{
+			msg->getSender()->sendMessage(ERR_NOTREGISTERED, ":You have not provided the correct password (this is the first thing u have to do!)");
+			return false;
+		}
+	}
+
+	if (msg->getSender()->isRegistered())
+		return true;
+	
+	//	1. Check if NICK is set
+	if (msg->getCmd() == "NICK")
+		nick(msg);
+	else if (msg->getCmd() == "USER")
+		user(msg);
+	else
+		msg->getSender()->sendMessage(ERR_NOTREGISTERED, ":You have not registered");
+	return false;
+}
+
+void	Server::chooseCommand(Message *msg)
+{
+	std::string cmd = msg->getCmd();
+	if (cmd.empty())
+		return ; // this should not happen by design
+
+	for (std::map<std::string, CommandFunction>::iterator it = _cmds.begin(); it != _cmds.end(); ++it)
+	{
+		if (cmd == it->first)
+		{
+			TraceSpan	span(it->first.c_str(), msg->getSender()->getSocketFd());
+			(this->*(it->second))(msg);
+			return ;
+		}
+	}
+	// :10.11.3.6 421 anshovah_ PRIMSG :Unknown command
+	msg->getSender()->sendMessage(ERR_UNKNOWNCOMMAND, msg->getCmd() + " :Unknown command");
+}
+
+// The registration burst is the same for everybody except for the nick in
+// front, so the text after it is rendered once at startup
+void	Server::buildBurst()
+{
+	char		created[64];
+	std::time_t	now = std::time(0);
+
+	std::strftime(created, sizeof(created), "%a %b %d %Y at %H:%M:%S UTC", std::gmtime(&now));
+	_yourHost = ":Your host is " + _serverName + ", running ircserv";
+	_created = ":This server was created " + std::string(created);
+	_myInfo = _serverName + " ircserv o beIiklot";
+	_isupport = "CHANTYPES=# PREFIX=(o)@ CHANMODES=beI,k,l,it EXCEPTS INVEX MAXLIST=b:" +
+		to_string(MASKLIST_MAX) + ",e:" + to_string(MASKLIST_MAX) + ",I:" + to_string(MASKLIST_MAX) + " TARGMAX=PRIVMSG:" +
+		to_string(TARGET_MAX) + ",JOIN:" + to_string(TARGET_MAX) + ",PART:" + to_string(TARGET_MAX) +
+		",KICK:" + to_string(TARGET_MAX) + " MODES=" + to_string(MODES_MAX) + " ELIST=MNU SAFELIST CHATHISTORY=" + to_string(HISTORY_QUERY_MAX) +
+		" :are supported by this server";
+}
+
+// Registration is done (NICK and USER can come in any order)
+void	Server::sendWelcome(Client *client)
+{
+	const std::string	&nick = client->getUniqueName();
+
+	//:luna.AfterNET.Org 001 ash_ :Welcome to the FINISHERS' IRC Network, ash_
+	client->sendReply(Reply(RPL_WELCOME, nick) << ":Welcome to " PROMT ", " << nick);
+	client->sendReply(Reply(RPL_YOURHOST, nick) << _yourHost);
+	client->sendReply(Reply(RPL_CREATED, nick) << _created);
+	client->sendReply(Reply(RPL_MYINFO, nick) << _myInfo);
+	client->sendReply(Reply(RPL_ISUPPORT, nick) << _isupport);
+	indexClient(client);
+	// ADD THE CLIENT TO THE LOBBY
+	_channels.front().joinChannel(client, "");
+}
+
+// Targets past TARGET_MAX are dropped with one ERR_TOOMANYTARGETS
+bool	Server::checkTargetCount(Client *sender, const std::vector<std::string> &targets, size_t index)
+{
+	if (index < TARGET_MAX)
+		return true;
+	if (index == TARGET_MAX)
+		sender->sendMessage(ERR_TOOMANYTARGETS, targets[index] +
+			" :Too many targets. Only " + to_string(TARGET_MAX) + " processed");
+	return false;
+}
+
+bool	Server::isValidChannelName(const std::string &name)
+{
+	return name.size() >= 2 && name[0] == '#' && name.find_first_of("'\":\\,") == std::string::npos;
+}
+
+//PASS
+void	Server::pass(Message *msg)
+{
+	// CHECK IF USER ALREADY LOGGED IN
+	if (msg->getSender()->isAuthenticated())
+	{
+		msg->getSender()->sendMessage(ERR_ALREADYREGISTRED, msg->getSender()->getUniqueName() + " :You may not reregister");
+		return ;
+	}
+	if (msg->getArg(0).empty())
+	{
+		msg->getSender()->sendMessage(ERR_NEEDMOREPARAMS, "PASS :Not enough parameters");
+		return ;
+	}
+	if (msg->getArg(0) == _password)
+	{
+		msg->getSender()->setAuthenticated(true);
+		msg->getSender()->logClient();
+	}
+}
+
+// /NICK
+void	Server::nick(Message *msg)
+{	
+	std::string oldNickname = msg->getSender()->getUniqueName();
+	std::string newNickname = msg->getArg(0);
+	Client		*holder = getClientByNick(newNickname);	// same nick casefolded (on any server)
+
+	if (oldNickname.empty())
+		oldNickname = newNickname;
+
+	if (newNickname.empty())
+		msg->getSender()->sendMessage(ERR_NONICKNAMEGIVEN, ":No nickname given");
+	else if (holder && holder != msg->getSender())
+		msg->getSender()->sendMessage(ERR_NICKNAMEINUSE, oldNickname + " " + newNickname + " :Nickname is already in use");
+	else
+	{
+		// (A USER WHICH ISN'T REGISTERED YET ISN'T IN THE WHO INDEX)
+		bool	indexed = msg->getSender()->isRegistered();
+		if (indexed)
+			unindexClient(msg->getSender());
+		msg->getSender()->setUniqueName(newNickname);
+		dropInvites(msg->getSender());
+		if (indexed)
+			indexClient(msg->getSender());
 		std::string ircMessage = 
-			":" + msg->getSender()->getUniqueName() + "!" +
+			":" + oldNickname + "!" +
 			msg->getSender()->getUsername() +
-			"@localhost PRIVMSG " +
-			recipientNick +
-			" :" +
-			msg->getColon();
-		msg->getReceiver()->sendMessage(ircMessage);
+			"@localhost NICK :" +
+			newNickname;
+		// NAMES and WHO are built from the members themselves, so the
+		// neighbours' view is right as soon as they got the NICK
+		sendToNeighbours(msg->getSender(), ircMessage, true);
+
+		// CHECK IF NEED tO SEND A WELCOME MSG NOW
+		if (!indexed && msg->getSender()->isRegistered())
+			sendWelcome(msg->getSender());
+	}
+}
+
+void	Server::user(Message *msg)
+{
+	std::string oldUsername = msg->getSender()->getUsername();
+	std::string newUsername = msg->getArg(0);
+	
+	// CAN'T RE-REGISTER!
+	if(!oldUsername.empty())
+	{
+		msg->getSender()->sendMessage(ERR_ALREADYREGISTRED, msg->getSender()->getUniqueName() + " :You may not reregister");
+		return ;
+	}
+
+	if (!msg->getArg(0).empty() && !msg->getArg(1).empty() &&
+		!msg->getArg(2).empty() && !msg->getColon().empty())
+	{
+		msg->getSender()->setUsername(msg->getArg(0));
+		msg->getSender()->setFullname(msg->getColon());
+		// CHECK IF NEED tO SEND A WELCOME MSG NOW
+		if (msg->getSender()->isRegistered())
+			sendWelcome(msg->getSender());
+	}
+	else
+		msg->getSender()->sendMessage(ERR_NEEDMOREPARAMS, "USER :Not enough parameters");
+}
+
+// WHO #<channel> lists the members, WHO <mask> everybody whose nick, user,
+// host or real name matches. Only the range of the index which starts with
+// the literal start of the mask is looked at, and the replies go out one by
+// one while it's walked.
+void	Server::who	(Message *msg)
+{
+	Client	*sender = msg->getSender();
+
+	// FIRST CHECK IF CHANNEL
+	if(msg->getChannel())
+	{
+		msg->getChannel()->sendWhoMessage(sender);
+		return ;
+	}
+
+	std::string	mask = msg->getChannelName().empty() ? msg->getArg(0) : msg->getChannelName();
+	if (mask.empty() || mask == "0")
+		mask = "*";
+	Glob				glob(mask);
+	const std::string	&prefix = glob.getPrefix();
+	size_t				found = 0;
+
+	// A USER CAN BE IN THE RANGE WITH MORE THAN ONE FIELD
+	_epoch++;
+	std::multimap<std::string, Client *>::const_iterator it = _whoIndex.lower_bound(prefix);
+	for (; it != _whoIndex.end() && found < WHO_RESULTS_MAX; ++it)
+	{
+		if (it->first.compare(0, prefix.size(), prefix) != 0)
+			break ;
+		if (!it->second->markEpoch(_epoch) || !matchWho(glob, it->second))
+			continue ;
+		sendWhoReply(sender, it->second);
+		found++;
+	}
+	sender->sendReply(Reply(RPL_ENDOFWHO, sender->getUniqueName()) << mask << " :End of /WHO list.");
+}
+
+bool	Server::matchWho(const Glob &mask, const Client *client)
+{
+	return mask.match(client->getUniqueName()) || mask.match(client->getUsername()) ||
+		mask.match(client->getHostname()) || mask.match(client->getFullname());
+}
+
+// A user outside of a channel (the channel field is "*")
+void	Server::sendWhoReply(Client *receiver, const Client *client)
+{
+	receiver->sendReply(Reply(RPL_WHOREPLY, receiver->getUniqueName()) << "* " << client->getUsername() << ' ' <<
+		client->getHostname() << " * " << client->getUniqueName() << " H :0 " << client->getFullname());
+}
+
+// The keys are folded like the names, so the index is in the order a mask
+// compares in
+void	Server::indexClient(Client *client)
+{
+	_whoIndex.insert(std::make_pair(client->getAtom().folded(), client));
+	_whoIndex.insert(std::make_pair(Atom::fold(client->getUsername()), client));
+	_whoIndex.insert(std::make_pair(Atom::fold(client->getHostname()), client));
+	_whoIndex.insert(std::make_pair(Atom::fold(client->getFullname()), client));
+}
+
+// Has to be called before one of the fields changes
+void	Server::unindexClient(Client *client)
+{
+	const std::string	keys[] = {
+		client->getAtom().folded(),
+		Atom::fold(client->getUsername()),
+		Atom::fold(client->getHostname()),
+		Atom::fold(client->getFullname())
+	};
+
+	for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i)
+	{
+		std::multimap<std::string, Client *>::iterator it = _whoIndex.lower_bound(keys[i]);
+		for (; it != _whoIndex.end() && it->first == keys[i]; ++it)
+		{
+			if (it->second == client)
+			{
+				_whoIndex.erase(it);
+				break ;
+			}
+		}
+	}
+}
+
+void	Server::whois	(Message *msg)
+{
+	if (msg->getArg(0).empty())
+	{
+		msg->getSender()->sendMessage(ERR_NONICKNAMEGIVEN, ":No nickname given");
+		return ;
+	}
+	Client *whoIsClient = getClientByNick(msg->getArg(0));
+	if (!whoIsClient)
+	{
+		msg->getSender()->sendMessage(ERR_NOSUCHNICK, msg->getArg(0) + " :No such nick/channel");
+		return ;
+	}
+
+	whoIsClient->sendWhoIsMsg(msg->getSender());
+}
+
+/* 
+	receiver not found				ERR_NOSUCHNICK
+		inform sender about it
+	send msg to receiver
+ */
+void	Server::privmsg(Message *msg)
+{
+	const std::vector<std::string>	&targets = msg->getTargets();
+
+	// IF NO RECEIPENT IS GIVEN
+	if (targets.empty())
+	{
+		msg->getSender()->sendMessage(ERR_NORECIPIENT, ":No recipient given (PRIVMSG)");
+		return ;
+	}
+
+	// NO TEXT TO SEND
+	if (msg->getColon().empty())
+	{
+		msg->getSender()->sendMessage(ERR_NOTEXTTOSEND, ":No text to send");
+		return ;
+	}
+
+	// The text is checked once for all targets (users of other servers were
+	// checked by their own server)
+	if (!msg->getSender()->isRemote())
+	{
+		SpamFilter::Action action = _filter.check(msg->getColon());
+		if (action != SpamFilter::ACTION_NONE)
+		{
+			_lineFiltered = true;
+			Logger::log("Filtered PRIVMSG of " + msg->getSender()->getUniqueName() + ": " + msg->getColon());
+			if (action == SpamFilter::ACTION_NOTICE)
+				msg->getSender()->sendMessage(":localhost NOTICE " + msg->getSender()->getUniqueName() +
+					" :Your message was blocked by the content filter.");
+			else if (action == SpamFilter::ACTION_KILL)
+			{
+				msg->getSender()->sendMessage("ERROR :Closing Link: localhost (Content filter)");
+				msg->getSender()->markForDisconnect("Content filter");
+			}
+			return ;
+		}
+	}
+
+	// The line is rendered once, only the target differs per delivery
+	std::string prefix =
+		":" + msg->getSender()->getUniqueName() + "!" +
+		msg->getSender()->getUsername() +
+		"@localhost PRIVMSG ";
+	std::string text = " :" + msg->getColon();
+	for (size_t i = 0; i < targets.size() && checkTargetCount(msg->getSender(), targets, i); ++i)
+	{
+		// CASE CHANNEl
+		if (targets[i][0] == '#')
+		{
+			Channel *channel = getInstanceByName(_channels, targets[i]);
+			if (!channel)
+				msg->getSender()->sendMessage(ERR_NOSUCHCHANNEL, targets[i] + " :No such channel");
+			else if (!channel->canSend(msg->getSender()))
+				msg->getSender()->sendMessage(ERR_CANNOTSENDTOCHAN, targets[i] + " :Cannot send to channel");
+			else
+			{
+				channel->sendMessageToClients(prefix + targets[i] + text, msg->getSender());
+				channel->addHistory(History::EVENT_PRIVMSG, msg->getSender(), msg->getColon());
+			}
+			continue ;
+		}
+		// CASE RECIPIENT
+		Client *receiver = getClientByNick(targets[i]);
+		if (!receiver)
+			msg->getSender()->sendMessage(ERR_NOSUCHNICK, targets[i] + " :No such nick");
+		else
+			receiver->sendMessage(prefix + targets[i] + text);
+	}
+}
+
+void	Server::join(Message *msg)
+{
+	// JOIN #<channel>{,#<channel>} [<key>{,<key>}]
+	const std::vector<std::string>	&targets = msg->getTargets();
+	std::vector<std::string>		keys = Message::splitList(msg->getParam(1));
+
+	// WITHOUT ARGS
+	if (targets.empty())
+	{
+		msg->getSender()->sendMessage(ERR_NEEDMOREPARAMS, "JOIN :Not enough parameter");
+		return ;
+	}
+
+	for (size_t i = 0; i < targets.size() && checkTargetCount(msg->getSender(), targets, i); ++i)
+	{
+		// NO HASHTAG
+		if (targets[i][0] != '#')
+		{
+			msg->getSender()->sendMessage(ERR_NOSUCHCHANNEL, targets[i] + " :Channel name has to start with '#'");
+			continue ;
+		}
+		if (!isValidChannelName(targets[i]))
+		{
+			msg->getSender()->sendMessage(ERR_NOSUCHCHANNEL, targets[i] + " :channelname contains invalid characters");
+			continue ;
+		}
+
+		// CHECK IF CHANNEL EXISTS
+		Channel *channel = getInstanceByName(_channels, targets[i]);
+		if (!channel)
+		{
+			createNewChannel(msg->getSender(), targets[i]);
+			continue ;
+		}
+
+		// LET THE CHANNEL DESIDE IF THE CLIENT CAN JOIN
+		channel->joinChannel(msg->getSender(), i < keys.size() ? keys[i] : "");
+	}
+}
+
+void	Server::invite(Message *msg)
+{
+	// INVITE <nick> <channel>
+	std::string guestNick 		= msg->getArg(0);
+	std::string channelName 	= msg->getChannelName();
+
+	// IF GUESTNICK IS NOT GIVEN DON'T DO SHIT
+	if (guestNick.empty())
+		return ;
+
+	// IF THE GUEST IS NOT ON THE SERVER
+	msg->setReceiver(getClientByNick(guestNick));
+	if (!msg->getReceiver())
+	{
+		msg->getSender()->sendMessage(ERR_NOSUCHNICK, guestNick + " :No such nick");
+		return ;
+	}
+
+	// IF CHANNEL NAME IS NOT PROVIDED 
+	if (channelName.empty())
+	{
+		msg->getSender()->sendMessage(ERR_NOSUCHCHANNEL, std::string(PROMT) + " :No such channel");
+		return ;
+	}
+
+	// IF CHANNEL DOES NOT EXIST
+	if (!msg->getChannel())
+	{
+		msg->getSender()->sendMessage(ERR_NOSUCHCHANNEL, channelName + " :No such channel");
+		return ;
+	}
+		
+	// CALL THE CHANNEL FUNCTION invite() AND LET IT DECIDE WHAT TO DO
+	msg->getChannel()->inviteToChannel(msg->getSender(), msg->getReceiver());
+}
+
+void	Server::topic(Message *msg)
+{
+	// TOPIC #<channelName> :<topic>
+	// TOPIC #<channelName>
+	
+	if (!msg->getChannel())
+		msg->getSender()->sendMessage(ERR_NOSUCHCHANNEL, msg->getChannelName() + " :No such channel");
+	msg->getChannel()->topicOfChannel(msg->getSender(), msg->getColon());
+}
+
+void	Server::mode(Message *msg)
+{
+	// MODE #<channelName> {[+|-]<modes> {<param>}}
+
+	// IF CHANNEL NAME IS NOT PROVIDED
+	if (msg->getChannelName().empty())
+	{
+		msg->getSender()->sendMessage(ERR_NEEDMOREPARAMS, "MODE :Not enough parameters");
+		return ;
+	}
+
+	// IF CHANNEL DOES NOT EXIST
+	if (!msg->getChannel())
+	{
+		msg->getSender()->sendMessage(ERR_NOSUCHCHANNEL, msg->getChannelName() + " :No such channel");
+		return ;
+	}
+
+	// THE PARAMETERS OF THE MODES FOLLOW THE CHANNEL AND THE MODE STRING
+	std::vector<std::string>	params;
+	for (size_t i = 2; !msg->getParam(i).empty(); i++)
+		params.push_back(msg->getParam(i));
+	if (!msg->getColon().empty())
+		params.push_back(msg->getColon());
+	msg->getChannel()->modeOfChannel(msg->getSender(), msg->getParam(1), params, this);
+}
+
+void	Server::kick(Message *msg)
+{
+	// KICK <channel>{,<channel>} <user>{,<user>} [:<reason>]
+	// One channel for all users or one channel per user
+	// (without a user param the text after the colon is the user)
+	const std::vector<std::string>	&channels = msg->getTargets();
+	bool							hasUsers = !msg->getParam(1).empty();
+	std::vector<std::string>		users = Message::splitList(hasUsers ? msg->getParam(1) : msg->getColon());
+	std::string						reason = hasUsers ? msg->getColon() : "";
+
+	// IF NO CHANNEL OR NO CLIENT NAME IS PROVIDED
+	if (channels.empty() || users.empty())
+	{
+		msg->getSender()->sendMessage(ERR_NEEDMOREPARAMS, "KICK :Not enough parameters");
+		return ;
+	}
+	if (channels.size() != 1 && channels.size() != users.size())
+	{
+		msg->getSender()->sendMessage(ERR_NEEDMOREPARAMS, "KICK :Not as many channels as users");
+		return ;
+	}
+
+	for (size_t i = 0; i < users.size() && checkTargetCount(msg->getSender(), users, i); ++i)
+	{
+		const std::string	&channelName = channels[channels.size() == 1 ? 0 : i];
+
+		// IF CHANNEL DOES NOT EXIST
+		Channel *channel = getInstanceByName(_channels, channelName);
+		if (!channel)
+		{
+			msg->getSender()->sendMessage(ERR_NOSUCHCHANNEL, channelName + " :No such channel");
+			continue ;
+		}
+
+		// IF TO BE KICKED CLIENT IS NOT ON THE SERVER
+		Client *kicked = getClientByNick(users[i]);
+		if (!kicked)
+		{
+			msg->getSender()->sendMessage(ERR_NOSUCHNICK, users[i] + " :No such nick");
+			continue ;
+		}
+
+		// KICK THE CLIENT
+		channel->kickFromChannel(msg->getSender(), kicked, reason);
+	}
+}
+
+void	Server::part(Message *msg)
+{
+	const std::vector<std::string>	&targets = msg->getTargets();
+
+	// IF CHANNEL NAME IS NOT PROVIDED
+	if (targets.empty())
+	{
+		msg->getSender()->sendMessage(ERR_NOSUCHCHANNEL, msg->getChannelName() + " :No such channel");
+		return ;
+	}
+	for (size_t i = 0; i < targets.size() && checkTargetCount(msg->getSender(), targets, i); ++i)
+	{
+		Channel *channel = getInstanceByName(_channels, targets[i]);
+		if (!channel)
+		{
+			msg->getSender()->sendMessage(ERR_NOSUCHCHANNEL, targets[i] + " :No such channel");
+			continue ;
+		}
+		channel->partChannel(msg->getSender(), msg->getColon());
+
+		// IF NO CLIENTS OR OPERATORS LEFT IN CHANNEL -> DELETE CHANNEL
+		if (!channel->isActive() && !channel->isLobby())
+		{
+			// DELETE CHANNEL. INFORM THE USERS
+			channel->sendMessageToClients("Channel " + targets[i] + " is dead! No Operators left!");
+		}
+	}
+}
+
+// CAP LS [302] | CAP LIST | CAP REQ :<caps> | CAP END
+// A REQ is acknowledged as a whole or not at all, "-<cap>" drops a cap. The
+// caps only change how the history is sent (see Channel::sendHistory).
+void	Server::cap(Message *msg)
+{
+	static const char		*names[] = {"batch", "server-time", "message-tags", "draft/chathistory"};
+	static const unsigned	bits[] = {CAP_BATCH, CAP_SERVER_TIME, CAP_MESSAGE_TAGS, CAP_CHATHISTORY};
+	static const size_t		count = sizeof(bits) / sizeof(bits[0]);
+	Client					*client = msg->getSender();
+	const std::string		&sub = msg->getArg(0);
+	std::string				prefix = ":localhost CAP " +
+		(client->getUniqueName().empty() ? std::string("*") : client->getUniqueName()) + " ";
+
+	if (sub == "LS" || sub == "LIST")
+	{
+		std::string	list;
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (sub == "LIST" && !client->hasCap(bits[i]))
+				continue ;
+			if (!list.empty())
+				list += " ";
+			list += names[i];
+		}
+		if (sub == "LS" && !client->isRegistered())
+			client->setNegotiatingCaps(true);
+		client->sendMessage(prefix + sub + " :" + list);
+	}
+	else if (sub == "REQ")
+	{
+		std::string			wanted = msg->getColon().empty() ? msg->getArg(1) : msg->getColon();
+		std::istringstream	iss(wanted);
+		std::string			name;
+		unsigned			caps = client->getCaps();
+		bool				known = !wanted.empty();
+		while (known && iss >> name)
+		{
+			bool	drop = (name[0] == '-');
+			size_t	i = 0;
+			while (i < count && name.compare(drop, std::string::npos, names[i]) != 0)
+				++i;
+			if (i == count)
+				known = false;
+			else if (drop)
+				caps &= ~bits[i];
+			else
+				caps |= bits[i];
+		}
+		if (!client->isRegistered())
+			client->setNegotiatingCaps(true);
+		if (known)
+			client->setCaps(caps);
+		client->sendMessage(prefix + (known ? "ACK" : "NAK") + " :" + wanted);
+	}
+	else if (sub == "END")
+	{
+		if (!client->isNegotiatingCaps())
+			return ;
+		client->setNegotiatingCaps(false);
+		if (client->isRegistered())
+			sendWelcome(client);
+	}
+	else
+		client->sendMessage(ERR_INVALIDCAPCMD, (sub.empty() ? std::string("*") : sub) + " :Invalid CAP command");
+}
+
+// PING <token>
+void	Server::ping(Message *msg)
+{
+	std::string token = msg->getArg(0);
+	if (token.empty())
+		token = msg->getColon();
+	if (token.empty())
+	{
+		msg->getSender()->sendMessage(ERR_NOORIGIN, ":No origin specified");
 		return ;
 	}
+	msg->getSender()->sendMessage(":localhost PONG localhost :" + token);
+}
+
+// PONG <token> (answer to our PING)
+void	Server::pong(Message *msg)
+{
+	msg->getSender()->setPingPending(false);
+}
+
+// The neighbours get the QUIT when the client is reaped (see sendQuit)
+void	Server::quit(Message *msg)
+{
+	std::string reason = msg->getColon().empty() ? "Client Quit" : "Quit: " + msg->getColon();
+
+	msg->getSender()->sendMessage("ERROR :Closing Link: localhost (" + reason + ")");
+	msg->getSender()->markForDisconnect(reason);
+}
+
+// LIST [<condition>{,<condition>}] [:<topic text>]
+// -----------------------------------------------------------------------------
+// Conditions: ">n" more than n users, "<n" less than n, "mask" the name
+// matches (one of the masks), "!mask" it doesn't. Nothing is rendered here:
+// the listing starts at the first channel and continueListings() adds to
+// the sendq of the client whenever it got small again, so even a huge
+// channel list neither blocks the loop nor sits in memory.
+void	Server::list(Message *msg)
+{
+	Client		*sender = msg->getSender();
+	Listing		listing;
+
+	cancelListing(sender);
+	listing.client = sender;
+	listing.next = _channels.begin();
+	listing.minUsers = 0;
+	listing.maxUsers = static_cast<size_t>(-1);
+	listing.topic = Atom::fold(msg->getColon());
+
+	std::vector<std::string>	conditions = Message::splitList(msg->getParam(0));
+	for (size_t i = 0; i < conditions.size(); ++i)
+	{
+		const std::string	&condition = conditions[i];
+		long				users = std::atol(condition.c_str() + 1);
+
+		if (condition[0] == '>')
+			listing.minUsers = users < 0 ? 0 : users + 1;
+		else if (condition[0] == '<')
+			listing.maxUsers = users <= 0 ? 0 : users - 1;
+		else if (condition[0] == '!')
+			listing.notMasks.push_back(Glob(condition.substr(1)));
+		else
+			listing.masks.push_back(Glob(condition));
+	}
+	sender->sendReply(Reply(RPL_LISTSTART, sender->getUniqueName()) << "Channel :Users  Name");
+	_listings.push_back(listing);
+}
+
+void	Server::continueListings()
+{
+	std::list<Listing>::iterator it = _listings.begin();
+	while (it != _listings.end())
+	{
+		if (it->client->isMarkedForDisconnect() || continueListing(*it))
+			it = _listings.erase(it);
+		else
+			++it;
+	}
+}
+
+// Returns true when the listing is done
+bool	Server::continueListing(Listing &listing)
+{
+	Client				*client = listing.client;
+	const std::string	&nick = client->getUniqueName();
+
+	for (size_t scanned = 0; listing.next != _channels.end(); ++scanned)
+	{
+		if (scanned == LIST_SCAN_MAX || client->isOutputBlocked() ||
+			client->getSendQueueSize() >= LIST_SENDQ_FILL)
+			return false;
+		const Channel	&channel = *listing.next++;
+		if (matchListing(listing, channel))
+			client->sendReply(Reply(RPL_LIST, nick) << channel.getUniqueName() << ' ' <<
+				channel.getMembers().size() << " :" << channel.getTopic());
+	}
+	client->sendReply(Reply(RPL_LISTEND, nick) << ":End of /LIST");
+	return true;
+}
+
+bool	Server::matchListing(const Listing &listing, const Channel &channel)
+{
+	size_t	users = channel.getMembers().size();
+
+	if (users < listing.minUsers || users > listing.maxUsers)
+		return false;
+	bool	named = listing.masks.empty();
+	for (size_t i = 0; !named && i < listing.masks.size(); ++i)
+		named = listing.masks[i].match(channel.getUniqueName());
+	for (size_t i = 0; named && i < listing.notMasks.size(); ++i)
+		named = !listing.notMasks[i].match(channel.getUniqueName());
+	if (!named)
+		return false;
+	if (listing.topic.empty())
+		return true;
+
+	// CASEFOLDED SEARCH FOR THE TEXT IN THE TOPIC
+	const std::string	&topic = channel.getTopic();
+	for (size_t start = 0; start + listing.topic.size() <= topic.size(); ++start)
+	{
+		size_t	i = 0;
+		while (i < listing.topic.size() && Atom::foldByte(topic[start + i]) == listing.topic[i])
+			i++;
+		if (i == listing.topic.size())
+			return true;
+	}
+	return false;
+}
 
-	// CASE CHANNEl
-	if (!channelName.empty())
+// A new LIST replaces the one the client still has running
+void	Server::cancelListing(const Client *client)
+{
+	for (std::list<Listing>::iterator it = _listings.begin(); it != _listings.end(); ++it)
 	{
-		if (!msg->getChannel())
+		if (it->client == client)
 		{
-			msg->getSender()->sendMessage(ERR_NOSUCHCHANNEL, channelName + " :No such channel");
+			_listings.erase(it);
 			return ;
 		}
-		std::string ircMessage = 
-			":" + msg->getSender()->getUniqueName() + "!" +
-			msg->getSender()->getUsername() +
-			"@localhost PRIVMSG " +
-			channelName +
-			" :" +
-			msg->getColon();
-		msg->getChannel()->sendMessageToClients(ircMessage, msg->getSender());
 	}
 }
 
-void	Server::join(Message *msg)
+// CHATHISTORY LATEST <channel> <* | msgid=<id>> <limit>	newest (after the id)
+// CHATHISTORY BEFORE <channel> msgid=<id> <limit>			newest before the id
+// CHATHISTORY AFTER <channel> msgid=<id> <limit>			oldest after the id
+void	Server::chathistory(Message *msg)
 {
-	std::string channelName = msg->getChannelName();
-	// JOIN #<channel>
-	
-	// WITHOUT ARGS
-	if (channelName.empty())
+	std::string	subCmd = msg->getParam(0);
+	std::string	reference = msg->getParam(2);
+	std::string	limit = msg->getParam(3);
+	uint64_t	id = 0;
+
+	if (reference.compare(0, 6, "msgid=") == 0 && reference.size() > 6 &&
+		reference.find_first_not_of("0123456789", 6) == std::string::npos)
+		std::istringstream(reference.substr(6)) >> id;
+	if ((subCmd != "LATEST" && subCmd != "BEFORE" && subCmd != "AFTER") ||
+		(!id && (reference != "*" || subCmd != "LATEST")) ||
+		limit.empty() || limit.find_first_not_of("0123456789") != std::string::npos)
 	{
-		// NO HASHTAG
-		if (!msg->getArg(0).empty())
-			msg->getSender()->sendMessage(ERR_NOSUCHCHANNEL, "JOIN :Channel name has to start with '#'");
-		else
-			msg->getSender()->sendMessage(ERR_NEEDMOREPARAMS, "JOIN :Not enough parameter");
+		msg->getSender()->sendMessage(ERR_NEEDMOREPARAMS, "CHATHISTORY :Not enough parameters");
 		return ;
 	}
-	
-	// CHECK IF CHANNEL EXISTS
-	if(!msg->getChannel())
+
+	Channel *channel = getInstanceByName(_channels, msg->getParam(1));
+	if (!channel)
 	{
-		if(!createNewChannel(msg))
-			return ; //Smth wrong we could find the channel but we also could create it
+		msg->getSender()->sendMessage(ERR_NOSUCHCHANNEL, msg->getParam(1) + " :No such channel");
 		return ;
 	}
-	
-	// LET THE CHANNEL DESIDE IF THE CLIENT CAN JOIN
-	msg->getChannel()->joinChannel(msg->getSender(), msg->getArg(0));
+	size_t count = intNoOverflow(limit) ? std::atoi(limit.c_str()) : HISTORY_QUERY_MAX;
+	if (count > HISTORY_QUERY_MAX)
+		count = HISTORY_QUERY_MAX;
+	uint64_t	none = static_cast<uint64_t>(-1);
+	if (subCmd == "LATEST")
+		channel->sendHistory(msg->getSender(), id, none, count, true);
+	else if (subCmd == "BEFORE")
+		channel->sendHistory(msg->getSender(), 0, id, count, true);
+	else
+		channel->sendHistory(msg->getSender(), id, none, count, false);
 }
 
-void	Server::invite(Message *msg)
+// STATS <letter>
+// 	f: flood control counters
+// 	t: liveness timers
+// 	i: connection limits per host
+// 	q: sendq
+// 	m: memory pools, arena, atoms and channel history
+// 	l: server links
+// 	p: loop phases (reads, flushes and processed lines)
+// 	s: channel snapshots
+void	Server::stats(Message *msg)
 {
-	// INVITE <nick> <channel>
-	std::string guestNick 		= msg->getArg(0);
-	std::string channelName 	= msg->getChannelName();
+	std::string letter = msg->getArg(0);
 
-	// IF GUESTNICK IS NOT GIVEN DON'T DO SHIT
-	if (guestNick.empty())
+	if (letter == "f")
+	{
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":flood throttled clients " + to_string(_floodStats.throttledClients));
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":flood deferred lines " + to_string(_floodStats.deferredLines));
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":flood excess disconnects " + to_string(_floodStats.excessFloods));
+	}
+	else if (letter == "t")
+	{
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":timers armed " + to_string(_timers.size()));
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":timers pings sent " + to_string(_timerStats.pingsSent));
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":timers ping timeouts " + to_string(_timerStats.pingTimeouts));
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":timers registration timeouts " + to_string(_timerStats.registerTimeouts));
+	}
+	else if (letter == "i")
+	{
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":hosts limit " + to_string(IP_MAX_CONNECTIONS) +
+			" connections, " + to_string(IP_CONNECT_BURST) + " connects + 1 per " + to_string(IP_CONNECT_RATE_MS) + "ms");
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":hosts tracked " + to_string(_limiter.getHostCount()) +
+			" table size " + to_string(_limiter.getCapacity()));
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":hosts rejected too many " + to_string(_limiter.getRejected(ConnectionLimiter::TOO_MANY_CONNECTIONS)));
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":hosts rejected too fast " + to_string(_limiter.getRejected(ConnectionLimiter::TOO_FAST)));
+	}
+	else if (letter == "p")
+	{
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":loop iterations " + to_string(_ioStats.iterations));
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":loop reads " + to_string(_ioStats.reads) +
+			" flushes " + to_string(_ioStats.flushes) + " lines " + to_string(_ioStats.lines));
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":loop io " + to_string(_ioStats.ioNs / 1000) +
+			"us core " + to_string(_ioStats.coreNs / 1000) + "us");
+	}
+	else if (letter == "s")
+	{
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":snapshot written " + to_string(_snapshotStats.written) +
+			" failed " + to_string(_snapshotStats.failed) + " channels " + to_string(_snapshotStats.channels) +
+			(_snapshotChild ? " (writing)" : ""));
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":snapshot loaded in " + to_string(_snapshotStats.loadMs) + "ms");
+	}
+	else if (letter == "l")
+	{
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":links server " + _serverName + " knows " + to_string(_servers.size()) +
+			" servers and " + to_string(_remoteClients.size()) + " remote users");
+		for (std::list<Client *>::const_iterator it = _links.begin(); it != _links.end(); ++it)
+		{
+			size_t users = 0;
+			for (ClientList::const_iterator user = _remoteClients.begin(); user != _remoteClients.end(); ++user)
+				if (user->getUplink() == *it)
+					users++;
+			msg->getSender()->sendMessage(RPL_STATSDEBUG, ":link " + (*it)->getLinkName() + " users " + to_string(users) +
+				" sendq " + to_string((*it)->getSendQueueSize()) + " peak " + to_string((*it)->getSendQueuePeak()));
+		}
+	}
+	else if (letter == "m")
+	{
+		size_t inUse = 0;
+		size_t reserved = 0;
+		for (int i = 0; i < Pool::getClassCount(); ++i)
+		{
+			Pool::ClassStats cls = Pool::getClassStats(i);
+			if (!cls.reserved)
+				continue ;
+			inUse += cls.inUse * cls.size;
+			reserved += cls.reserved;
+			msg->getSender()->sendMessage(RPL_STATSDEBUG, ":pool " + to_string(cls.size) + " used " + to_string(cls.inUse) +
+				" free " + to_string(cls.free) + " reserved " + to_string(cls.reserved));
+		}
+		// Fragmentation: reserved pool memory which isn't handed out
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":pool total used " + to_string(inUse) + " reserved " + to_string(reserved) +
+			" unused " + to_string(reserved ? (reserved - inUse) * 100 / reserved : 0) + "%");
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":pool big allocations " + to_string(Pool::getBigBytes()));
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":arena capacity " + to_string(Arena::frame().getCapacity()) +
+			" peak " + to_string(Arena::frame().getPeak()) + " resets " + to_string(Arena::frame().getResets()) +
+			" grows " + to_string(Arena::frame().getGrows()) + " trims " + to_string(Arena::frame().getTrims()));
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":atoms " + to_string(Atom::count()) +
+			" buckets " + to_string(Atom::bucketCount()));
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":history buffers " + to_string(History::getBufferCount()) +
+			" bytes " + to_string(History::getMemoryUsed()) + " of " + to_string(HISTORY_MEMORY_MAX) +
+			" spilled " + to_string(History::getSpilled()) + " dropped " + to_string(History::getDropped()));
+
+		// Per connection (counted again right now, without compacting)
+		scanMemory(false);
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":memory clients " + to_string(_memoryStats.clients) +
+			" object " + to_string(_memoryStats.object) + " strings " + to_string(_memoryStats.strings) +
+			" buffers " + to_string(_memoryStats.buffers) + " channels " + to_string(_memoryStats.channels) +
+			" memberships " + to_string(_memoryStats.memberships) + " index " + to_string(_memoryStats.index));
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":memory idle registered clients " + to_string(_memoryStats.idleClients) +
+			" bytes " + to_string(_memoryStats.idleBytes) + " per client " +
+			to_string(_memoryStats.idleClients ? _memoryStats.idleBytes / _memoryStats.idleClients : 0));
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":memory compacted " + to_string(_memoryStats.compacted) +
+			" total " + to_string(getMemoryTotal()) + " cap " + to_string(MEMORY_CAP) +
+			" refused " + to_string(_memoryStats.refused));
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":memory arena retained " + to_string(Arena::frame().getCapacity()) +
+			" of max " + to_string(ARENA_RETAIN_MAX));
+	}
+	else if (letter == "c")
+	{
+		const SpamFilter::Stats	&filter = _filter.getStats();
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":filter patterns " + to_string(_filter.getPatternCount()) +
+			" states " + to_string(_filter.getStateCount()) + " classes " + to_string(_filter.getClassCount()) +
+			" bytes " + to_string(_filter.getMemoryUsed()) + (_filter.usesSimd() ? " simd" : " table"));
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":filter checked " + to_string(filter.checked) +
+			" bytes " + to_string(filter.bytes) + " ns " + to_string(filter.nanoseconds) +
+			" avg " + to_string(filter.checked ? filter.nanoseconds / filter.checked : 0) + "ns");
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":filter dropped " + to_string(filter.hits[SpamFilter::ACTION_DROP]) +
+			" noticed " + to_string(filter.hits[SpamFilter::ACTION_NOTICE]) +
+			" killed " + to_string(filter.hits[SpamFilter::ACTION_KILL]));
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":filter loads " + to_string(filter.loads) +
+			" failed " + to_string(filter.failedLoads));
+	}
+	else if (letter == "a")
+	{
+		if (!AllocScope::isEnabled())
+			msg->getSender()->sendMessage(RPL_STATSDEBUG, ":allocations are only counted by the build of make alloc");
+		for (int i = 0; AllocScope::isEnabled() && i < ALLOC_SCOPES; ++i)
+		{
+			const AllocScope::Stats &scope = AllocScope::getStats(i);
+			msg->getSender()->sendMessage(RPL_STATSDEBUG, ":alloc " + std::string(AllocScope::getName(i)) +
+				" allocations " + to_string(scope.allocations) + " bytes " + to_string(scope.bytes) +
+				" frees " + to_string(scope.frees));
+		}
+	}
+	else if (letter == "q")
+	{
+		size_t	queued = 0;
+		size_t	peak = _sendqStats.peak;
+		int		paused = 0;
+		for (ClientList::iterator it = _clients.begin(); it != _clients.end(); ++it)
+		{
+			queued += it->getSendQueueSize();
+			if (it->getSendQueuePeak() > peak)
+				peak = it->getSendQueuePeak();
+			if (it->getSendQueueSize() > SENDQ_SOFT)
+				paused++;
+		}
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":sendq limit " + to_string(SENDQ_MAX) + " soft " + to_string(SENDQ_SOFT));
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":sendq queued bytes " + to_string(queued) + " peak " + to_string(peak));
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":sendq exceeded disconnects " + to_string(_sendqStats.exceeded));
+		msg->getSender()->sendMessage(RPL_STATSDEBUG, ":sendq clients not read from " + to_string(paused));
+		// The high-water mark of every client which ever had a backlog
+		for (ClientList::iterator it = _clients.begin(); it != _clients.end(); ++it)
+		{
+			if (it->getSendQueuePeak() == 0)
+				continue ;
+			msg->getSender()->sendMessage(RPL_STATSDEBUG, ":sendq " + it->getUniqueName() +
+				" queued " + to_string(it->getSendQueueSize()) + " peak " + to_string(it->getSendQueuePeak()));
+		}
+	}
+	msg->getSender()->sendMessage(RPL_ENDOFSTATS, (letter.empty() ? "*" : letter) + " :End of /STATS report");
+}
+
+// -----------------------------------------------------------------------------
+// Server Links
+// -----------------------------------------------------------------------------
+// Servers form a tree: every server knows all others and the link each of
+// them is behind. A server which is already known can't be linked a second
+// time, so a cycle is refused when it would be closed. Lines are flooded to
+// all links except the one they came from, which makes them reach every
+// server exactly once.
+//
+// State changing cmds of users are replayed on all servers (as if the
+// remote user sent them there), so every server has the same channels and
+// delivers to its own users. Remote users never get anything sent by their
+// Client object; their own server does that.
+//
+// 	SERVER <name> <password>			handshake (both directions)
+// 	SERVER <name>						a server behind the link
+// 	SQUIT <name>						a server behind the link is gone
+// 	NICK <nick> <user> <host> :<real>	a new user
+// 	SJOIN <#chan> <flags> <key> <limit> :<[@]nick ...>
+// 	STOPIC <#chan> <setter> <time> :<topic>
+// 	KILL <nick> :<reason>				nick collision: the nick is gone everywhere
+// 	:<nick> <cmd> ...					a cmd of a user (see _linkedCmds) or QUIT
+
+// Splits ":<prefix> <cmd> <params> :<trailing>" into the prefix, the line
+// without the prefix and its words (the trailing part is the last one)
+static void	splitLinkLine(const std::string &line, std::string &prefix, std::string &rest, std::vector<std::string> &params)
+{
+	size_t	pos = 0;
+	size_t	end = line.find_last_not_of("\r\n");
+
+	if (end == std::string::npos)
 		return ;
+	if (line[0] == ':')
+	{
+		pos = line.find(' ');
+		if (pos == std::string::npos)
+			return ;
+		prefix = line.substr(1, pos - 1);
+		pos = line.find_first_not_of(' ', pos);
+		if (pos == std::string::npos)
+			return ;
+	}
+	rest = line.substr(pos, end + 1 - pos);
+	while (pos <= end)
+	{
+		if (line[pos] == ':' && !params.empty())
+		{
+			params.push_back(line.substr(pos + 1, end - pos));
+			return ;
+		}
+		size_t next = line.find(' ', pos);
+		if (next == std::string::npos || next > end)
+			next = end + 1;
+		params.push_back(line.substr(pos, next - pos));
+		pos = line.find_first_not_of(' ', next);
+		if (pos == std::string::npos)
+			return ;
+	}
+}
 
-	// IF THE GUEST IS NOT ON THE SERVER
-	msg->setReceiver(getInstanceByName(_clients, guestNick));
-	if (!msg->getReceiver())
+// Outgoing link: the handshake starts as soon as the connection is there
+void	Server::connectLink(LinkPeer &peer)
+{
+	struct addrinfo	hints;
+	struct addrinfo	*result = NULL;
+
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(peer.host.c_str(), peer.port.c_str(), &hints, &result) != 0 || !result)
 	{
-		msg->getSender()->sendMessage(ERR_NOSUCHNICK, guestNick + " :No such nick");
+		Logger::log("Link to " + peer.host + ":" + peer.port + " failed: unknown host");
+		_timers.arm(peer.retry, LINK_RETRY, &peer);
 		return ;
 	}
-
-	// IF CHANNEL NAME IS NOT PROVIDED 
-	if (channelName.empty())
+	int fd = socket(result->ai_family, SOCK_STREAM, 0);
+	if (fd < 0 || fcntl(fd, F_SETFL, O_NONBLOCK) < 0 ||
+		(connect(fd, result->ai_addr, result->ai_addrlen) < 0 && errno != EINPROGRESS))
 	{
-		msg->getSender()->sendMessage(ERR_NOSUCHCHANNEL, std::string(PROMT) + " :No such channel");
+		Logger::log("Link to " + peer.host + ":" + peer.port + " failed: " + std::string(strerror(errno)));
+		if (fd >= 0)
+			close(fd);
+		freeaddrinfo(result);
+		_timers.arm(peer.retry, LINK_RETRY, &peer);
 		return ;
 	}
+	struct sockaddr_storage	address;
+	std::memset(&address, 0, sizeof(address));
+	std::memcpy(&address, result->ai_addr, result->ai_addrlen);
+	freeaddrinfo(result);
+
+	_clients.push_back(Client(fd));
+	Client &link = _clients.back();
+	link.setServerLink("");
+	link.setPeerAddress(address);
+	link.setHostname(peer.host);
+	_timers.arm(link.getLivenessTimer(), REGISTER_TIMEOUT, &link);
+	// Queued until the connection is established
+	link.sendMessage("SERVER " + _serverName + " " + _password);
+	peer.connection = &link;
+	info("Linking to " + peer.host + ":" + peer.port, CLR_BLU);
+}
 
-	// IF CHANNEL DOES NOT EXIST
-	if (!msg->getChannel())
+Server::LinkPeer	*Server::getPeerByTimer(const Timer *timer)
+{
+	for (std::list<LinkPeer>::iterator it = _peers.begin(); it != _peers.end(); ++it)
+		if (&it->retry == timer)
+			return &(*it);
+	return NULL;
+}
+
+Server::LinkPeer	*Server::getPeerByConnection(const Client *connection)
+{
+	for (std::list<LinkPeer>::iterator it = _peers.begin(); it != _peers.end(); ++it)
+		if (it->connection == connection)
+			return &(*it);
+	return NULL;
+}
+
+void	Server::processLinkLine(Client *link, const std::string &line)
+{
+	std::string					prefix;
+	std::string					rest;
+	std::vector<std::string>	params;
+
+	splitLinkLine(line, prefix, rest, params);
+	if (params.empty())
+		return ;
+	const std::string &cmd = params[0];
+	if (cmd == "SERVER" && params.size() >= 3)
+		return linkHandshake(link, params);
+	if (!link->isRegistered())
 	{
-		msg->getSender()->sendMessage(ERR_NOSUCHCHANNEL, channelName + " :No such channel");
+		link->sendMessage("ERROR :Closing Link: " + _serverName + " (Not registered)");
+		link->markForDisconnect("Link not registered");
 		return ;
 	}
-		
-	// CALL THE CHANNEL FUNCTION invite() AND LET IT DECIDE WHAT TO DO
-	msg->getChannel()->inviteToChannel(msg->getSender(), msg->getReceiver());
+	if (cmd == "PING")
+		link->sendMessage("PONG " + _serverName + " :" + params.back());
+	else if (cmd == "PONG")
+		link->setPingPending(false);
+	else if (cmd == "ERROR")
+		link->markForDisconnect("Link closed by " + link->getLinkName() + ": " + params.back());
+	else if (params.size() < 2)
+		Logger::log("Ignoring link line from " + link->getLinkName() + ": " + line);
+	else if (cmd == "SERVER")
+		introduceServer(link, params[1]);
+	else if (cmd == "SQUIT")
+		removeServer(link, params[1]);
+	else if (cmd == "KILL")
+		killClient(params[1], params.back(), link);
+	else if (cmd == "NICK" && prefix.empty())
+		introduceClient(link, params);
+	else if (cmd == "SJOIN")
+		burstChannel(params);
+	else if (cmd == "STOPIC")
+		burstTopic(params);
+	else if (!prefix.empty())
+		relayClientCommand(link, prefix, rest, params);
+	else
+		Logger::log("Ignoring link line from " + link->getLinkName() + ": " + line);
 }
 
-void	Server::topic(Message *msg)
+// SERVER <name> <password>
+// The side which accepted the connection answers with its own SERVER line
+void	Server::linkHandshake(Client *link, const std::vector<std::string> &params)
 {
-	// TOPIC #<channelName> :<topic>
-	// TOPIC #<channelName>
-	
-	if (!msg->getChannel())
-		msg->getSender()->sendMessage(ERR_NOSUCHCHANNEL, msg->getChannelName() + " :No such channel");
-	msg->getChannel()->topicOfChannel(msg->getSender(), msg->getColon());
+	const std::string &name = params[1];
+
+	if (link->isRegistered())
+		return ;
+	if (params[2] != _password)
+	{
+		link->sendMessage("ERROR :Closing Link: " + _serverName + " (Bad password)");
+		link->markForDisconnect("Link with bad password");
+		return ;
+	}
+	if (name == _serverName || _servers.count(name))
+	{
+		link->sendMessage("ERROR :Closing Link: " + _serverName + " (Server " + name + " already exists)");
+		link->markForDisconnect("Link to known server " + name);
+		return ;
+	}
+	bool incoming = !link->isServerLink();
+	link->setServerLink(name);
+	if (incoming)
+		link->sendMessage("SERVER " + _serverName + " " + _password);
+	propagate("SERVER " + name, NULL);
+	_servers[name] = link;
+	_links.push_back(link);
+	info("Linked with " + name, CLR_GRN);
+	sendBurst(link);
 }
 
-void	Server::mode(Message *msg)
+// Everything the other side doesn't know yet: the servers, the users and the
+// channels (members, modes and topic) of this side of the link
+void	Server::sendBurst(Client *link)
 {
-	// MODE #<channelName> flag
+	for (std::map<std::string, Client *>::const_iterator it = _servers.begin(); it != _servers.end(); ++it)
+		if (it->second != link)
+			link->sendMessage("SERVER " + it->first);
+	for (ClientList::const_iterator it = _clients.begin(); it != _clients.end(); ++it)
+		if (!it->isServerLink() && it->isRegistered() && !it->isMarkedForDisconnect())
+			link->sendMessage(getIntroduction(&(*it)));
+	for (ClientList::const_iterator it = _remoteClients.begin(); it != _remoteClients.end(); ++it)
+		if (it->getUplink() != link)
+			link->sendMessage(getIntroduction(&(*it)));
+	for (ChannelList::const_iterator it = _channels.begin(); it != _channels.end(); ++it)
+	{
+		std::string head = "SJOIN " + it->getUniqueName() + " " + it->getBurstModes() + " :";
+		std::string members = it->getClientList();
+		// The input buffer of the other side only takes short lines
+		while (!members.empty())
+		{
+			size_t cut = members.size();
+			if (cut > LINK_BURST_LINE)
+				cut = members.rfind(' ', LINK_BURST_LINE) + 1;
+			link->sendMessage(head + members.substr(0, cut));
+			members.erase(0, cut);
+		}
+		if (!it->getTopic().empty())
+			link->sendMessage("STOPIC " + it->getUniqueName() + " " + it->getTopicChange() + " :" + it->getTopic());
+	}
+}
 
-	// IF CHANNEL NAME IS NOT PROVIDED
-	if (msg->getChannelName().empty())
+// SERVER <name>
+// A server which is already known would close a cycle -> drop the link
+void	Server::introduceServer(Client *link, const std::string &name)
+{
+	if (name == _serverName || _servers.count(name))
 	{
-		msg->getSender()->sendMessage(ERR_NEEDMOREPARAMS, "MODE :Not enough parameters");
+		link->sendMessage("ERROR :Closing Link: " + _serverName + " (Loop: server " + name + " already exists)");
+		link->markForDisconnect("Link loop with " + name);
 		return ;
 	}
+	_servers[name] = link;
+	propagate("SERVER " + name, link);
+}
 
-	// IF CHANNEL DOES NOT EXIST
-	if (!msg->getChannel())
+// SQUIT <name>
+void	Server::removeServer(Client *link, const std::string &name)
+{
+	std::map<std::string, Client *>::iterator it = _servers.find(name);
+	if (it == _servers.end() || it->second != link)
+		return ;
+	_servers.erase(it);
+	propagate("SQUIT " + name, link);
+}
+
+// NICK <nick> <user> <host> :<real>
+// If the nick is already taken both users lose (there is no way to tell
+// which one was first)
+void	Server::introduceClient(Client *link, const std::vector<std::string> &params)
+{
+	if (params.size() < 5)
+		return ;
+	if (getClientByNick(params[1]))
 	{
-		msg->getSender()->sendMessage(ERR_NOSUCHCHANNEL, msg->getChannelName() + " :No such channel");
+		Logger::log("Nick collision of " + params[1] + " with a user of " + link->getLinkName());
+		killClient(params[1], "Nick collision", NULL);
+		return ;
+	}
+	_remoteClients.push_back(Client(-1));
+	Client &client = _remoteClients.back();
+	client.setUplink(link);
+	client.setAuthenticated(true);
+	client.setUniqueName(params[1]);
+	client.setUsername(params[2]);
+	client.setHostname(params[3]);
+	client.setFullname(params[4]);
+	indexClient(&client);
+	// Like every user the remote one starts in the lobby
+	_channels.front().joinChannel(&client, "");
+	propagate(getIntroduction(&client), link);
+}
+
+// SJOIN <#chan> <flags> <key> <limit> :<[@]nick ...>
+// A channel which exists on both sides keeps the modes of this side
+void	Server::burstChannel(const std::vector<std::string> &params)
+{
+	if (params.size() < 6 || params[1].size() < 2 || params[1][0] != '#')
 		return ;
+	Channel *channel = getInstanceByName(_channels, params[1]);
+	if (!channel)
+	{
+		_channels.push_back(Channel(params[1]));
+		channel = &_channels.back();
+		channel->applyBurstModes(params[2], params[3], std::atoi(params[4].c_str()));
+	}
+	std::istringstream	members(params[5]);
+	std::string			member;
+	while (members >> member)
+	{
+		bool op = member[0] == '@';
+		Client *client = getClientByNick(op ? member.substr(1) : member);
+		if (client)
+			channel->burstJoin(client, op);
 	}
+}
 
-	msg->getChannel()->modeOfChannel(msg->getSender(), msg->getArg(0), msg->getArg(1), this);
+// STOPIC <#chan> <setter> <time> :<topic>
+// A channel which already has a topic keeps it
+void	Server::burstTopic(const std::vector<std::string> &params)
+{
+	if (params.size() < 5)
+		return ;
+	Channel *channel = getInstanceByName(_channels, params[1]);
+	if (channel && channel->getTopic().empty())
+		channel->applyBurstTopic(params[4], params[2] + " " + params[3]);
 }
 
-void	Server::kick(Message *msg)
+// :<nick> <cmd> ...
+// The cmd is executed as if the remote user sent it to this server
+void	Server::relayClientCommand(Client *link, const std::string &prefix, const std::string &rest, const std::vector<std::string> &params)
 {
-	// IF CHANNEL DOES NOT EXIST
-	if (!msg->getChannel())
+	Client *sender = getClientByNick(prefix);
+	if (!sender || sender->getUplink() != link)
 	{
-		msg->getSender()->sendMessage(ERR_NOSUCHCHANNEL, msg->getChannelName() + " :No such channel");
+		Logger::log("Ignoring cmd of unknown user " + prefix + " from " + link->getLinkName() + ": " + rest);
 		return ;
 	}
-	
-	// IF NO CLIENT NAME IS PROVIDED
-	if (msg->getArg(0).empty() && msg->getColon().empty())
+	const std::string &cmd = params[0];
+	if (cmd == "QUIT")
 	{
-		msg->getSender()->sendMessage(ERR_NOSUCHCHANNEL, msg->getChannelName() + " :No such channel");
+		propagate(":" + prefix + " QUIT :" + params.back(), link);
+		removeRemoteClient(sender, params.back());
 		return ;
 	}
-	
-	// IF TO BE KICKED CLIENT IS NOT ON THE SERVER
-	if (!msg->getColon().empty())
+	if (cmd == "NICK")
+	{
+		Client *holder = getClientByNick(params[1]);
+		if (holder && holder != sender)
+		{
+			Logger::log("Nick collision of " + params[1] + " (renamed from " + prefix + ")");
+			killClient(params[1], "Nick collision", NULL);
+			killClient(prefix, "Nick collision", NULL);
+			return ;
+		}
+	}
+	if (_linkedCmds.count(cmd))
 	{
-		std::cout << "A" << msg->getColon()  <<"A\n";
-		msg->setReceiver(getInstanceByName(_clients, msg->getColon()));
+		processMessage(sender, rest);
+		propagateMessage(sender, prefix, true, rest);
 	}
-	else
-		msg->setReceiver(getInstanceByName(_clients, msg->getArg(0)));
-	if (!msg->getReceiver())
+}
+
+// KILL <nick> :<reason>
+void	Server::killClient(const std::string &nickname, const std::string &reason, Client *from)
+{
+	Client *client = getClientByNick(nickname);
+	if (!client || client->isMarkedForDisconnect())
+		return ;
+	propagate("KILL " + nickname + " :" + reason, from);
+	if (client->isRemote())
 	{
-		msg->getSender()->sendMessage(ERR_NOSUCHNICK, msg->getArg(0) + " :No such nick");
+		removeRemoteClient(client, "Killed (" + reason + ")");
 		return ;
 	}
+	client->sendMessage("ERROR :Closing Link: " + _serverName + " (Killed (" + reason + "))");
+	client->markForDisconnect("Killed (" + reason + ")");
+}
 
-	// KICK THE CLIENT
-	msg->getChannel()->kickFromChannel(msg->getSender(), msg->getReceiver(), msg->getColon());
+// The destructor of the client parts it from all its channels
+void	Server::removeRemoteClient(Client *client, const std::string &reason)
+{
+	for (ClientList::iterator it = _remoteClients.begin(); it != _remoteClients.end(); ++it)
+	{
+		if (&(*it) == client)
+		{
+			sendQuit(client, reason);
+			unindexClient(client);
+			_remoteClients.erase(it);
+			return ;
+		}
+	}
 }
 
-void	Server::part(Message *msg)
+// Everything behind a lost link is gone for the rest of the network too
+void	Server::linkLost(Client *link)
 {
-	// IF CHANNEL NAME IS NOT PROVIDED
-	if (msg->getChannelName().empty())
+	info("Lost link to " + link->getLinkName(), CLR_RED);
+	_links.remove(link);
+	std::map<std::string, Client *>::iterator server = _servers.begin();
+	while (server != _servers.end())
 	{
-		msg->getSender()->sendMessage(ERR_NOSUCHCHANNEL, msg->getChannelName() + " :No such channel");
+		if (server->second != link)
+		{
+			++server;
+			continue ;
+		}
+		propagate("SQUIT " + server->first, NULL);
+		_servers.erase(server++);
+	}
+	ClientList::iterator it = _remoteClients.begin();
+	while (it != _remoteClients.end())
+	{
+		if (it->getUplink() != link)
+		{
+			++it;
+			continue ;
+		}
+		propagate(":" + it->getUniqueName() + " QUIT :" + _serverName + " " + link->getLinkName(), NULL);
+		sendQuit(&(*it), _serverName + " " + link->getLinkName());
+		unindexClient(&(*it));
+		it = _remoteClients.erase(it);
+	}
+}
+
+// Sends a line to all links except the one it came from
+void	Server::propagate(const std::string &line, Client *except)
+{
+	AllocScope	scope(ALLOC_FANOUT);
+
+	for (std::list<Client *>::iterator it = _links.begin(); it != _links.end(); ++it)
+		if (*it != except)
+			(*it)->sendMessage(line);
+}
+
+// After a cmd of a user was executed here the rest of the network needs it:
+//	- a user who just finished the registration gets introduced
+//	- the cmds of _linkedCmds are replayed (with the nick before the cmd)
+//	- a PRIVMSG to a user only goes towards the server of that user
+void	Server::propagateMessage(Client *sender, const std::string &nickname, bool wasRegistered, const std::string &ircMessage)
+{
+	if (_links.empty() || sender->isMarkedForDisconnect())
+		return ;
+	if (!wasRegistered)
+	{
+		if (sender->isRegistered())
+			propagate(getIntroduction(sender), NULL);
 		return ;
 	}
-	msg->getChannel()->partChannel(msg->getSender(), msg->getColon());
 
-	// IF NO CLIENTS OR OPERATORS LEFT IN CHANNEL -> DELETE CHANNEL
-	if (!msg->getChannel()->isActive() && msg->getChannel()->getUniqueName() != "#lobby")
+	std::string	message = ircMessage.substr(0, ircMessage.find_last_not_of("\r\n") + 1);
+	size_t		cmdEnd = message.find(' ');
+	std::string	cmd = message.substr(0, cmdEnd);
+	if (!_linkedCmds.count(cmd))
+		return ;
+	if (cmd == "PRIVMSG")
 	{
-		// DELETE CHANNEL. INFORM THE USERS
-		msg->getChannel()->sendMessageToClients("Channel " + msg->getChannelName() + " is dead! No Operators left!");
-	}	
+		propagatePrivmsg(sender, nickname, message, cmdEnd);
+		return ;
+	}
+	propagate(":" + nickname + " " + message, sender->getUplink());
+}
+
+// PRIVMSG <target>{,<target>} :<text>
+// Every target gets its own line: a channel goes to all links (once, however
+// often it's listed), a user only to the link it is behind. No server gets a
+// list with names it doesn't know.
+void	Server::propagatePrivmsg(Client *sender, const std::string &nickname, const std::string &message, size_t cmdEnd)
+{
+	size_t	targetStart = message.find_first_not_of(' ', cmdEnd);
+	if (cmdEnd == std::string::npos || targetStart == std::string::npos || message[targetStart] == ':')
+		return ;
+	size_t						targetEnd = message.find(' ', targetStart);
+	std::string					rest = targetEnd == std::string::npos ? "" : message.substr(targetEnd);
+	std::vector<std::string>	targets = Message::splitList(message.substr(targetStart, targetEnd - targetStart));
+	std::set<std::string>		sent;	// casefolded
+
+	for (size_t i = 0; i < targets.size() && i < TARGET_MAX; ++i)
+	{
+		std::string	line = ":" + nickname + " PRIVMSG " + targets[i] + rest;
+		if (!sent.insert(Atom::fold(targets[i])).second)
+			continue ;
+		if (targets[i][0] == '#')
+		{
+			propagate(line, sender->getUplink());
+			continue ;
+		}
+		Client *receiver = getClientByNick(targets[i]);
+		if (receiver && receiver->isRemote() && receiver->getUplink() != sender->getUplink())
+			receiver->getUplink()->sendMessage(line);
+	}
+}
+
+// NICK <nick> <user> <host> :<real>
+std::string	Server::getIntroduction(const Client *client) const
+{
+	return "NICK " + client->getUniqueName() + " " + client->getUsername() + " " +
+		client->getHostname() + " :" + client->getFullname();
 }
 
 // -----------------------------------------------------------------------------
@@ -701,7 +2763,7 @@ Client	*Server::getClientByFd(int fd)
 		return NULL;
 	}
 
-	for (std::list<Client>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+	for (ClientList::iterator it = _clients.begin(); it != _clients.end(); ++it)
 	{
 		if (it->getSocketFd() == fd)
 		{
@@ -715,12 +2777,10 @@ Client	*Server::getClientByFd(int fd)
 
 Client	*Server::getClientByNick(const std::string &nickname)
 {
-	for (std::list<Client>::iterator it = _clients.begin(); it != _clients.end(); ++it)
-	{
-		if (it->getUniqueName() == nickname)
-			return &(*it);
-	}
-	return NULL;
+	Client *client = getInstanceByName(_clients, nickname);
+	if (!client)
+		client = getInstanceByName(_remoteClients, nickname);
+	return client;
 }
 
 // -----------------------------------------------------------------------------
@@ -738,13 +2798,13 @@ void	Server::removeChannel(Channel *channel)
 
 // If there is no channel this function
 // create it and returns a pointer to the new channel
-Channel	*Server::createNewChannel(Message *msg)
+Channel	*Server::createNewChannel(Client *creator, const std::string &name)
 {
-	Logger::log("Trying to create a new channel: " + msg->getChannelName());
-	if (isNameAvailable(_channels, msg->getChannelName()))
+	Logger::log("Trying to create a new channel: " + name);
+	if (isNameAvailable(_channels, name))
 	{
-		_channels.push_back(Channel(msg->getChannelName()));
-		_channels.back().iniChannel(msg->getSender());
+		_channels.push_back(Channel(name));
+		_channels.back().iniChannel(creator);
 		Logger::log("Server created new channel named: " + _channels.back().getUniqueName());
 		return &(_channels.back());
 	}
@@ -752,22 +2812,39 @@ Channel	*Server::createNewChannel(Message *msg)
 }
 
 // -----------------------------------------------------------------------------
-// Static Signal handling (for exit with CTRL C)
+// Static Signal handling (for exit with CTRL C and the hot upgrade)
 // -----------------------------------------------------------------------------
 volatile sig_atomic_t	Server::_keepRunning = 1;
+volatile sig_atomic_t	Server::_upgradeRequested = 0;
+volatile sig_atomic_t	Server::_reloadRequested = 0;
+volatile sig_atomic_t	Server::_traceRequested = 0;
 
 void	Server::setupSignalHandling()
 {
 	// All signals in an ugly way :D
 	for (int i = 1; i < 32; i++)
 	{
-		if (i != SIGKILL && i != SIGSTOP)
+		// SIGCHLD: the snapshot child is reaped by the loop
+		if (i != SIGKILL && i != SIGSTOP && i != SIGCHLD)
 			signal(i, Server::sigIntHandler);
 	}
 }
 
 void	Server::sigIntHandler(int sig)
 {
+	if (sig == SIGUSR2)
+	{
+		_upgradeRequested = 1;	// done by the loop (poll returns with EINTR)
+		return;
+	}
+	if (sig == SIGHUP || sig == SIGUSR1)
+	{
+		if (sig == SIGHUP)
+			_reloadRequested = 1;	// also done by the loop
+		else
+			_traceRequested = 1;
+		return;
+	}
 	if(sig != SIGINT)
 	{
 		info("End the server with Ctrl+C", CLR_GRN);
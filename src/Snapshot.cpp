@@ -0,0 +1,264 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Snapshot.cpp                                       :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/20 19:12:40 by astein            #+#    #+#             */
+/*   Updated: 2024/05/20 19:12:40 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "Snapshot.hpp"
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define HEADER_SIZE		24
+#define MAX_STRING		0xFFFF
+
+// Constructor and Destructor
+// -----------------------------------------------------------------------------
+Snapshot::Snapshot() :
+	_payload(),
+	_count(0)
+{
+}
+
+Snapshot::~Snapshot()
+{
+	// Nothing to do
+}
+
+// Writing
+// -----------------------------------------------------------------------------
+void	Snapshot::add(const Record &record)
+{
+	uint8_t	flags = (record.inviteOnly ? 1 : 0) | (record.topicProtected ? 2 : 0);
+	size_t	operators = record.operators.size();
+
+	if (operators > MAX_STRING)
+		operators = MAX_STRING;
+	_payload.append(reinterpret_cast<const char *>(&flags), 1);
+	putU32(record.limit < 0 ? 0 : record.limit);
+	putString(record.name);
+	putString(record.topic);
+	putString(record.topicChange);
+	putString(record.key);
+	putU16(operators);
+	for (size_t i = 0; i < operators; ++i)
+		putString(record.operators[i]);
+	for (size_t i = 0; i < 3; ++i)
+		putMasks(record.masks[i]);
+	_count++;
+}
+
+// Header and payload in one piece (also what a hot upgrade hands over)
+std::string	Snapshot::getData() const
+{
+	char	header[HEADER_SIZE];
+	uint32_t values[4] = {SNAPSHOT_VERSION, _count, static_cast<uint32_t>(_payload.size()),
+		checksum(_payload.data(), _payload.size())};
+
+	std::memset(header, 0, sizeof(header));
+	std::memcpy(header, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	std::memcpy(header + 8, values, sizeof(values));
+	return std::string(header, sizeof(header)) + _payload;
+}
+
+bool	Snapshot::writeTo(const std::string &path) const
+{
+	std::string	data = getData();
+
+	// Unique per process: the periodic snapshot is written by a child
+	char	suffix[32];
+	std::snprintf(suffix, sizeof(suffix), ".tmp.%d", static_cast<int>(getpid()));
+	std::string	tmpPath = path + suffix;
+	int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		return false;
+
+	size_t	done = 0;
+	while (done < data.size())
+	{
+		ssize_t written = write(fd, data.data() + done, data.size() - done);
+		if (written < 0)
+		{
+			close(fd);
+			unlink(tmpPath.c_str());
+			return false;
+		}
+		done += written;
+	}
+	if (fsync(fd) < 0 || close(fd) < 0 || rename(tmpPath.c_str(), path.c_str()) < 0)
+	{
+		unlink(tmpPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+uint32_t	Snapshot::getCount() const
+{
+	return _count;
+}
+
+void	Snapshot::putString(const std::string &str)
+{
+	size_t len = str.size() > MAX_STRING ? MAX_STRING : str.size();
+
+	putU16(len);
+	_payload.append(str.data(), len);
+}
+
+void	Snapshot::putMasks(const std::vector<Mask> &masks)
+{
+	size_t	count = masks.size() > MAX_STRING ? MAX_STRING : masks.size();
+
+	putU16(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		putString(masks[i].mask);
+		putString(masks[i].setter);
+		putU32(masks[i].time);
+	}
+}
+
+void	Snapshot::putU16(uint16_t value)
+{
+	_payload.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void	Snapshot::putU32(uint32_t value)
+{
+	_payload.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+// Reading
+// -----------------------------------------------------------------------------
+// Bounds checked reader over the mapped payload
+namespace
+{
+	struct Reader
+	{
+		const char	*pos;
+		const char	*end;
+
+		bool	take(void *dst, size_t len)
+		{
+			if (static_cast<size_t>(end - pos) < len)
+				return false;
+			std::memcpy(dst, pos, len);
+			pos += len;
+			return true;
+		}
+
+		bool	string(std::string &dst)
+		{
+			uint16_t len;
+			if (!take(&len, sizeof(len)) || static_cast<size_t>(end - pos) < len)
+				return false;
+			dst.assign(pos, len);
+			pos += len;
+			return true;
+		}
+
+		bool	masks(std::vector<Snapshot::Mask> &dst)
+		{
+			uint16_t count;
+			if (!take(&count, sizeof(count)))
+				return false;
+			dst.resize(count);
+			for (uint16_t i = 0; i < count; ++i)
+				if (!string(dst[i].mask) || !string(dst[i].setter) ||
+					!take(&dst[i].time, sizeof(dst[i].time)))
+					return false;
+			return true;
+		}
+	};
+}
+
+// Returns false if there is no snapshot or it is broken (records stays empty)
+bool	Snapshot::load(const std::string &path, std::vector<Record> &records)
+{
+	int	fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat	st;
+	if (fstat(fd, &st) < 0 || st.st_size < HEADER_SIZE)
+	{
+		close(fd);
+		return false;
+	}
+	size_t	size = st.st_size;
+	void	*map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+
+	bool ok = parse(static_cast<const char *>(map), size, records);
+	munmap(map, size);
+	return ok;
+}
+
+// Returns false if the data is no valid snapshot (records stays empty)
+bool	Snapshot::parse(const char *data, size_t size, std::vector<Record> &records)
+{
+	if (size < HEADER_SIZE)
+		return false;
+
+	uint32_t	values[4];
+	std::memcpy(values, data + 8, sizeof(values));
+	bool ok = std::memcmp(data, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0 &&
+		(values[0] == 1 || values[0] == SNAPSHOT_VERSION) && values[2] == size - HEADER_SIZE &&
+		values[3] == checksum(data + HEADER_SIZE, values[2]);
+
+	Reader	reader;
+	reader.pos = data + HEADER_SIZE;
+	reader.end = data + size;
+	if (ok)
+		records.resize(values[1]);
+	for (uint32_t i = 0; ok && i < values[1]; ++i)
+	{
+		Record		&record = records[i];
+		uint8_t		flags;
+		uint32_t	limit;
+		uint16_t	operators;
+
+		ok = reader.take(&flags, 1) && reader.take(&limit, sizeof(limit)) &&
+			reader.string(record.name) && reader.string(record.topic) &&
+			reader.string(record.topicChange) && reader.string(record.key) &&
+			reader.take(&operators, sizeof(operators));
+		if (!ok)
+			break ;
+		record.inviteOnly = flags & 1;
+		record.topicProtected = flags & 2;
+		record.limit = limit;
+		record.operators.resize(operators);
+		for (uint16_t op = 0; ok && op < operators; ++op)
+			ok = reader.string(record.operators[op]);
+		for (size_t list = 0; ok && values[0] >= 2 && list < 3; ++list)
+			ok = reader.masks(record.masks[list]);
+	}
+	if (!ok)
+		records.clear();
+	return ok;
+}
+
+// FNV-1a
+uint32_t	Snapshot::checksum(const char *data, size_t len)
+{
+	uint32_t hash = 2166136261u;
+
+	for (size_t i = 0; i < len; ++i)
+	{
+		hash ^= static_cast<unsigned char>(data[i]);
+		hash *= 16777619u;
+	}
+	return hash;
+}
@@ -0,0 +1,289 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   SpamFilter.cpp                                     :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/25 16:42:31 by astein            #+#    #+#             */
+/*   Updated: 2024/05/25 16:42:31 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "SpamFilter.hpp"
+#include <fstream>
+#include <sstream>
+#include <queue>
+#include <cstring>
+#include <ctime>
+#include "utils.hpp"
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+// Constructor and Destructor
+// -----------------------------------------------------------------------------
+SpamFilter::SpamFilter() :
+	_patterns(0),
+	_classes(1),
+	_first(),
+	_delta(1, 0),
+	_action(1, ACTION_NONE)
+{
+	std::memset(_classOf, 0, sizeof(_classOf));
+	std::memset(_isFirst, 0, sizeof(_isFirst));
+	std::memset(&_stats, 0, sizeof(_stats));
+}
+
+SpamFilter::~SpamFilter()
+{
+	// Nothing to do
+}
+
+// Loading
+// -----------------------------------------------------------------------------
+// The new automaton is built aside and only swapped in when the whole file
+// was fine. A missing file is an empty pattern list.
+bool	SpamFilter::load(const std::string &path, std::string &error)
+{
+	SpamFilter		next;
+	std::ifstream	file(path.c_str());
+	std::string		line;
+	size_t			lineNumber = 0;
+	std::vector<std::pair<Action, std::string> >	patterns;
+
+	_stats.loads++;
+	while (file && std::getline(file, line))
+	{
+		lineNumber++;
+		if (!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		if (line.empty() || line[0] == '#')
+			continue ;
+
+		size_t		space = line.find(' ');
+		std::string	word = line.substr(0, space);
+		std::string	pattern = space == std::string::npos ? "" : line.substr(space + 1);
+		Action		action = ACTION_NONE;
+		if (word == "drop")
+			action = ACTION_DROP;
+		else if (word == "notice")
+			action = ACTION_NOTICE;
+		else if (word == "kill")
+			action = ACTION_KILL;
+		if (action == ACTION_NONE || pattern.empty() || pattern.size() > FILTER_PATTERN_LENGTH ||
+			patterns.size() == FILTER_PATTERNS_MAX)
+		{
+			error = path + ":" + to_string(lineNumber) + ": expected \"drop|notice|kill <text>\" (at most " +
+				to_string(FILTER_PATTERNS_MAX) + " patterns of " + to_string(FILTER_PATTERN_LENGTH) + " bytes)";
+			_stats.failedLoads++;
+			return false;
+		}
+		patterns.push_back(std::make_pair(action, pattern));
+
+		// EVERY BYTE OF A PATTERN GETS A CLASS (BOTH CASES THE SAME)
+		for (size_t i = 0; i < pattern.size(); ++i)
+		{
+			unsigned char c = fold(pattern[i]);
+			if (next._classOf[c])
+				continue ;
+			next._classOf[c] = next._classes++;
+			if (c >= 'a' && c <= 'z')
+				next._classOf[c - 'a' + 'A'] = next._classOf[c];
+		}
+	}
+
+	// THE TRIE (-1: NO CHILD YET)
+	size_t				classes = next._classes;
+	std::vector<int>	trie(classes, -1);
+	std::vector<unsigned char>	actions(1, ACTION_NONE);
+	for (size_t p = 0; p < patterns.size(); ++p)
+	{
+		const std::string	&pattern = patterns[p].second;
+		size_t				state = 0;
+		for (size_t i = 0; i < pattern.size(); ++i)
+		{
+			size_t	slot = state * classes + next._classOf[fold(pattern[i])];
+			if (trie[slot] < 0)
+			{
+				if (actions.size() > FILTER_STATES_MAX)
+				{
+					error = path + ": the patterns need more than " + to_string(FILTER_STATES_MAX) + " states";
+					_stats.failedLoads++;
+					return false;
+				}
+				trie[slot] = actions.size();
+				trie.resize(trie.size() + classes, -1);
+				actions.push_back(ACTION_NONE);
+			}
+			state = trie[slot];
+		}
+		if (patterns[p].first > actions[state])
+			actions[state] = patterns[p].first;
+	}
+	next._patterns = patterns.size();
+
+	// THE FAILURE LINKS, BREADTH FIRST: A MISSING TRANSITION IS THE ONE OF
+	// THE LONGEST SUFFIX WHICH IS IN THE TRIE, AND A STATE ALSO ENDS THE
+	// PATTERNS WHICH END AT THAT SUFFIX
+	next._delta.assign(trie.size(), 0);
+	next._action = actions;
+	std::vector<size_t>	fail(actions.size(), 0);
+	std::queue<size_t>	pending;
+	for (size_t c = 0; c < classes; ++c)
+	{
+		if (trie[c] <= 0)
+			continue ;
+		next._delta[c] = trie[c];
+		pending.push(trie[c]);
+	}
+	while (!pending.empty())
+	{
+		size_t state = pending.front();
+		pending.pop();
+		if (next._action[fail[state]] > next._action[state])
+			next._action[state] = next._action[fail[state]];
+		for (size_t c = 0; c < classes; ++c)
+		{
+			int child = trie[state * classes + c];
+			if (child < 0)
+			{
+				next._delta[state * classes + c] = next._delta[fail[state] * classes + c];
+				continue ;
+			}
+			fail[child] = next._delta[fail[state] * classes + c];
+			next._delta[state * classes + c] = child;
+			pending.push(child);
+		}
+	}
+
+	// THE BYTES WHICH LEAVE THE START STATE
+	for (int byte = 0; byte < 256; ++byte)
+	{
+		if (next._delta[next._classOf[byte]] == 0)
+			continue ;
+		next._isFirst[byte] = true;
+		next._first.push_back(byte);
+	}
+
+	next._stats = _stats;
+	swap(next);
+	return true;
+}
+
+void	SpamFilter::swap(SpamFilter &other)
+{
+	std::swap(_patterns, other._patterns);
+	std::swap(_classes, other._classes);
+	std::swap_ranges(_classOf, _classOf + 256, other._classOf);
+	std::swap_ranges(_isFirst, _isFirst + 256, other._isFirst);
+	_first.swap(other._first);
+	_delta.swap(other._delta);
+	_action.swap(other._action);
+	std::swap(_stats, other._stats);
+}
+
+// Matching
+// -----------------------------------------------------------------------------
+SpamFilter::Action	SpamFilter::check(const std::string &text)
+{
+	if (!_patterns)
+		return ACTION_NONE;
+
+	struct timespec			start;
+	struct timespec			end;
+	const unsigned char		*bytes = reinterpret_cast<const unsigned char *>(text.data());
+	size_t					len = text.size();
+	size_t					state = 0;
+	unsigned char			found = ACTION_NONE;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t pos = 0; pos < len && found != ACTION_KILL; ++pos)
+	{
+		if (state == 0)
+		{
+			pos = nextFirst(bytes, pos, len);
+			if (pos == len)
+				break ;
+		}
+		state = _delta[state * _classes + _classOf[bytes[pos]]];
+		if (_action[state] > found)
+			found = _action[state];
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	_stats.checked++;
+	_stats.bytes += len;
+	_stats.nanoseconds += (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+	_stats.hits[found]++;
+	return static_cast<Action>(found);
+}
+
+// The next byte which can start a pattern (len if there is none)
+size_t	SpamFilter::nextFirst(const unsigned char *text, size_t pos, size_t len) const
+{
+#ifdef __SSE2__
+	size_t	count = _first.size();
+	if (count <= FILTER_FIRST_SIMD)
+	{
+		__m128i	first[FILTER_FIRST_SIMD];
+		for (size_t i = 0; i < count; ++i)
+			first[i] = _mm_set1_epi8(static_cast<char>(_first[i]));
+		while (len - pos >= 16)
+		{
+			__m128i	chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + pos));
+			__m128i	hit = _mm_setzero_si128();
+			for (size_t i = 0; i < count; ++i)
+				hit = _mm_or_si128(hit, _mm_cmpeq_epi8(chunk, first[i]));
+			int mask = _mm_movemask_epi8(hit);
+			if (mask)
+				return pos + __builtin_ctz(mask);
+			pos += 16;
+		}
+	}
+#endif
+	while (pos < len && !_isFirst[text[pos]])
+		pos++;
+	return pos;
+}
+
+unsigned char	SpamFilter::fold(unsigned char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+// Getters
+// -----------------------------------------------------------------------------
+size_t	SpamFilter::getPatternCount() const
+{
+	return _patterns;
+}
+
+size_t	SpamFilter::getStateCount() const
+{
+	return _action.size();
+}
+
+size_t	SpamFilter::getClassCount() const
+{
+	return _classes;
+}
+
+size_t	SpamFilter::getMemoryUsed() const
+{
+	return _delta.capacity() * sizeof(uint16_t) + _action.capacity() + _first.capacity();
+}
+
+bool	SpamFilter::usesSimd() const
+{
+#ifdef __SSE2__
+	return _first.size() <= FILTER_FIRST_SIMD;
+#else
+	return false;
+#endif
+}
+
+const SpamFilter::Stats	&SpamFilter::getStats() const
+{
+	return _stats;
+}
@@ -0,0 +1,243 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   TimerWheel.cpp                                     :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/16 19:02:11 by astein            #+#    #+#             */
+/*   Updated: 2024/05/16 19:02:11 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "TimerWheel.hpp"
+
+// Timer
+// -----------------------------------------------------------------------------
+Timer::Timer() :
+	_prev(NULL),
+	_next(NULL),
+	_wheel(NULL),
+	_expires(0),
+	_data(NULL)
+{
+	// Nothing to do
+}
+
+// A copied timer is not linked into any wheel
+Timer::Timer(const Timer &other) :
+	_prev(NULL),
+	_next(NULL),
+	_wheel(NULL),
+	_expires(0),
+	_data(other._data)
+{
+	// Nothing to do
+}
+
+Timer	&Timer::operator=(const Timer &other)
+{
+	if (this != &other)
+	{
+		cancel();
+		_data = other._data;
+	}
+	return *this;
+}
+
+Timer::~Timer()
+{
+	cancel();
+}
+
+bool	Timer::isArmed() const
+{
+	return _wheel != NULL;
+}
+
+void	*Timer::getData() const
+{
+	return _data;
+}
+
+void	Timer::cancel()
+{
+	if (_wheel)
+		_wheel->cancel(*this);
+}
+
+// Construction / Destruction
+// -----------------------------------------------------------------------------
+TimerWheel::TimerWheel(unsigned long now) :
+	_current(now),
+	_count(0)
+{
+	for (int i = 0; i < WHEEL_SIZE_0; ++i)
+		_level0[i]._prev = _level0[i]._next = &_level0[i];
+	for (int l = 0; l < WHEEL_LEVELS - 1; ++l)
+		for (int i = 0; i < WHEEL_SIZE_N; ++i)
+			_levelN[l][i]._prev = _levelN[l][i]._next = &_levelN[l][i];
+	for (int i = 0; i < WHEEL_SIZE_0 / 32; ++i)
+		_pending[i] = 0;
+}
+
+// Unlink the remaining timers so they don't point to a dead wheel
+TimerWheel::~TimerWheel()
+{
+	for (int l = 0; l < WHEEL_LEVELS; ++l)
+	{
+		int size = (l == 0) ? WHEEL_SIZE_0 : WHEEL_SIZE_N;
+		for (int i = 0; i < size; ++i)
+		{
+			Timer *head = slot(l, i);
+			while (head->_next != head)
+				cancel(*head->_next);
+		}
+	}
+}
+
+// Arm / Cancel
+// -----------------------------------------------------------------------------
+// The timer expires 'ticks' ticks after the last processed tick. Arming an
+// armed timer moves it.
+void	TimerWheel::arm(Timer &timer, unsigned long ticks, void *data)
+{
+	if (timer._wheel)
+		timer._wheel->cancel(timer);
+	if (ticks > WHEEL_MAX_TICKS)
+		ticks = WHEEL_MAX_TICKS;
+	timer._expires = _current + ticks;
+	timer._data = data;
+	timer._wheel = this;
+	place(timer);
+	_count++;
+}
+
+void	TimerWheel::cancel(Timer &timer)
+{
+	if (timer._wheel != this)
+		return ;
+	timer._prev->_next = timer._next;
+	timer._next->_prev = timer._prev;
+	timer._prev = timer._next = NULL;
+	timer._wheel = NULL;
+	_count--;
+}
+
+// Advance
+// -----------------------------------------------------------------------------
+void	TimerWheel::advance(unsigned long now, std::vector<Timer *> &expired)
+{
+	// Nothing armed: no need to walk the ticks one by one
+	if (_count == 0)
+	{
+		if (now >= _current)
+			_current = now + 1;
+		return ;
+	}
+	while (_current <= now)
+	{
+		unsigned long index = _current & (WHEEL_SIZE_0 - 1);
+
+		// Level 0 wrapped around -> refill it from the higher levels
+		if (index == 0)
+		{
+			for (int l = 1; l < WHEEL_LEVELS && cascade(l) == 0; ++l)
+				;
+		}
+
+		Timer *head = &_level0[index];
+		while (head->_next != head)
+		{
+			Timer *timer = head->_next;
+			cancel(*timer);
+			expired.push_back(timer);
+		}
+		_pending[index / 32] &= ~(1U << (index % 32));
+		_current++;
+	}
+}
+
+long	TimerWheel::nextEventTick() const
+{
+	if (_count == 0)
+		return -1;
+
+	// Level 0 wraps around -> the cascade is due now
+	unsigned long index = _current & (WHEEL_SIZE_0 - 1);
+	if (index == 0)
+		return _current;
+
+	// Look for the next used slot of level 0 (32 slots at once)
+	for (unsigned long i = index; i < WHEEL_SIZE_0; )
+	{
+		unsigned int bits = _pending[i / 32] >> (i % 32);
+		if (bits)
+			return _current + (i + __builtin_ctz(bits) - index);
+		i = (i | 31) + 1;
+	}
+	// Nothing until the next cascade
+	return _current + (WHEEL_SIZE_0 - index);
+}
+
+size_t	TimerWheel::size() const
+{
+	return _count;
+}
+
+// Private Methods
+// -----------------------------------------------------------------------------
+// Puts the timer in the slot of the level which covers its expiry
+void	TimerWheel::place(Timer &timer)
+{
+	unsigned long	expires = timer._expires;
+	unsigned long	delta;
+	Timer			*head;
+
+	// Already due -> next processed tick
+	if (expires < _current)
+		expires = _current;
+	delta = expires - _current;
+	if (delta < WHEEL_SIZE_0)
+	{
+		unsigned long index = expires & (WHEEL_SIZE_0 - 1);
+		head = &_level0[index];
+		_pending[index / 32] |= 1U << (index % 32);
+	}
+	else
+	{
+		int l = 1;
+		while (l < WHEEL_LEVELS - 1 && delta >= (1UL << (WHEEL_BITS_0 + l * WHEEL_BITS_N)))
+			l++;
+		head = slot(l, expires >> (WHEEL_BITS_0 + (l - 1) * WHEEL_BITS_N));
+	}
+	timer._next = head;
+	timer._prev = head->_prev;
+	head->_prev->_next = &timer;
+	head->_prev = &timer;
+}
+
+// Moves all timers of the current slot of a level one level down
+// Returns the index of that slot (0 means the level wrapped around as well)
+int	TimerWheel::cascade(int level)
+{
+	unsigned long	index = (_current >> (WHEEL_BITS_0 + (level - 1) * WHEEL_BITS_N)) & (WHEEL_SIZE_N - 1);
+	Timer			*head = slot(level, index);
+	Timer			*timer;
+
+	while (head->_next != head)
+	{
+		timer = head->_next;
+		timer->_prev->_next = timer->_next;
+		timer->_next->_prev = timer->_prev;
+		place(*timer);
+	}
+	return index;
+}
+
+Timer	*TimerWheel::slot(int level, unsigned long index)
+{
+	if (level == 0)
+		return &_level0[index & (WHEEL_SIZE_0 - 1)];
+	return &_levelN[level - 1][index & (WHEEL_SIZE_N - 1)];
+}
@@ -0,0 +1,105 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Trace.cpp                                          :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/26 15:31:09 by astein            #+#    #+#             */
+/*   Updated: 2024/05/26 15:31:09 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "Trace.hpp"
+#include <cstdio>
+#include <ctime>
+#include <unistd.h>
+
+bool			Trace::_enabled = false;
+Trace::Event	*Trace::_ring = NULL;
+size_t			Trace::_next = 0;
+size_t			Trace::_count = 0;
+
+// Switching
+// -----------------------------------------------------------------------------
+// The ring is only allocated the first time tracing is switched on and
+// every run starts with an empty one
+void	Trace::enable()
+{
+	if (!_ring)
+		_ring = new Event[TRACE_EVENTS];
+	_next = 0;
+	_count = 0;
+	_enabled = true;
+}
+
+void	Trace::disable()
+{
+	_enabled = false;
+}
+
+size_t	Trace::getEventCount()
+{
+	return _count;
+}
+
+// Recording
+// -----------------------------------------------------------------------------
+void	Trace::begin(const char *name, int fd)
+{
+	record(name, fd, 'B');
+}
+
+void	Trace::end(const char *name, int fd)
+{
+	record(name, fd, 'E');
+}
+
+void	Trace::record(const char *name, int fd, char phase)
+{
+	struct timespec	ts;
+	Event			&event = _ring[_next];
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	event.name = name;
+	event.ns = ts.tv_sec * 1000000000L + ts.tv_nsec;
+	event.fd = fd;
+	event.phase = phase;
+	_next = (_next + 1) % TRACE_EVENTS;
+	if (_count < TRACE_EVENTS)
+		_count++;
+}
+
+// Export
+// -----------------------------------------------------------------------------
+// {"traceEvents":[{"name":"poll","ph":"B","ts":12.345,"pid":1,"tid":1}, ...]}
+// The timestamps are microseconds. End events whose begin was overwritten
+// are left out, so the spans in the file are always nested properly.
+bool	Trace::dump(const std::string &path)
+{
+	FILE	*file = std::fopen(path.c_str(), "w");
+	if (!file)
+		return false;
+
+	int		pid = getpid();
+	size_t	first = (_next + TRACE_EVENTS - _count) % TRACE_EVENTS;
+	size_t	depth = 0;
+	bool	comma = false;
+
+	std::fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	for (size_t i = 0; i < _count; ++i)
+	{
+		const Event	&event = _ring[(first + i) % TRACE_EVENTS];
+		if (event.phase == 'E' && depth == 0)
+			continue ;
+		depth += event.phase == 'B' ? 1 : -1;
+		std::fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%ld.%03ld,\"pid\":%d,\"tid\":1",
+			comma ? ",\n" : "", event.name, event.phase, event.ns / 1000, event.ns % 1000, pid);
+		if (event.fd >= 0)
+			std::fprintf(file, ",\"args\":{\"fd\":%d}", event.fd);
+		std::fprintf(file, "}");
+		comma = true;
+	}
+	std::fprintf(file, "\n]}\n");
+	return std::fclose(file) == 0;
+}
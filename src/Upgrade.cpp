@@ -0,0 +1,213 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Upgrade.cpp                                        :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/21 20:03:17 by astein            #+#    #+#             */
+/*   Updated: 2024/05/21 20:03:17 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "Upgrade.hpp"
+#include <cstring>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+// Constructor and Destructor
+// -----------------------------------------------------------------------------
+Upgrade::Upgrade() :
+	_data(),
+	_pos(0),
+	_fds(),
+	_received(false)
+{
+}
+
+Upgrade::~Upgrade()
+{
+	if (!_received)
+		return ;
+	for (size_t i = 0; i < _fds.size(); ++i)
+		if (_fds[i] >= 0)
+			close(_fds[i]);
+}
+
+// Writing
+// -----------------------------------------------------------------------------
+uint32_t	Upgrade::addFd(int fd)
+{
+	_fds.push_back(fd);
+	return _fds.size() - 1;
+}
+
+void	Upgrade::putU32(uint32_t value)
+{
+	_data.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void	Upgrade::putString(const std::string &str)
+{
+	putU32(str.size());
+	_data.append(str);
+}
+
+void	Upgrade::putBytes(const void *data, size_t len)
+{
+	_data.append(static_cast<const char *>(data), len);
+}
+
+bool	Upgrade::sendTo(int sock) const
+{
+	uint32_t	sizes[2] = {static_cast<uint32_t>(_fds.size()), static_cast<uint32_t>(_data.size())};
+
+	if (!sendAll(sock, reinterpret_cast<const char *>(sizes), sizeof(sizes)))
+		return false;
+	for (size_t done = 0; done < _fds.size(); done += UPGRADE_FDS_PER_MSG)
+	{
+		size_t	count = _fds.size() - done;
+		if (count > UPGRADE_FDS_PER_MSG)
+			count = UPGRADE_FDS_PER_MSG;
+
+		char			dummy = 0;
+		struct iovec	iov = {&dummy, 1};
+		char			control[CMSG_SPACE(UPGRADE_FDS_PER_MSG * sizeof(int))];
+		struct msghdr	msg;
+		std::memset(&msg, 0, sizeof(msg));
+		std::memset(control, 0, sizeof(control));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+
+		struct cmsghdr	*cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+		std::memcpy(CMSG_DATA(cmsg), &_fds[done], count * sizeof(int));
+		if (sendmsg(sock, &msg, MSG_NOSIGNAL) != 1)
+			return false;
+	}
+	return sendAll(sock, _data.data(), _data.size());
+}
+
+// The old process keeps on serving if the new one doesn't answer in time
+bool	Upgrade::waitForAck(int sock)
+{
+	struct pollfd	pfd = {sock, POLLIN, 0};
+	char			ack;
+
+	if (poll(&pfd, 1, UPGRADE_TIMEOUT_MS) != 1)
+		return false;
+	return recv(sock, &ack, 1, 0) == 1;
+}
+
+// Reading
+// -----------------------------------------------------------------------------
+bool	Upgrade::receiveFrom(int sock)
+{
+	uint32_t	sizes[2];
+
+	_received = true;
+	if (!recvAll(sock, reinterpret_cast<char *>(sizes), sizeof(sizes)))
+		return false;
+	while (_fds.size() < sizes[0])
+	{
+		char			dummy;
+		struct iovec	iov = {&dummy, 1};
+		char			control[CMSG_SPACE(UPGRADE_FDS_PER_MSG * sizeof(int))];
+		struct msghdr	msg;
+		std::memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(sock, &msg, 0) != 1 || (msg.msg_flags & MSG_CTRUNC))
+			return false;
+
+		struct cmsghdr	*cmsg = CMSG_FIRSTHDR(&msg);
+		if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			return false;
+		size_t	count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		size_t	first = _fds.size();
+		_fds.resize(first + count);
+		std::memcpy(&_fds[first], CMSG_DATA(cmsg), count * sizeof(int));
+	}
+	_data.resize(sizes[1]);
+	_pos = 0;
+	return sizes[1] == 0 || recvAll(sock, &_data[0], sizes[1]);
+}
+
+bool	Upgrade::getU32(uint32_t &value)
+{
+	return getBytes(&value, sizeof(value));
+}
+
+bool	Upgrade::getString(std::string &str)
+{
+	uint32_t	len;
+
+	if (!getU32(len) || _data.size() - _pos < len)
+		return false;
+	str.assign(_data, _pos, len);
+	_pos += len;
+	return true;
+}
+
+bool	Upgrade::getBytes(void *data, size_t len)
+{
+	if (_data.size() - _pos < len)
+		return false;
+	std::memcpy(data, _data.data() + _pos, len);
+	_pos += len;
+	return true;
+}
+
+int	Upgrade::takeFd(uint32_t index)
+{
+	if (index >= _fds.size())
+		return -1;
+	int fd = _fds[index];
+	_fds[index] = -1;
+	return fd;
+}
+
+bool	Upgrade::sendAck(int sock)
+{
+	return sendAll(sock, "1", 1);
+}
+
+// Helpers (the socketpair is blocking)
+// -----------------------------------------------------------------------------
+bool	Upgrade::sendAll(int sock, const char *data, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t sent = send(sock, data, len, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR)
+			continue ;
+		if (sent <= 0)
+			return false;
+		data += sent;
+		len -= sent;
+	}
+	return true;
+}
+
+bool	Upgrade::recvAll(int sock, char *data, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t got = recv(sock, data, len, 0);
+		if (got < 0 && errno == EINTR)
+			continue ;
+		if (got <= 0)
+			return false;
+		data += got;
+		len -= got;
+	}
+	return true;
+}
@@ -19,9 +19,9 @@ int main(int ac, char **av)
 	Logger::init();
 	Logger::activateLogger();
 	// Logger::deactivateLogger();
-    if (ac != 3)
+    if (ac < 3)
     {
-		info("Usage: ./ircserv <port> <pswd>", CLR_RED);
+		info("Usage: ./ircserv <port> <pswd> [<server name> [<peer host>:<port> ...]]", CLR_RED);
         return 1;
     }
 	Server::setupSignalHandling();
@@ -30,10 +30,28 @@ int main(int ac, char **av)
 		title("IRC Server", true, false);
 		info("Welcome to " + std::string(PROMT), CLR_GRN);
 		info("End the server with Ctrl+C", CLR_GRN);
+		info("Upgrade the binary with kill -USR2 " + to_string(getpid()), CLR_GRN);
+		info("Reload " + std::string(FILTER_FILE) + " with kill -HUP " + to_string(getpid()), CLR_GRN);
+		info("Trace the loop with kill -USR1 " + to_string(getpid()) + " (again to write " + TRACE_FILE + ")", CLR_GRN);
 		info("~~~~~~~~~~~~~~~~~~~~~~~~~~", CLR_GRN);
 		info("Create server instance", CLR_BLU);
         Server server(av[1], av[2]);
-        server.initNetwork();
+		// Optional: the name of this server and the servers to link to
+		if (ac > 3)
+			server.setServerName(av[3]);
+		for (int i = 4; i < ac; ++i)
+			server.addLinkPeer(av[i]);
+		server.enableUpgrade(av);
+		// Started by a hot upgrade: the old process hands everything over
+		const char *upgradeFd = getenv(UPGRADE_ENV);
+		if (upgradeFd)
+		{
+			int sock = std::atoi(upgradeFd);
+			unsetenv(UPGRADE_ENV);
+			server.resumeUpgrade(sock);
+		}
+		else
+			server.initNetwork();
         server.goOnline();
     }
 	catch (const ServerException &se)
@@ -46,6 +64,8 @@ int main(int ac, char **av)
 		info ("STANDARD EXCEPTION CAUGHT: ", CLR_RED);
 		info(e.what(), CLR_RED);
     }
+	// All clients and channels are gone -> give the pool memory back
+	Pool::purge();
 	Logger::close();
 	title("IRC Server stopped!", true, true);
     return 0;
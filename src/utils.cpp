@@ -11,6 +11,7 @@
 /* ************************************************************************** */
 
 #include "utils.hpp"
+#include <cstring>
 
 // Helper functions for printing
 void	title(std::string str, bool newline_before, bool newline_after)
@@ -45,4 +46,129 @@ bool	intNoOverflow(std::string token)
     if (token.length() < maxInt.size())
         return (true);
     return (token.compare(maxInt) <= 0);
-}
\ No newline at end of file
+}
+// Monotonic clock in milliseconds
+// -----------------------------------------------------------------------------
+// CLOCK_MONOTONIC doesn't jump when the wall clock is changed, so it is safe
+// to use for measuring intervals (flood control, timeouts, ...)
+long	monotonicMs()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+// The same in nanoseconds, for the time spent in the loop phases
+long	monotonicNs()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// Wall clock in milliseconds
+// -----------------------------------------------------------------------------
+long	realtimeMs()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+// Integer formatting
+// -----------------------------------------------------------------------------
+// Two digits per division, written backwards into a scratch buffer
+static const char	digitPairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+size_t	formatNumber(char *out, unsigned long value)
+{
+	char	buffer[NUMBER_MAX];
+	char	*end = buffer + sizeof(buffer);
+	char	*pos = end;
+
+	while (value >= 100)
+	{
+		const char	*pair = digitPairs + (value % 100) * 2;
+		value /= 100;
+		*--pos = pair[1];
+		*--pos = pair[0];
+	}
+	if (value >= 10)
+	{
+		*--pos = digitPairs[value * 2 + 1];
+		*--pos = digitPairs[value * 2];
+	}
+	else
+		*--pos = static_cast<char>('0' + value);
+	std::memcpy(out, pos, end - pos);
+	return end - pos;
+}
+
+size_t	formatNumber(char *out, long value)
+{
+	if (value >= 0)
+		return formatNumber(out, static_cast<unsigned long>(value));
+	*out = '-';
+	return 1 + formatNumber(out + 1, 0UL - static_cast<unsigned long>(value));
+}
+
+std::string	to_string(int value)
+{
+	return to_string(static_cast<long>(value));
+}
+
+std::string	to_string(unsigned int value)
+{
+	return to_string(static_cast<unsigned long>(value));
+}
+
+std::string	to_string(long value)
+{
+	char	digits[NUMBER_MAX];
+
+	return std::string(digits, formatNumber(digits, value));
+}
+
+std::string	to_string(unsigned long value)
+{
+	char	digits[NUMBER_MAX];
+
+	return std::string(digits, formatNumber(digits, value));
+}
+
+// Strings
+// -----------------------------------------------------------------------------
+size_t	stringHeapBytes(const std::string &str)
+{
+	const char	*data = str.data();
+	const char	*self = reinterpret_cast<const char *>(&str);
+
+	if (str.capacity() == 0 || (data >= self && data < self + sizeof(str)))
+		return 0;
+	return str.capacity() + 1;
+}
+
+// Returns the bytes given back
+size_t	shrinkString(std::string &str)
+{
+	size_t before = stringHeapBytes(str);
+
+	if (!before || str.capacity() == str.size())
+		return 0;
+	std::string(str.data(), str.size()).swap(str);
+	size_t after = stringHeapBytes(str);
+	return before > after ? before - after : 0;
+}
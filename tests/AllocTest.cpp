@@ -0,0 +1,174 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   AllocTest.cpp                                      :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/26 16:02:18 by astein            #+#    #+#             */
+/*   Updated: 2024/05/26 16:02:18 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "tests.hpp"
+#include "AllocScope.hpp"
+#include "Arena.hpp"
+#include "Channel.hpp"
+#include "Client.hpp"
+#include "LineScan.hpp"
+#include "Reply.hpp"
+#include "codes.hpp"
+#include <sys/socket.h>
+#include <unistd.h>
+
+// The hot paths in the steady state must not touch the heap (see
+// AllocScope.hpp); the first round of each test warms the pools up
+#define MEMBERS		5
+#define ROUNDS		100
+
+namespace
+{
+	unsigned long	allocations(int scope)
+	{
+		return AllocScope::getStats(scope).allocations;
+	}
+
+	unsigned long	allAllocations()
+	{
+		unsigned long	total = 0;
+
+		for (int scope = 0; scope < ALLOC_SCOPES; ++scope)
+			total += allocations(scope);
+		return total;
+	}
+
+	// Sends the send queue and throws away what arrives at the other end
+	void	drain(Client &client, int peer)
+	{
+		char	buffer[4096];
+
+		client.flushOutput();
+		while (recv(peer, buffer, sizeof(buffer), MSG_DONTWAIT) > 0)
+			;
+	}
+
+	// A channel with MEMBERS clients on socketpairs; member 0 talks
+	struct Fixture
+	{
+		Channel	channel;
+		Client	*members[MEMBERS];
+		int		peers[MEMBERS];
+
+		Fixture() : channel("#bench")
+		{
+			for (int i = 0; i < MEMBERS; ++i)
+			{
+				int	fds[2];
+				socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+				members[i] = new Client(fds[0]);
+				peers[i] = fds[1];
+				members[i]->setUniqueName(std::string("member") + static_cast<char>('0' + i));
+				members[i]->setUsername("user");
+				if (i == 0)
+					channel.iniChannel(members[i]);
+				else
+					channel.joinChannel(members[i], "");
+			}
+			drainAll();
+		}
+
+		~Fixture()
+		{
+			for (int i = 0; i < MEMBERS; ++i)
+			{
+				int	fd = members[i]->getSocketFd();
+				delete members[i];
+				close(fd);
+				close(peers[i]);
+			}
+		}
+
+		void	drainAll()
+		{
+			for (int i = 0; i < MEMBERS; ++i)
+				drain(*members[i], peers[i]);
+			Arena::frame().reset();
+		}
+	};
+
+	// A channel PRIVMSG and a PRIVMSG to a nick, the line rendered once
+	void	testFanout()
+	{
+		Fixture				fixture;
+		const std::string	line = ":member0!user@localhost PRIVMSG #bench :hello everybody";
+		const std::string	direct = ":member0!user@localhost PRIVMSG member1 :hello you";
+
+		fixture.channel.sendMessageToClients(line, fixture.members[0]);
+		fixture.members[1]->sendMessage(direct);
+		fixture.drainAll();
+
+		unsigned long	before = allocations(ALLOC_FANOUT);
+		for (int round = 0; round < ROUNDS; ++round)
+		{
+			fixture.channel.sendMessageToClients(line, fixture.members[0]);
+			fixture.members[1]->sendMessage(direct);
+			fixture.drainAll();
+		}
+		CHECK_EQ(allocations(ALLOC_FANOUT) - before, 0ul);
+	}
+
+	// A numeric rendered on the stack and queued
+	void	testReply()
+	{
+		Fixture			fixture;
+		Client			&receiver = *fixture.members[1];
+		const std::string	channel = "#bench";
+		const std::string	topic = "a topic which is long enough not to fit into a small string";
+
+		receiver.sendReply(Reply(RPL_TOPIC, receiver.getUniqueName()) << channel << " :" << topic);
+		fixture.drainAll();
+
+		unsigned long	before = allAllocations();
+		for (int round = 0; round < ROUNDS; ++round)
+		{
+			Reply	reply(RPL_TOPIC, receiver.getUniqueName());
+			reply << channel << " :" << topic << ' ' << round << ' ' << 4294967295ul;
+			receiver.sendReply(reply);
+			fixture.drainAll();
+		}
+		CHECK_EQ(allAllocations() - before, 0ul);
+
+		Reply	reply(RPL_TOPIC, "nick");
+		reply << channel << " :" << -42 << ' ' << 7u;
+		CHECK_EQ(std::string(reply.data(), reply.size()), std::string(":localhost 332 nick #bench :-42 7"));
+		CHECK(!reply.overflowed());
+
+		// What doesn't fit is cut and flagged
+		reply << std::string(REPLY_MAX, 'x');
+		CHECK_EQ(reply.size(), static_cast<size_t>(REPLY_MAX));
+		CHECK_EQ(reply.room(), 0ul);
+		CHECK(reply.overflowed());
+	}
+
+	// Scanning a line is done on the stack as well
+	void	testLineScan()
+	{
+		const std::string	line = "PRIVMSG #bench,member1 :hello everybody, this is a line with some text";
+
+		unsigned long	before = allAllocations();
+		for (int round = 0; round < ROUNDS; ++round)
+		{
+			LineScan	scan(line);
+			CHECK_EQ(scan.getVerdict(), LineScan::LINE_OK);
+			CHECK_EQ(scan.getTokenCount(), 2ul);
+		}
+		CHECK_EQ(allAllocations() - before, 0ul);
+	}
+}
+
+void	testAllocations()
+{
+	testFanout();
+	testReply();
+	testLineScan();
+}
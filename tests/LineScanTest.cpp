@@ -0,0 +1,118 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   LineScanTest.cpp                                   :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/26 16:40:52 by astein            #+#    #+#             */
+/*   Updated: 2024/05/26 16:40:52 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "tests.hpp"
+#include "LineScan.hpp"
+
+// The chunked paths of LineScan (SSE2, 64 bit words) have to give the same
+// result as looking at every byte alone; each case is moved over 40 offsets
+// so it crosses the 8 and 16 byte boundaries of the chunks
+#define SHIFTS		40
+
+namespace
+{
+	struct Case
+	{
+		const char			*name;
+		const char			*line;
+		size_t				size;		// the lines may contain NUL
+		LineScan::Verdict	verdict;
+		bool				inTrailing;	// shift it inside the trailing text
+	};
+
+	#define LINE(text)	text, sizeof(text) - 1
+
+	const Case	cases[] =
+	{
+		{"ascii",				LINE("hello world"),					LineScan::LINE_OK,		true},
+		{"two bytes",			LINE("caf\xC3\xA9"),					LineScan::LINE_OK,		true},
+		{"three bytes",			LINE("\xE2\x82\xAC 5"),					LineScan::LINE_OK,		true},
+		{"four bytes",			LINE("\xF0\x9F\x98\x80!"),				LineScan::LINE_OK,		true},
+		{"many multibyte",		LINE("\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80"),
+																		LineScan::LINE_OK,		true},
+		{"CTCP",				LINE("\x01" "ACTION waves\x01"),		LineScan::LINE_OK,		true},
+		{"formatting",			LINE("\x02" "bold\x0F \x03" "4red"),	LineScan::LINE_OK,		true},
+		{"tab",					LINE("a\tb"),							LineScan::LINE_OK,		true},
+		{"overlong 2 bytes",	LINE("a\xC0\x80"),						LineScan::LINE_ENCODING, true},
+		{"overlong C1",			LINE("a\xC1\xBF"),						LineScan::LINE_ENCODING, true},
+		{"overlong 3 bytes",	LINE("a\xE0\x80\xAF"),					LineScan::LINE_ENCODING, true},
+		{"overlong 4 bytes",	LINE("a\xF0\x80\x80\xAF"),				LineScan::LINE_ENCODING, true},
+		{"surrogate",			LINE("a\xED\xA0\x80"),					LineScan::LINE_ENCODING, true},
+		{"past U+10FFFF",		LINE("a\xF4\x90\x80\x80"),				LineScan::LINE_ENCODING, true},
+		{"lone continuation",	LINE("a\x80z"),							LineScan::LINE_ENCODING, true},
+		{"cut at the end",		LINE("a\xE2\x82"),						LineScan::LINE_ENCODING, true},
+		{"ascii after lead",	LINE("a\xC3z"),							LineScan::LINE_ENCODING, true},
+		{"NUL",					LINE("a\0b"),							LineScan::LINE_CONTROL,	true},
+		{"bell",				LINE("a\x07" "b"),						LineScan::LINE_CONTROL,	true},
+		{"DEL",					LINE("a\x7F" "b"),						LineScan::LINE_CONTROL,	true},
+		{"control in arg",		LINE("PRIVMSG a\x01" "b :hi"),			LineScan::LINE_CONTROL,	false},
+		{"control in channel",	LINE("JOIN #c\x02"),					LineScan::LINE_CONTROL,	false},
+		{"NUL in arg",			LINE("NICK a\0b"),						LineScan::LINE_CONTROL,	false},
+		{"UTF-8 in arg",		LINE("NICK caf\xC3\xA9"),				LineScan::LINE_OK,		false},
+		{"overlong in arg",		LINE("NICK a\xC0\x80"),					LineScan::LINE_ENCODING, false},
+		{"bad channel",			LINE("JOIN #ok,#b\"ad"),				LineScan::LINE_BAD_CHANNEL, false},
+		{"bad arg",				LINE("MODE a:b +i"),					LineScan::LINE_BAD_ARG,	false},
+	};
+
+	#undef LINE
+
+	bool	sameResult(const LineScan &a, const LineScan &b)
+	{
+		if (a.getVerdict() != b.getVerdict() || a.getBadStart() != b.getBadStart() ||
+			a.getBadLength() != b.getBadLength() || a.getTokenCount() != b.getTokenCount() ||
+			a.hasTrailing() != b.hasTrailing() || a.getTrailingStart() != b.getTrailingStart() ||
+			a.getTrailingLength() != b.getTrailingLength())
+			return false;
+		for (size_t i = 0; i < a.getTokenCount(); ++i)
+			if (a.getTokenStart(i) != b.getTokenStart(i) || a.getTokenLength(i) != b.getTokenLength(i))
+				return false;
+		return true;
+	}
+
+	void	checkLine(const Case &test, const std::string &line)
+	{
+		LineScan::setChunking(LineScan::CHUNK_NONE);
+		LineScan	bytes(line);
+		LineScan::setChunking(LineScan::CHUNK_WORDS);
+		LineScan	words(line);
+		LineScan::setChunking(LineScan::CHUNK_SSE2);
+		LineScan	sse2(line);
+
+		if (bytes.getVerdict() != test.verdict)
+			std::cerr << "case \"" << test.name << "\"" << std::endl;
+		CHECK_EQ(bytes.getVerdict(), test.verdict);
+		CHECK(sameResult(bytes, words));
+		CHECK(sameResult(bytes, sse2));
+	}
+}
+
+void	testLineScanChunking()
+{
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+	{
+		const Case			&test = cases[i];
+		const std::string	payload(test.line, test.size);
+
+		if (!test.inTrailing)
+		{
+			checkLine(test, payload);
+			checkLine(test, payload + " :" + std::string(SHIFTS, 'x'));
+			continue ;
+		}
+		for (size_t shift = 0; shift < SHIFTS; ++shift)
+		{
+			std::string	line = "PRIVMSG #chan :" + std::string(shift, 'x') + payload;
+			checkLine(test, line);
+			checkLine(test, line + std::string(SHIFTS - shift, 'y') + "  ");
+		}
+	}
+}
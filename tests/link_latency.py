@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+# Cross-link delivery latency (make latency)
+# ------------------------------------------------------------------------------
+# Starts two ircserv instances on localhost, links the second one to the first
+# and times PRIVMSG round-trips: alice (on a.net) sends "ping <n>" to bob (on
+# b.net), bob answers "pong <n>", so every sample crosses the link twice. The
+# same is measured with both users on one server as the baseline.
+# The flood control allows FLOOD_RATE lines per second, so the pings are paced
+# (--interval); the servers run in temporary folders (log.txt, snapshots).
+import argparse
+import os
+import shutil
+import signal
+import socket
+import subprocess
+import tempfile
+import time
+
+PASSWORD = '42'
+
+
+class Client:
+	def __init__(self, nick, port):
+		self.nick = nick
+		self.sock = socket.create_connection(('127.0.0.1', port))
+		self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+		self.buffer = b''
+		self.send('PASS ' + PASSWORD)
+		self.send('NICK ' + nick)
+		self.send('USER %s * * :%s' % (nick, nick))
+		self.expect(' 001 ')
+
+	def send(self, line):
+		self.sock.sendall((line + '\r\n').encode())
+
+	# Reads until a line contains text, answers PINGs of the server on the way
+	def expect(self, text, timeout=5.0):
+		end = time.time() + timeout
+		while True:
+			while b'\n' in self.buffer:
+				line, self.buffer = self.buffer.split(b'\n', 1)
+				line = line.decode(errors='replace').rstrip('\r')
+				if line.startswith('PING '):
+					self.send('PONG ' + line[5:])
+				elif text in line:
+					return line
+			left = end - time.time()
+			if left <= 0:
+				raise RuntimeError('%s: no "%s" within %.1fs' % (self.nick, text.strip(), timeout))
+			self.sock.settimeout(left)
+			data = self.sock.recv(65536)
+			if not data:
+				raise RuntimeError('%s: connection closed' % self.nick)
+			self.buffer += data
+
+	def close(self):
+		self.sock.close()
+
+
+def start(binary, port, args):
+	folder = tempfile.mkdtemp(prefix='ircserv-latency-')
+	process = subprocess.Popen([binary, str(port), PASSWORD] + args, cwd=folder,
+		stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+	for _ in range(50):
+		try:
+			socket.create_connection(('127.0.0.1', port)).close()
+			return process, folder
+		except OSError:
+			time.sleep(0.1)
+	raise RuntimeError('ircserv on port %d did not start' % port)
+
+
+def stop(process, folder):
+	process.send_signal(signal.SIGINT)
+	try:
+		process.wait(5)
+	except subprocess.TimeoutExpired:
+		process.kill()
+		process.wait()
+	shutil.rmtree(folder, ignore_errors=True)
+
+
+# bob answers every ping of alice; returns the round-trips in microseconds
+def measure(alice, bob, count, interval):
+	samples = []
+	for n in range(count):
+		start = time.perf_counter()
+		alice.send('PRIVMSG %s :ping %d' % (bob.nick, n))
+		bob.expect('PRIVMSG %s :ping %d' % (bob.nick, n))
+		bob.send('PRIVMSG %s :pong %d' % (alice.nick, n))
+		alice.expect('PRIVMSG %s :pong %d' % (alice.nick, n))
+		samples.append((time.perf_counter() - start) * 1e6)
+		time.sleep(interval)
+	return samples
+
+
+def report(name, samples):
+	samples = sorted(samples)
+	def percentile(p):
+		return samples[min(len(samples) - 1, int(len(samples) * p / 100))]
+	print('%-12s n=%-4d min %7.0f  p50 %7.0f  p90 %7.0f  p99 %7.0f  max %7.0f  (us round-trip)' % (
+		name, len(samples), samples[0], percentile(50), percentile(90), percentile(99), samples[-1]))
+
+
+def main():
+	parser = argparse.ArgumentParser(description='PRIVMSG round-trips over a server link')
+	parser.add_argument('--binary', default=os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'ircserv'))
+	parser.add_argument('--port', type=int, default=6790, help='a.net listens here, b.net on the next port')
+	parser.add_argument('--count', type=int, default=100)
+	parser.add_argument('--interval', type=float, default=0.25, help='seconds between pings (flood control)')
+	options = parser.parse_args()
+	binary = os.path.abspath(options.binary)
+
+	servers = []
+	clients = []
+	try:
+		servers.append(start(binary, options.port, ['a.net']))
+		servers.append(start(binary, options.port + 1, ['b.net', '127.0.0.1:%d' % options.port]))
+		alice = Client('alice', options.port)
+		bob = Client('bob', options.port + 1)
+		carol = Client('carol', options.port)
+		clients = [alice, bob, carol]
+
+		# bob is known on a.net once the burst went through
+		for _ in range(50):
+			alice.send('WHOIS bob')
+			if ' 311 ' in alice.expect(' bob '):
+				break
+			time.sleep(0.1)
+		else:
+			raise RuntimeError('the servers did not link')
+
+		report('local', measure(alice, carol, options.count, options.interval))
+		report('cross-link', measure(alice, bob, options.count, options.interval))
+	finally:
+		for client in clients:
+			client.close()
+		for process, folder in reversed(servers):
+			stop(process, folder)
+
+
+if __name__ == '__main__':
+	main()
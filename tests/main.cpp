@@ -0,0 +1,33 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   main.cpp                                           :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/26 16:02:18 by astein            #+#    #+#             */
+/*   Updated: 2024/05/26 16:02:18 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "tests.hpp"
+#include "Logger.hpp"
+#include "AllocScope.hpp"
+
+int	tests::failures = 0;
+int	tests::checks = 0;
+
+int	main()
+{
+	if (!AllocScope::isEnabled())
+	{
+		std::cerr << "the tests need the allocation counting build (make test)" << std::endl;
+		return 1;
+	}
+	// The log file isn't opened; log() has to cost nothing then
+	Logger::deactivateLogger();
+	testAllocations();
+	testLineScanChunking();
+	std::cout << tests::checks << " checks, " << tests::failures << " failed" << std::endl;
+	return tests::failures ? 1 : 0;
+}
@@ -0,0 +1,53 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   tests.hpp                                          :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: astein <astein@student.42lisboa.com>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2024/05/26 16:02:18 by astein            #+#    #+#             */
+/*   Updated: 2024/05/26 16:02:18 by astein           ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef TESTS_HPP
+#define TESTS_HPP
+
+#include <iostream>
+
+// make test: a small driver on the allocation counting build
+// -----------------------------------------------------------------------------
+// Every test function runs its checks with CHECK(); a failed check is printed
+// with its line and counted, main() returns non-zero if any failed.
+#define CHECK(expr)		tests::check((expr), #expr, __FILE__, __LINE__)
+#define CHECK_EQ(a, b)	tests::checkEqual((a), (b), #a " == " #b, __FILE__, __LINE__)
+
+namespace tests
+{
+	extern int	failures;
+	extern int	checks;
+
+	inline void	check(bool ok, const char *expr, const char *file, int line)
+	{
+		checks++;
+		if (ok)
+			return ;
+		failures++;
+		std::cerr << file << ":" << line << ": FAILED " << expr << std::endl;
+	}
+
+	template <typename A, typename B>
+	void	checkEqual(const A &a, const B &b, const char *expr, const char *file, int line)
+	{
+		checks++;
+		if (a == b)
+			return ;
+		failures++;
+		std::cerr << file << ":" << line << ": FAILED " << expr << " (" << a << " vs " << b << ")" << std::endl;
+	}
+}
+
+void	testAllocations();
+void	testLineScanChunking();
+
+#endif